@@ -0,0 +1,11 @@
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = qtlog-bench
+
+SOURCES += \
+        main.cpp
+
+include(../qtlog/qtlog.pri)
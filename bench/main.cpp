@@ -0,0 +1,336 @@
+﻿#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSemaphore>
+#include <QStringList>
+#include <QVector>
+#include <QtDebug>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include "qtlog.h"
+
+/**
+ * qtlog-bench
+ * 日志管线(outputMessage到LogFileObject::write)吞吐和单次调用延迟基准测试
+ *
+ * 用法: qtlog-bench [--messages N] [--json result.json] [--filter name] [--dir logdir] [--async]
+ * 每个场景写入N条日志(多线程场景平均分配)，记录每次调用耗时，输出平均值和分位数。
+ * 控制台场景会向stderr输出日志，建议运行时重定向 2>/dev/null
+ * 未指定--dir时日志写入临时目录，退出时删除
+ */
+
+Q_LOGGING_CATEGORY(benchCategory, "bench.pipeline")
+
+/** 一个测试场景的配置 */
+struct Scenario{
+    QString group;
+    QString name;
+    int threads = 1;
+    int size = 64;
+    bool category = false;
+    bool console = false;
+    bool flush = false;
+    quint32 maxSize = 0;
+};
+
+/** 一个场景的测试结果，延迟单位ns */
+struct Result{
+    Scenario scenario;
+    qint64 messages = 0;
+    double seconds = 0;
+    double mean = 0;
+    qint64 p50 = 0;
+    qint64 p90 = 0;
+    qint64 p99 = 0;
+    qint64 p999 = 0;
+    qint64 max = 0;
+};
+
+class BenchWorker : public QThread{
+public:
+    BenchWorker(const QByteArray &payload, int count, QSemaphore *start):
+        payload_(payload),count_(count),start_(start){
+    }
+
+    QVector<qint64> latencies;
+
+protected:
+    void run(){
+        latencies.resize(count_);
+        start_->acquire();
+
+        QElapsedTimer timer;
+        timer.start();
+        const char* payload = payload_.constData();
+        for(int i = 0; i < count_; i++){
+            qint64 begin = timer.nsecsElapsed();
+            qCDebug(benchCategory, "%s", payload);
+            latencies[i] = timer.nsecsElapsed() - begin;
+        }
+    }
+
+private:
+    QByteArray payload_;
+    int count_;
+    QSemaphore* start_;
+};
+
+static qint64 percentile(const QVector<qint64> &sorted, double p)
+{
+    if(sorted.isEmpty())
+        return 0;
+    int index = static_cast<int>(p * (sorted.size() - 1) + 0.5);
+    return sorted[qBound(0, index, sorted.size() - 1)];
+}
+
+/** 设置日志目录和applied中的全部选项并安装处理函数，只在开始时调用一次 */
+static void setup(const Scenario &applied, QString &logdir)
+{
+    qtlog::setqtLogDestination(QDEBUG, logdir);
+    qtlog::setqtCategoryModeLogDestination(logdir);
+
+    qtlog::setqtLogCategoryMode(applied.category);
+    qtlog::setPrintToConsole(applied.console);
+    qtlog::setqtLogShouldflush(applied.flush);
+    qtlog::setqtLogMaxSize(applied.maxSize);
+    qtlog::qInstallHandlers();
+}
+
+/** 只修改与上一个场景不同的选项，applied记录当前生效的选项 */
+static void configure(const Scenario &scenario, Scenario &applied)
+{
+    qtlog::flushqtLogNow();
+
+    if(scenario.console != applied.console)
+        qtlog::setPrintToConsole(scenario.console);
+    if(scenario.flush != applied.flush)
+        qtlog::setqtLogShouldflush(scenario.flush);
+    if(scenario.maxSize != applied.maxSize)
+        qtlog::setqtLogMaxSize(scenario.maxSize);
+    if(scenario.category != applied.category){
+        qtlog::setqtLogCategoryMode(scenario.category);
+        /** 日志格式是否包含分类名随模式变化，需重新编译 */
+        qtlog::qInstallHandlers();
+    }
+    applied = scenario;
+}
+
+static Result runScenario(const Scenario &scenario, qint64 messages, Scenario &applied)
+{
+    configure(scenario, applied);
+
+    QByteArray payload(scenario.size, 'x');
+    int perThread = static_cast<int>(qMax<qint64>(1, messages / scenario.threads));
+
+    /** 预热：创建日志文件、分类和格式缓存 */
+    for(int i = 0; i < 1000; i++)
+        qCDebug(benchCategory, "%s", payload.constData());
+    qtlog::flushqtLogNow();
+
+    QSemaphore start;
+    QVector<BenchWorker*> workers;
+    for(int i = 0; i < scenario.threads; i++){
+        BenchWorker* worker = new BenchWorker(payload, perThread, &start);
+        worker->start();
+        workers.append(worker);
+    }
+
+    QElapsedTimer wall;
+    wall.start();
+    start.release(scenario.threads);
+    for(BenchWorker* worker : workers)
+        worker->wait();
+    /** 异步模式下吞吐包含排空队列的时间 */
+    qtlog::flushqtLogNow();
+    qint64 elapsed = wall.nsecsElapsed();
+
+    QVector<qint64> latencies;
+    latencies.reserve(perThread * scenario.threads);
+    for(BenchWorker* worker : workers){
+        latencies += worker->latencies;
+        delete worker;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    Result result;
+    result.scenario = scenario;
+    result.messages = latencies.size();
+    result.seconds = elapsed / 1e9;
+    double total = 0;
+    for(qint64 latency : latencies)
+        total += latency;
+    result.mean = latencies.isEmpty() ? 0 : total / latencies.size();
+    result.p50 = percentile(latencies, 0.50);
+    result.p90 = percentile(latencies, 0.90);
+    result.p99 = percentile(latencies, 0.99);
+    result.p999 = percentile(latencies, 0.999);
+    result.max = latencies.isEmpty() ? 0 : latencies.last();
+    return result;
+}
+
+static QVector<Scenario> scenarios()
+{
+    QVector<Scenario> list;
+    Scenario base;
+    base.group = "baseline";
+    base.name = "single-thread";
+    list.append(base);
+
+    for(int threads : {1, 2, 4, 8, 16, 32, 64}){
+        Scenario s = base;
+        s.group = "threads";
+        s.name = QString("threads-%1").arg(threads);
+        s.threads = threads;
+        list.append(s);
+    }
+
+    for(bool category : {false, true}){
+        Scenario s = base;
+        s.group = "routing";
+        s.name = category ? "category-mode" : "severity-mode";
+        s.category = category;
+        list.append(s);
+    }
+
+    for(bool console : {false, true}){
+        Scenario s = base;
+        s.group = "console";
+        s.name = console ? "console-on" : "console-off";
+        s.console = console;
+        list.append(s);
+    }
+
+    for(bool flush : {false, true}){
+        Scenario s = base;
+        s.group = "flush";
+        s.name = flush ? "flush-on" : "flush-off";
+        s.flush = flush;
+        list.append(s);
+    }
+
+    for(int size : {16, 64, 256, 1024, 4096}){
+        Scenario s = base;
+        s.group = "size";
+        s.name = QString("size-%1").arg(size);
+        s.size = size;
+        list.append(s);
+    }
+
+    /** 1M切换一次文件，1K消息约每千条切换一次 */
+    Scenario rotation = base;
+    rotation.group = "rotation";
+    rotation.name = "rotate-1M";
+    rotation.size = 1024;
+    rotation.maxSize = 1;
+    list.append(rotation);
+    return list;
+}
+
+static QJsonObject toJson(const Result &result)
+{
+    QJsonObject latency;
+    latency["mean"] = result.mean;
+    latency["p50"] = static_cast<double>(result.p50);
+    latency["p90"] = static_cast<double>(result.p90);
+    latency["p99"] = static_cast<double>(result.p99);
+    latency["p999"] = static_cast<double>(result.p999);
+    latency["max"] = static_cast<double>(result.max);
+
+    QJsonObject object;
+    object["group"] = result.scenario.group;
+    object["name"] = result.scenario.name;
+    object["threads"] = result.scenario.threads;
+    object["messageSize"] = result.scenario.size;
+    object["categoryMode"] = result.scenario.category;
+    object["console"] = result.scenario.console;
+    object["shouldFlush"] = result.scenario.flush;
+    object["maxSizeMB"] = static_cast<int>(result.scenario.maxSize);
+    object["messages"] = static_cast<double>(result.messages);
+    object["seconds"] = result.seconds;
+    object["messagesPerSecond"] = result.seconds > 0 ? result.messages / result.seconds : 0;
+    object["latencyNs"] = latency;
+    return object;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    qint64 messages = 200000;
+    QString json;
+    QString filter;
+    QString logdir = QDir::tempPath() + QString("/qtlog-bench-%1/").arg(QCoreApplication::applicationPid());
+    /** 未指定--dir时使用的临时目录在退出时删除 */
+    bool temporary = true;
+    bool async = false;
+
+    QStringList arguments = a.arguments();
+    for(int i = 1; i < arguments.size(); i++){
+        const QString &arg = arguments[i];
+        if(arg == "--messages" && i + 1 < arguments.size())
+            messages = arguments[++i].toLongLong();
+        else if(arg == "--json" && i + 1 < arguments.size())
+            json = arguments[++i];
+        else if(arg == "--filter" && i + 1 < arguments.size())
+            filter = arguments[++i];
+        else if(arg == "--dir" && i + 1 < arguments.size()){
+            logdir = arguments[++i];
+            temporary = false;
+        }
+        else if(arg == "--async")
+            async = true;
+        else{
+            fprintf(stderr, "usage: qtlog-bench [--messages N] [--json result.json] [--filter name] [--dir logdir] [--async]\n");
+            return 2;
+        }
+    }
+    if(!logdir.endsWith('/'))
+        logdir.append('/');
+
+    qtlog::setAsyncMode(async);
+    Scenario applied;
+    setup(applied, logdir);
+
+    QJsonArray results;
+    printf("%-16s %7s %8s %12s %9s %9s %9s %9s %10s\n",
+           "scenario", "threads", "size", "msgs/s", "mean", "p50", "p99", "p99.9", "max(ns)");
+    for(const Scenario &scenario : scenarios()){
+        if(!filter.isEmpty() && !scenario.name.contains(filter) && !scenario.group.contains(filter))
+            continue;
+        Result result = runScenario(scenario, messages, applied);
+        printf("%-16s %7d %8d %12.0f %9.0f %9lld %9lld %9lld %10lld\n",
+               qPrintable(scenario.name), scenario.threads, scenario.size,
+               result.seconds > 0 ? result.messages / result.seconds : 0.0, result.mean,
+               static_cast<long long>(result.p50), static_cast<long long>(result.p99),
+               static_cast<long long>(result.p999), static_cast<long long>(result.max));
+        fflush(stdout);
+        results.append(toJson(result));
+    }
+
+    qtlog::setAsyncMode(false);
+    qtlog::flushqtLogNow();
+    if(temporary)
+        QDir(logdir).removeRecursively();
+
+    if(!json.isEmpty()){
+        QJsonObject root;
+        root["format"] = 1;
+        root["qtVersion"] = QString(qVersion());
+        root["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+        root["async"] = async;
+        root["messagesPerScenario"] = static_cast<double>(messages);
+        root["results"] = results;
+
+        QFile file(json);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+            fprintf(stderr, "qtlog-bench: cannot write %s\n", qPrintable(json));
+            return 1;
+        }
+        file.write(QJsonDocument(root).toJson());
+    }
+    return 0;
+}
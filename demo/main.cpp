@@ -18,6 +18,7 @@ int main(int argc, char *argv[])
     qint64 secs;
     bool category;
     bool ImmediatelyFlush;
+    bool async;
 
     QString settingsPath = QCoreApplication::applicationDirPath()+"/settings.ini";
     QSettings settings_(settingsPath,QSettings::IniFormat);
@@ -97,6 +98,14 @@ int main(int argc, char *argv[])
     else{
         ImmediatelyFlush = settings_.value("ImmediatelyFlush").toBool();
     }
+    /** 异步写入模式,日志由后台线程写入文件,默认不开启 */
+    if(!settings_.contains("Async")){
+        settings_.setValue("Async",false);
+        async = false;
+    }
+    else{
+        async = settings_.value("Async").toBool();
+    }
     settings_.endGroup();
 
     /** dump导出地址设置 */
@@ -118,6 +127,7 @@ int main(int argc, char *argv[])
     qtlog::setqtLogbuffsecs(secs);
     qtlog::setqtLogShouldflush(ImmediatelyFlush);
     qtlog::setqtLogCategoryMode(category);
+    qtlog::setAsyncMode(async);
     if(category)
         qtlog::setqtCategoryModeLogDestination(logpath);
     else{
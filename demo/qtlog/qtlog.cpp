@@ -1,29 +1,110 @@
 ﻿#include "qtlog.h"
+#include "qtlogformat.h"
+#include "qtlogcrc32c.h"
+#include "qtlogring.h"
 #include <QLoggingCategory>
 #include <QtCore/qglobal.h>
 #include <qlogging.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <QFile>
+#include <QSemaphore>
+#include <QWaitCondition>
+#include <QTextCodec>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QVector>
+#include <QHash>
+#include <QThreadPool>
+#include <QRunnable>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <new>
+
+/** 旧日志文件压缩，Windows下使用Qt自带的zlib */
+#if defined(Q_OS_WIN)
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+#ifdef QTLOG_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/** 结构化输出的字符串转义，x86下使用SSE2批量判断无需转义的ASCII字符 */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QTLOG_ESCAPE_SSE2
+#include <emmintrin.h>
+#endif
 
 #ifdef Q_OS_WIN
 #include<windows.h>
+#include <io.h>
 #endif
 
 #ifdef Q_OS_UNIX
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
 #endif
 
 bool fileLine = false;
 static quint32 g_max_log_size = 0;
 static qint64 logbufsecs = 5;
-static bool stop_writing = false;
+/** 磁盘已满时停止写入文件，由LogRetention线程定时检查可用空间后设置 */
+static std::atomic<bool> stop_writing{false};
 static bool should_flush = false;
 static bool is_to_console = true;
+static int file_backend = qtlog::FileBackendQFile;
+static quint32 mmap_chunk_size = 8;
+static bool mmap_sync_flush = false;
+static int compression_mode = qtlog::CompressionNone;
+static int compression_level = -1;
+static int compression_threads = 1;
+static int compression_io_priority = -1;
+static bool background_flush = true;
+static bool time_index = true;
+static bool block_framing = false;
+static int block_size = 64 * 1024;
+static bool block_compress = false;
+static int output_format = qtlog::OutputText;
+static qint64 retention_max_bytes = 0;
+static int retention_max_files = 0;
+static qint64 retention_max_age = 0;
+static qint64 min_free_space = 0;
+/** 磁盘空间不足时低于该等级的日志不写入文件 */
+static std::atomic<int> shed_severity{QDEBUG};
+static std::atomic<quint64> shed_total{0};
+static std::atomic<quint64> retention_deleted{0};
+/** 网络日志暂存区上限和发送统计，见LogNetworkSink */
+static qint64 network_spill_limit = 4 * 1024 * 1024;
+static std::atomic<quint64> network_sent{0};
+static std::atomic<quint64> network_dropped{0};
+static std::atomic<quint64> network_fallback{0};
+/** 低于该等级的日志不写入日志文件，开启飞行记录器时设置 */
+static std::atomic<int> file_min_severity{QDEBUG};
+/** fatal日志返回前刷新全部日志目标的时间上限(毫秒，不大于0时只写入fatal日志所在文件)和是否同步到磁盘 */
+static qint64 fatal_flush_timeout = 2000;
+static bool fatal_flush_sync = false;
 const char*const LogSeverityNames[NUM_SEVERITIES] = {
     "DEBUG","INFO", "WARNING", "ERROR", "FATAL"
 };
@@ -31,37 +112,262 @@ const char*const LogSeverityNames[NUM_SEVERITIES] = {
 static QString dump_path;
 
 /**
- * @brief DayHasChanged
- * @param day
- * @return
- * @details 此函数多线程使用不安全，调用前确保加锁互斥
+ * @brief The LogClock class
+ * @details 共享的粗粒度时钟。当前秒、下一个本地零点以及预先渲染的"hh:mm:ss"文本每秒只刷新一次，
+ * 读取时只需一次单调时钟读取加整数比较，毫秒由单调时钟推算。
+ * 刷新时写者加锁并通过序号(seqlock)发布，读者不加锁，读到序号变化时重读
  */
-static bool DayHasChanged( qint32 &day)
+class LogClock{
+public:
+    struct Snapshot{
+        qint64 msecs;           ///< 当前时间，epoch毫秒
+        qint64 secs;            ///< 当前时间，epoch秒
+        int msec;               ///< 毫秒部分
+        int year;
+        int month;
+        int day;
+        int hour;
+        int minute;
+        int second;
+        char hms[8];            ///< 预渲染的"hh:mm:ss"
+    };
+
+    /** 当前epoch秒 */
+    static qint64 nowSecs();
+
+    /** 当前epoch毫秒 */
+    static qint64 nowMSecs();
+
+    /** 下一个本地零点的epoch秒，用于日志按天切分 */
+    static qint64 nextMidnight();
+
+    /** 当前时间的完整快照，格式化时间戳使用 */
+    static void now(Snapshot *snapshot);
+
+    /** 指定epoch毫秒的快照，按QDateTime换算，只用于补写延迟写入的日志 */
+    static void at(qint64 msecs, Snapshot *snapshot);
+
+private:
+    static qint64 monotonicMSecs();
+    static qint64 currentMSecs();
+    static void refresh(qint64 msecs);
+
+    static QElapsedTimer& timer();
+
+    static QMutex mutex_;
+    static std::atomic<quint32> seq_;
+    /** 单调时钟到墙上时钟的偏移，每秒刷新时重新校准 */
+    static std::atomic<qint64> offset_;
+    static std::atomic<qint64> second_;
+    static std::atomic<qint64> next_midnight_;
+    static std::atomic<int> date_;
+    static std::atomic<int> time_;
+    static std::atomic<quint64> hms_;
+};
+
+QMutex LogClock::mutex_;
+std::atomic<quint32> LogClock::seq_(0);
+std::atomic<qint64> LogClock::offset_(0);
+std::atomic<qint64> LogClock::second_(-1);
+std::atomic<qint64> LogClock::next_midnight_(0);
+std::atomic<int> LogClock::date_(0);
+std::atomic<int> LogClock::time_(0);
+std::atomic<quint64> LogClock::hms_(0);
+
+QElapsedTimer& LogClock::timer()
 {
-    time_t raw_time;
-    struct tm* tm_info;
+    static QElapsedTimer timer = []() -> QElapsedTimer {
+        QElapsedTimer t;
+        t.start();
+        return t;
+    }();
+    return timer;
+}
 
-    time(&raw_time);
-    tm_info = localtime(&raw_time);
+inline qint64 LogClock::monotonicMSecs()
+{
+    return timer().elapsed();
+}
 
-    if (tm_info->tm_mday != day)
-    {
-        day = tm_info->tm_mday;
-        return true;
+inline qint64 LogClock::currentMSecs()
+{
+    qint64 msecs = monotonicMSecs() + offset_.load(std::memory_order_relaxed);
+    if(msecs / 1000 != second_.load(std::memory_order_relaxed)){
+        refresh(msecs);
+        msecs = monotonicMSecs() + offset_.load(std::memory_order_relaxed);
     }
+    return msecs;
+}
 
-    return false;
+void LogClock::refresh(qint64 msecs)
+{
+    QMutexLocker locker(&mutex_);
+    /** 其他线程已刷新到同一秒 */
+    if(msecs / 1000 == second_.load(std::memory_order_relaxed)
+            && second_.load(std::memory_order_relaxed) >= 0)
+        return;
+
+    /** 以墙上时钟重新校准，系统时间调整在一秒内生效 */
+    qint64 wall = QDateTime::currentMSecsSinceEpoch();
+    qint64 mono = monotonicMSecs();
+    QDateTime local = QDateTime::fromMSecsSinceEpoch(wall);
+    QDate date = local.date();
+    QTime time = local.time();
+
+    char hms[8] = {
+        static_cast<char>('0' + time.hour() / 10), static_cast<char>('0' + time.hour() % 10), ':',
+        static_cast<char>('0' + time.minute() / 10), static_cast<char>('0' + time.minute() % 10), ':',
+        static_cast<char>('0' + time.second() / 10), static_cast<char>('0' + time.second() % 10)
+    };
+    quint64 packed = 0;
+    memcpy(&packed, hms, sizeof(packed));
+
+    int packed_date = date.year() * 10000 + date.month() * 100 + date.day();
+    qint64 next_midnight = next_midnight_.load(std::memory_order_relaxed);
+    if(packed_date != date_.load(std::memory_order_relaxed) || next_midnight == 0)
+        next_midnight = QDateTime(date.addDays(1), QTime(0, 0)).toSecsSinceEpoch();
+
+    seq_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    offset_.store(wall - mono, std::memory_order_relaxed);
+    second_.store(wall / 1000, std::memory_order_relaxed);
+    next_midnight_.store(next_midnight, std::memory_order_relaxed);
+    date_.store(packed_date, std::memory_order_relaxed);
+    time_.store(time.hour() * 10000 + time.minute() * 100 + time.second(), std::memory_order_relaxed);
+    hms_.store(packed, std::memory_order_relaxed);
+    seq_.fetch_add(1, std::memory_order_release);
+}
+
+qint64 LogClock::nowSecs()
+{
+    return currentMSecs() / 1000;
+}
+
+qint64 LogClock::nowMSecs()
+{
+    return currentMSecs();
+}
+
+qint64 LogClock::nextMidnight()
+{
+    currentMSecs();
+    return next_midnight_.load(std::memory_order_relaxed);
+}
+
+void LogClock::now(Snapshot *snapshot)
+{
+    qint64 msecs = currentMSecs();
+    quint32 seq;
+    int date;
+    int time;
+    quint64 hms;
+    qint64 second;
+    do{
+        seq = seq_.load(std::memory_order_acquire);
+        date = date_.load(std::memory_order_relaxed);
+        time = time_.load(std::memory_order_relaxed);
+        hms = hms_.load(std::memory_order_relaxed);
+        second = second_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }while((seq & 1) || seq != seq_.load(std::memory_order_relaxed));
+
+    /** 读取期间跨秒时毫秒取整到缓存的秒，保证文本与毫秒一致 */
+    if(msecs / 1000 != second)
+        msecs = msecs / 1000 > second ? second * 1000 + 999 : second * 1000;
+
+    snapshot->msecs = msecs;
+    snapshot->secs = second;
+    snapshot->msec = static_cast<int>(msecs % 1000);
+    snapshot->year = date / 10000;
+    snapshot->month = date / 100 % 100;
+    snapshot->day = date % 100;
+    snapshot->hour = time / 10000;
+    snapshot->minute = time / 100 % 100;
+    snapshot->second = time % 100;
+    memcpy(snapshot->hms, &hms, sizeof(snapshot->hms));
+}
+
+void LogClock::at(qint64 msecs, Snapshot *snapshot)
+{
+    QDateTime local = QDateTime::fromMSecsSinceEpoch(msecs);
+    QDate date = local.date();
+    QTime time = local.time();
+    snapshot->msecs = msecs;
+    snapshot->secs = msecs / 1000;
+    snapshot->msec = time.msec();
+    snapshot->year = date.year();
+    snapshot->month = date.month();
+    snapshot->day = date.day();
+    snapshot->hour = time.hour();
+    snapshot->minute = time.minute();
+    snapshot->second = time.second();
+    const char hms[8] = {
+        static_cast<char>('0' + time.hour() / 10), static_cast<char>('0' + time.hour() % 10), ':',
+        static_cast<char>('0' + time.minute() / 10), static_cast<char>('0' + time.minute() % 10), ':',
+        static_cast<char>('0' + time.second() / 10), static_cast<char>('0' + time.second() % 10)
+    };
+    memcpy(snapshot->hms, hms, sizeof(snapshot->hms));
 }
 
 static quint32 MaxLogSize(){
     return (g_max_log_size > 0 ? g_max_log_size : 10);
 }
 
-static qint64 CycleClock_Now(){
-    QDateTime qdtime;
-    return qdtime.currentDateTime().toSecsSinceEpoch();
+static inline qint64 CycleClock_Now(){
+    return LogClock::nowSecs();
+}
+
+/** 统计耗时用的单调时钟，单位ns */
+static inline quint64 MonotonicNanos(){
+    return static_cast<quint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/** 距deadline(MonotonicNanos)剩余的毫秒数，已超时返回0 */
+static inline int RemainingMSecs(quint64 deadline){
+    quint64 now = MonotonicNanos();
+    return now >= deadline ? 0 : static_cast<int>(qMin<quint64>((deadline - now + 999999) / 1000000, INT_MAX));
 }
 
+/**
+ * @brief The LogHistogram struct
+ * @details 耗时直方图累加器，只在LogFileObject的文件锁内更新，stats()不加锁读取
+ */
+struct LogHistogram{
+    LogHistogram(){
+        for(int i = 0; i < qtlog::LatencyBuckets; i++)
+            buckets[i].store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    void record(quint64 nanos){
+        int bucket = 0;
+        for(quint64 value = nanos >> 1; value && bucket < qtlog::LatencyBuckets - 1; value >>= 1)
+            bucket++;
+        /** 单一写入者，不需要原子加 */
+        buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + nanos, std::memory_order_relaxed);
+        if(nanos > max.load(std::memory_order_relaxed))
+            max.store(nanos, std::memory_order_relaxed);
+    }
+
+    void addTo(qtlog::LatencyHistogram &histogram) const{
+        for(int i = 0; i < qtlog::LatencyBuckets; i++)
+            histogram.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+        histogram.count += count.load(std::memory_order_relaxed);
+        histogram.totalNs += total.load(std::memory_order_relaxed);
+        histogram.maxNs = qMax(histogram.maxNs, max.load(std::memory_order_relaxed));
+    }
+
+    std::atomic<quint64> buckets[qtlog::LatencyBuckets];
+    std::atomic<quint64> count;
+    std::atomic<quint64> total;
+    std::atomic<quint64> max;
+};
+
 static void GetHostName(std::string* hostname) {
 #if defined(Q_OS_LINUX)
     char hostname_[60] = {0};
@@ -135,28 +441,22 @@ bool shouldLogToStderr()
 #else
 
 #if defined(Q_OS_UNIX)
-static bool unix_message_handler(QtMsgType type,
-                                 const QMessageLogContext &context,
-                                 const QString &message)
+static bool unix_message_handler(const QByteArray &formattedMessage)
 {
     if (shouldLogToStderr())
         return false; // Leave logging up to stderr handler
-    QString formattedMessage = qFormatLogMessage(type, context, message);
 
-    if (!formattedMessage.isNull()){
-        fprintf(stderr, "%s\n", formattedMessage.toLocal8Bit().constData());
-        fflush(stderr);
-    }
+    fwrite(formattedMessage.constData(), 1, static_cast<size_t>(formattedMessage.size()), stderr);
+    fflush(stderr);
     return true; // Prevent further output to stderr
 }
 #endif
 #ifdef Q_OS_WIN
-static bool win_message_handler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+static bool win_message_handler(const QByteArray &formatted)
 {
     if (shouldLogToStderr())
         return false; // Leave logging up to stderr handler
-    QString formattedMessage = qFormatLogMessage(type, context, message);
-    formattedMessage.append(QLatin1Char('\n'));
+    QString formattedMessage = QString::fromLocal8Bit(formatted);
     OutputDebugString(reinterpret_cast<const wchar_t *>(formattedMessage.utf16()));
     return true; // Prevent further output to stderr
 }
@@ -165,379 +465,5687 @@ static bool win_message_handler(QtMsgType type, const QMessageLogContext &contex
 
 
 // --------------------------------------------------------------------------
-static void stderr_message_handler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+static void stderr_message_handler(const QByteArray &formattedMessage)
 {
-    QString formattedMessage = qFormatLogMessage(type, context, message);
-    // print nothing if message pattern didn't apply / was empty.
-    // (still print empty lines, e.g. because message itself was empty)
-    if (formattedMessage.isNull())
-        return;
-    fprintf(stderr, "%s\n", formattedMessage.toLocal8Bit().constData());
+    fwrite(formattedMessage.constData(), 1, static_cast<size_t>(formattedMessage.size()), stderr);
     fflush(stderr);
 }
 
-class LogFileObject{
-
+/**
+ * @brief The LogFormatter class
+ * @details 日志格式编译器。qInstallHandlers时将%{...}格式串一次性解析为操作序列，
+ * 每条日志按操作序列直接渲染到线程局部的可复用缓冲区，控制台和日志文件共用同一份渲染结果，
+ * 不再重复调用qFormatLogMessage解释格式串
+ */
+class LogFormatter{
 public:
-    LogFileObject(LogSeverity severity, QString &base_filename);
-    LogFileObject(QByteArray category,QString &base_filename);
-    ~LogFileObject();
-    void setBasename(QString &basename);
-    void write(bool flush, QByteArray &msg );
-    void flushUnlocked();
-    void flush();
+    static void compile(const QString &pattern);
+    /** timestamp和thread非0时按指定的时间和线程渲染(补写网络线程暂存的日志)，否则取当前时间和当前线程 */
+    static QByteArray &render(QtMsgType type, const QMessageLogContext &context, const QString &msg,
+                              qint64 timestamp = 0, quintptr thread = 0);
+    /** 按qtlog::OutputFormat渲染为一行JSON或logfmt记录，与render使用不同的缓冲区，控制台仍输出render的结果 */
+    static QByteArray &renderRecord(QtMsgType type, const QMessageLogContext &context, const QString &msg, int format,
+                                    qint64 timestamp = 0, quintptr thread = 0);
 
 private:
-    bool base_filename_selected_;
-    QString base_filename_;
-    QMutex mutex_;
-    QFile* file_;
-    LogSeverity severity_;
+    enum OpCode{
+        OpLiteral,      ///< 原样输出text
+        OpSeverity,     ///< 按日志等级输出names[severity]，由连续的%{if-xxx}X%{endif}合并而来
+        OpType,         ///< %{type}
+        OpPid,          ///< %{pid}
+        OpAppName,      ///< %{appname}
+        OpThreadPtr,    ///< %{qthreadptr}
+        OpThreadId,     ///< %{threadid}
+        OpFile,         ///< %{file}
+        OpLine,         ///< %{line}
+        OpFunction,     ///< %{function}
+        OpCategory,     ///< %{category}
+        OpMessage,      ///< %{message}
+        OpTimeField,    ///< %{time ...}中的时间字段，arg为字段，width为位数
+        OpTimeHms,      ///< %{time ...}中的"h:mm:ss"/"hh:mm:ss"，直接复制时钟缓存的文本，width为小时位数
+        OpTimeQt,       ///< %{time}，运行时交给QDateTime按ISO格式输出
+        OpTimeProcess,  ///< %{time process}，与Qt相同输出"%6d.%03d"格式的进程运行秒数
+        OpTimeBoot,     ///< %{time boot}，系统启动以来的秒数，格式同上
+        OpIfSeverity,   ///< %{if-xxx}，等级不匹配时跳转到jump
+        OpIfCategory,   ///< %{if-category}，无分类或为default时跳转到jump
+        OpEndif         ///< %{endif}
+    };
+
+    enum TimeField{
+        FieldYear, FieldMonth, FieldDay, FieldHour, FieldMinute, FieldSecond, FieldMsec
+    };
+
+    struct Op{
+        OpCode code = OpLiteral;
+        int arg = 0;
+        int width = 0;
+        int jump = 0;
+        QByteArray text;
+        QByteArray names[NUM_SEVERITIES];
+    };
+
+    /** 编译结果，pid和应用名随编译结果一起发布，发布后只读 */
+    struct Program{
+        QVector<Op> ops;
+        QByteArray pid;
+        QByteArray appname;
+    };
+
+    static void compileTime(Program *program, const QString &format);
+    static void optimize(Program *program);
+    /** 当前线程使用的编译结果，未编译时返回nullptr */
+    static const Program* current();
+    static void appendElapsed(QByteArray &buffer, qint64 msecs);
 
-    QByteArray category_;
-    quint32 file_length_ = 0;
-    quint32 bytes_since_flush_ = 0;
-    qint64 next_flush_time_ = 0;
-
-    qint32 day_;
-
-    bool createLogfile(QString &base_filename);
+    /**
+     * 当前编译结果，mutex_保护，重新编译时替换并递增generation_。各线程缓存结果的引用，
+     * 只在generation_变化时加锁取新结果，最后一个线程切换或退出后旧结果释放
+     */
+    static QSharedPointer<const Program> program_;
+    static std::atomic<quint32> generation_;
+    static QMutex mutex_;
+    /** %{time process}的计时起点，与Qt相同为首次设置格式的时间 */
+    static QElapsedTimer process_timer_;
 };
 
-class LogDestination{
-public:
-    static void setCategoryMode(bool mode);
-    static void setLogDestination(LogSeverity severity,
-                                  QString &pathdir);
-    static void setLogDestination(QString &pathdir);
-
-    static void LogToAllLogfiles(LogSeverity severity, QByteArray &msg, QByteArray &category);
+QSharedPointer<const LogFormatter::Program> LogFormatter::program_;
+std::atomic<quint32> LogFormatter::generation_(0);
+QMutex LogFormatter::mutex_;
+QElapsedTimer LogFormatter::process_timer_;
 
-    static bool getCategoryMode();
+static inline LogSeverity severityOf(QtMsgType type)
+{
+    switch(type)
+    {
+    case QtDebugMsg:
+        return QDEBUG;
+    case QtInfoMsg:
+        return QINFO;
+    case QtWarningMsg:
+        return QWARING;
+    case QtCriticalMsg:
+        return QERROR;
+    case QtFatalMsg:
+        return QFATAL;
+    }
+    return QDEBUG;
+}
 
-    static void flushAllLogs();
+static inline QtMsgType typeOf(LogSeverity severity)
+{
+    switch(severity)
+    {
+    case QINFO:
+        return QtInfoMsg;
+    case QWARING:
+        return QtWarningMsg;
+    case QERROR:
+        return QtCriticalMsg;
+    case QFATAL:
+        return QtFatalMsg;
+    }
+    return QtDebugMsg;
+}
 
-private:
-    LogDestination(LogSeverity severity,QString &base_filename);
-    LogDestination(QByteArray category,QString &base_filename);
-    ~LogDestination();
+static const char*const LogTypeNames[NUM_SEVERITIES] = {
+    "debug", "info", "warning", "critical", "fatal"
+};
 
-    /** LogDestination的文件句柄 */
-    LogFileObject fileobject_;
+static inline void appendNumber(QByteArray &out, quint64 value, int base = 10, int width = 0)
+{
+    char buf[24];
+    int pos = sizeof(buf);
+    do{
+        int digit = static_cast<int>(value % static_cast<quint64>(base));
+        buf[--pos] = static_cast<char>(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= static_cast<quint64>(base);
+    }while(value != 0 && pos > 0);
+    while(static_cast<int>(sizeof(buf)) - pos < width && pos > 0)
+        buf[--pos] = '0';
+    out.append(buf + pos, static_cast<int>(sizeof(buf)) - pos);
+}
 
-    /** 声明LogDestination指针数组 */
-    static LogDestination* log_destinations_[NUM_SEVERITIES];
+static inline void appendCString(QByteArray &out, const char *str, const char *fallback)
+{
+    out.append(str ? str : fallback);
+}
 
-    static QMap<QByteArray,LogDestination*> log_destinations_map_;
+/** 从src[i]开始编码一个字符为UTF-8，代理对时i前进到低位代理，dst至少预留4字节 */
+static inline char* putUtf8(char *dst, const ushort *src, int &i, int len)
+{
+    uint ch = src[i];
+    if(ch < 0x80){
+        *dst++ = static_cast<char>(ch);
+    }
+    else if(ch < 0x800){
+        *dst++ = static_cast<char>(0xc0 | (ch >> 6));
+        *dst++ = static_cast<char>(0x80 | (ch & 0x3f));
+    }
+    else{
+        if(ch >= 0xd800 && ch < 0xdc00 && i + 1 < len && src[i + 1] >= 0xdc00 && src[i + 1] < 0xe000){
+            /** 代理对，4字节编码，占用两个UTF-16单元，预留的6字节足够 */
+            ch = 0x10000 + ((ch - 0xd800) << 10) + (src[++i] - 0xdc00);
+            *dst++ = static_cast<char>(0xf0 | (ch >> 18));
+            *dst++ = static_cast<char>(0x80 | ((ch >> 12) & 0x3f));
+        }
+        else{
+            if(ch >= 0xd800 && ch < 0xe000)
+                ch = 0xfffd;
+            *dst++ = static_cast<char>(0xe0 | (ch >> 12));
+        }
+        *dst++ = static_cast<char>(0x80 | ((ch >> 6) & 0x3f));
+        *dst++ = static_cast<char>(0x80 | (ch & 0x3f));
+    }
+    return dst;
+}
 
-    static bool CategoryMode_;
+/**
+ * @brief appendUtf8
+ * @details UTF-16直接编码为UTF-8追加到缓冲区，避免toLocal8Bit产生临时QByteArray
+ */
+static void appendUtf8(QByteArray &out, const QString &str)
+{
+    const int len = str.size();
+    const ushort *src = str.utf16();
+    int pos = out.size();
+    out.resize(pos + len * 3);
+    char *dst = out.data() + pos;
+    char *begin = dst;
+    for(int i = 0; i < len; i++)
+        dst = putUtf8(dst, src, i, len);
+    out.resize(pos + static_cast<int>(dst - begin));
+}
 
-    static QString category_base_filename_;
+/** 需要转义的ASCII字符写为JSON转义序列，其余原样输出，dst至少预留6字节 */
+static inline char* putEscaped(char *dst, uint ch)
+{
+    static const char hex[] = "0123456789abcdef";
+    switch(ch){
+    case '"':  *dst++ = '\\'; *dst++ = '"';  break;
+    case '\\': *dst++ = '\\'; *dst++ = '\\'; break;
+    case '\n': *dst++ = '\\'; *dst++ = 'n';  break;
+    case '\r': *dst++ = '\\'; *dst++ = 'r';  break;
+    case '\t': *dst++ = '\\'; *dst++ = 't';  break;
+    case '\b': *dst++ = '\\'; *dst++ = 'b';  break;
+    case '\f': *dst++ = '\\'; *dst++ = 'f';  break;
+    default:
+        if(ch < 0x20){
+            memcpy(dst, "\\u00", 4);
+            dst[4] = hex[ch >> 4];
+            dst[5] = hex[ch & 0xf];
+            dst += 6;
+        }
+        else{
+            *dst++ = static_cast<char>(ch);
+        }
+        break;
+    }
+    return dst;
+}
 
-    /**
-     * @brief log_destinations
-     * @param severity
-     * @return LogDestination指针
-     * @details 根据serverity获取对应的LogDestination指针
-     */
-    static LogDestination* log_destinations(LogSeverity severity);
+/**
+ * @brief appendEscaped
+ * @details UTF-16消息编码为UTF-8的同时按JSON规则转义，logfmt带引号的值使用相同规则。
+ * SSE2下每次判断16个UTF-16单元，全部为无需转义的ASCII时直接收窄写入，遇到需要转义或非ASCII字符时逐个处理
+ */
+static void appendEscaped(QByteArray &out, const ushort *src, int len)
+{
+    int pos = out.size();
+    out.resize(pos + len * 6);
+    char *dst = out.data() + pos;
+    char *begin = dst;
+    int i = 0;
+#ifdef QTLOG_ESCAPE_SSE2
+    const __m128i low = _mm_set1_epi16(0x20);
+    const __m128i high = _mm_set1_epi16(0x7f);
+    const __m128i quote = _mm_set1_epi16('"');
+    const __m128i backslash = _mm_set1_epi16('\\');
+    const __m128i zero = _mm_setzero_si128();
+#endif
+    while(i < len){
+        int stop = len;
+#ifdef QTLOG_ESCAPE_SSE2
+        while(i + 16 <= len){
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+            /** 饱和减法：小于0x20或大于0x7f的单元结果非0 */
+            __m128i bad = _mm_or_si128(_mm_or_si128(_mm_subs_epu16(low, a), _mm_subs_epu16(a, high)),
+                                       _mm_or_si128(_mm_subs_epu16(low, b), _mm_subs_epu16(b, high)));
+            bad = _mm_or_si128(bad, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(a, quote), _mm_cmpeq_epi16(a, backslash)),
+                                                 _mm_or_si128(_mm_cmpeq_epi16(b, quote), _mm_cmpeq_epi16(b, backslash))));
+            if(_mm_movemask_epi8(_mm_cmpeq_epi16(bad, zero)) != 0xffff)
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(a, b));
+            dst += 16;
+            i += 16;
+        }
+        /** 含转义或非ASCII字符的16个单元逐个处理后回到批量判断 */
+        stop = qMin(i + 16, len);
+#endif
+        for(; i < stop; i++){
+            uint ch = src[i];
+            if(ch < 0x80)
+                dst = putEscaped(dst, ch);
+            else
+                dst = putUtf8(dst, src, i, len);
+        }
+    }
+    out.resize(pos + static_cast<int>(dst - begin));
+}
 
-    static LogDestination* log_destinations(QByteArray &category);
+/** 文件名、函数名、分类名按JSON规则转义，非ASCII字节原样输出 */
+static void appendEscaped(QByteArray &out, const char *str, int len)
+{
+    int pos = out.size();
+    out.resize(pos + len * 6);
+    char *dst = out.data() + pos;
+    char *begin = dst;
+    const uchar *src = reinterpret_cast<const uchar*>(str);
+    int i = 0;
+#ifdef QTLOG_ESCAPE_SSE2
+    const __m128i control = _mm_set1_epi8(0x1f);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+#endif
+    while(i < len){
+        int stop = len;
+#ifdef QTLOG_ESCAPE_SSE2
+        while(i + 16 <= len){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            /** 无符号最小值等于自身即小于0x20 */
+            __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, control), v),
+                                       _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+            if(_mm_movemask_epi8(bad) != 0)
+                break;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+            dst += 16;
+            i += 16;
+        }
+        stop = qMin(i + 16, len);
+#endif
+        for(; i < stop; i++)
+            dst = putEscaped(dst, src[i]);
+    }
+    out.resize(pos + static_cast<int>(dst - begin));
+}
 
-    QMutex logDestination_mutex;
+/** logfmt的值为空或含空白、等号、引号、控制字符时加引号 */
+static void appendLogfmtValue(QByteArray &out, const char *str)
+{
+    const int len = static_cast<int>(strlen(str));
+    bool quoted = len == 0;
+    for(int i = 0; i < len && !quoted; i++){
+        uchar ch = static_cast<uchar>(str[i]);
+        quoted = ch <= ' ' || ch == '=' || ch == '"' || ch == '\\';
+    }
+    if(!quoted){
+        out.append(str, len);
+        return;
+    }
+    out.append('"');
+    appendEscaped(out, str, len);
+    out.append('"');
+}
 
-    static void maybeLogToLogfile(LogSeverity severity, QByteArray &msg, QByteArray &category);
+void LogFormatter::compile(const QString &pattern)
+{
+    Program *program = new Program;
+    QVector<int> ifs;
+    const int len = pattern.size();
+    int i = 0;
+    while(i < len){
+        int start = pattern.indexOf(QString("%{"), i);
+        if(start < 0)
+            start = len;
+        if(start > i){
+            Op op;
+            op.code = OpLiteral;
+            op.text = pattern.mid(i, start - i).toLocal8Bit();
+            program->ops.append(op);
+        }
+        if(start >= len)
+            break;
+        int end = pattern.indexOf(QChar('}'), start);
+        if(end < 0){
+            /** 未闭合的%{按普通文本输出 */
+            Op op;
+            op.code = OpLiteral;
+            op.text = pattern.mid(start).toLocal8Bit();
+            program->ops.append(op);
+            break;
+        }
+        QString token = pattern.mid(start + 2, end - start - 2);
+        i = end + 1;
+
+        Op op;
+        if(token == "message")          op.code = OpMessage;
+        else if(token == "pid")         op.code = OpPid;
+        else if(token == "appname")     op.code = OpAppName;
+        else if(token == "qthreadptr")  op.code = OpThreadPtr;
+        else if(token == "threadid")    op.code = OpThreadId;
+        else if(token == "file")        op.code = OpFile;
+        else if(token == "line")        op.code = OpLine;
+        else if(token == "function")    op.code = OpFunction;
+        else if(token == "category")    op.code = OpCategory;
+        else if(token == "type")        op.code = OpType;
+        else if(token == "if-category") op.code = OpIfCategory;
+        else if(token == "endif")       op.code = OpEndif;
+        else if(token.startsWith(QString("if-"))){
+            op.code = OpIfSeverity;
+            op.arg = -1;
+            QString type = token.mid(3);
+            for(int severity = 0; severity < NUM_SEVERITIES; severity++){
+                if(type == LogTypeNames[severity])
+                    op.arg = severity;
+            }
+        }
+        else if(token == "time" || token.startsWith(QString("time "))){
+            compileTime(program, token.mid(5));
+            continue;
+        }
+        else{
+            /** 不支持的占位符(如%{backtrace})输出为空 */
+            continue;
+        }
 
+        if(op.code == OpIfSeverity || op.code == OpIfCategory){
+            ifs.append(program->ops.size());
+        }
+        else if(op.code == OpEndif){
+            if(ifs.isEmpty())
+                continue;
+            program->ops[ifs.last()].jump = program->ops.size() + 1;
+            ifs.removeLast();
+        }
+        program->ops.append(op);
+    }
+    /** 未闭合的条件块跳转到末尾 */
+    for(int index : ifs)
+        program->ops[index].jump = program->ops.size();
 
-};
+    optimize(program);
 
+    program->pid = QByteArray::number(QCoreApplication::applicationPid());
+    program->appname = QCoreApplication::applicationName().toLocal8Bit();
 
-LogFileObject::LogFileObject(LogSeverity severity, QString &base_filename):
-    base_filename_selected_(base_filename.size() != 0),
-    base_filename_((base_filename.size() != 0) ? base_filename : QString()),
-    file_(nullptr),
-    severity_(severity),file_length_(0){
-    category_.clear();
-    day_=QDate::currentDate().day();
+    QMutexLocker locker(&mutex_);
+    if(!process_timer_.isValid())
+        process_timer_.start();
+    program_ = QSharedPointer<const Program>(program);
+    generation_.fetch_add(1, std::memory_order_release);
 }
 
-LogFileObject::LogFileObject(QByteArray category,QString &base_filename):base_filename_selected_(true),file_(nullptr)
+const LogFormatter::Program* LogFormatter::current()
 {
-    base_filename_ = base_filename;
-    category_ = category;
-    severity_ = -1;
-    day_ = QDate::currentDate().day();
-}
-
-LogFileObject::~LogFileObject(){
-    if(file_)
-        delete file_;
-}
-
-void LogFileObject::setBasename(QString &basename){
-    base_filename_selected_ = true;
-    if (base_filename_ != basename) {
-        base_filename_ = basename;
+    struct Cache{
+        quint32 generation = 0;
+        QSharedPointer<const Program> program;
+    };
+    static thread_local Cache cache;
+    if(cache.generation != generation_.load(std::memory_order_acquire)){
+        QMutexLocker locker(&mutex_);
+        cache.program = program_;
+        cache.generation = generation_.load(std::memory_order_relaxed);
     }
+    return cache.program.data();
 }
 
-void LogFileObject::write(bool flush, QByteArray &msg){
-    QMutexLocker locker(&mutex_);
+void LogFormatter::appendElapsed(QByteArray &buffer, qint64 msecs)
+{
+    char text[32];
+    int len = snprintf(text, sizeof(text), "%6u.%03u", static_cast<uint>(qMax<qint64>(msecs, 0) / 1000),
+                       static_cast<uint>(qMax<qint64>(msecs, 0) % 1000));
+    buffer.append(text, len);
+}
 
-    if(base_filename_selected_&&base_filename_.isEmpty()){
+void LogFormatter::compileTime(Program *program, const QString &format)
+{
+    if(format.isEmpty() || format == "process" || format == "boot"){
+        Op op;
+        op.code = format.isEmpty() ? OpTimeQt : format == "process" ? OpTimeProcess : OpTimeBoot;
+        program->ops.append(op);
         return;
     }
 
-    if ( (file_length_ >> 20) >= MaxLogSize() || DayHasChanged(day_) ) {
-        if (file_){
-            file_->close();
-            delete file_;
-            file_ = nullptr;
+    const int len = format.size();
+    int i = 0;
+    QByteArray literal;
+
+    /** 时分秒开头的格式直接使用时钟预渲染的文本 */
+    QString hms[] = { QString("hh:mm:ss"), QString("HH:mm:ss"), QString("h:mm:ss"), QString("H:mm:ss") };
+    for(const QString &prefix : hms){
+        if(format.startsWith(prefix) && (len == prefix.size() || format.at(prefix.size()).toLatin1() != 's')){
+            Op op;
+            op.code = OpTimeHms;
+            op.width = prefix.at(1).toLatin1() == ':' ? 1 : 2;
+            program->ops.append(op);
+            i = prefix.size();
+            break;
         }
-        file_length_ = bytes_since_flush_ = 0;
     }
 
-    if(!file_){
-        if(base_filename_selected_){
-            //设置过base_filename的进行地址创建
-            if(!createLogfile(base_filename_)){
-                //创建失败
-                printf("log file create failed!\r\n");
-                printf("%s\r\n",category_.toStdString().c_str());
-                return;
-            }
+    while(i < len){
+        char ch = format.at(i).toLatin1();
+        int count = 1;
+        while(i + count < len && format.at(i + count).toLatin1() == ch)
+            count++;
+
+        int field = -1;
+        int width = 0;
+        switch(ch){
+        case 'y': field = FieldYear;   width = count >= 4 ? 4 : 2; break;
+        case 'M': field = FieldMonth;  width = count >= 2 ? 2 : 1; break;
+        case 'd': field = FieldDay;    width = count >= 2 ? 2 : 1; break;
+        case 'h':
+        case 'H': field = FieldHour;   width = count >= 2 ? 2 : 1; break;
+        case 'm': field = FieldMinute; width = count >= 2 ? 2 : 1; break;
+        case 's': field = FieldSecond; width = count >= 2 ? 2 : 1; break;
+        case 'z': field = FieldMsec;   width = count >= 3 ? 3 : 1; break;
+        default: break;
         }
-        else{
-            /** We don't log if the base_name_ is "" */
-            return;
+        if(field < 0 || count > 4 || (ch != 'y' && ch != 'z' && count > 2) || (ch == 'y' && count == 3)){
+            literal.append(format.mid(i, count).toLocal8Bit());
+            i += count;
+            continue;
         }
-
-        QByteArray file_header_string;
-        QTextStream file_header_stream(&file_header_string,QIODevice::Text | QIODevice::WriteOnly);
-
-        std::string hostname_;
-        if (hostname_.empty()) {
-            GetHostName(&hostname_);
-            if (hostname_.empty()) {
-                hostname_ = "(unknown)";
-            }
+        if(!literal.isEmpty()){
+            Op op;
+            op.code = OpLiteral;
+            op.text = literal;
+            program->ops.append(op);
+            literal.clear();
         }
+        Op op;
+        op.code = OpTimeField;
+        op.arg = field;
+        op.width = width;
+        program->ops.append(op);
+        i += count;
+    }
+    if(!literal.isEmpty()){
+        Op op;
+        op.code = OpLiteral;
+        op.text = literal;
+        program->ops.append(op);
+    }
+}
 
-        // Write a header message into the log file
-        file_header_stream << "Log file created at: "
-                           << QDateTime::currentDateTime().toString("yyyy/MM/dd hh:mm:ss")<< endl
-                           << "Running on machine: "
-                           << hostname_.c_str() << endl
-                           << "Log line format: [DIWEF]pid hh:mm:ss.zzz ";
-        if(fileLine){
-            file_header_stream<<"threadid](file:line _function) msg" << endl;
+void LogFormatter::optimize(Program *program)
+{
+    /** 连续的 %{if-debug}D%{endif}%{if-info}I%{endif}... 合并为一次按等级查表 */
+    const QVector<Op> &src = program->ops;
+    QVector<Op> ops;
+    QVector<int> remap(src.size() + 1);
+    int i = 0;
+    while(i < src.size()){
+        int j = i;
+        Op merged;
+        merged.code = OpSeverity;
+        while(j + 2 < src.size() && src[j].code == OpIfSeverity && src[j].arg >= 0
+              && src[j + 1].code == OpLiteral && src[j + 2].code == OpEndif
+              && merged.names[src[j].arg].isEmpty()){
+            merged.names[src[j].arg] = src[j + 1].text;
+            j += 3;
         }
-        else{
-            file_header_stream<<"threadid] msg" << endl;
+        if(j > i){
+            for(int k = i; k < j; k++)
+                remap[k] = ops.size();
+            ops.append(merged);
+            i = j;
+            continue;
         }
+        remap[i] = ops.size();
+        ops.append(src[i]);
+        i++;
+    }
+    remap[src.size()] = ops.size();
+    for(int k = 0; k < ops.size(); k++){
+        if(ops[k].code == OpIfSeverity || ops[k].code == OpIfCategory)
+            ops[k].jump = remap[ops[k].jump];
+    }
 
-        file_header_stream.flush();
-        const int header_len = static_cast<int>(file_header_string.size());
-        file_->write(file_header_string.data(),header_len);
-        file_length_ += static_cast<quint32>(header_len);
-        bytes_since_flush_ += static_cast<quint32>(header_len);
+    /** 相邻文本合并，条件跳转目标不参与合并 */
+    QVector<bool> target(ops.size() + 1, false);
+    for(int k = 0; k < ops.size(); k++){
+        if(ops[k].code == OpIfSeverity || ops[k].code == OpIfCategory)
+            target[ops[k].jump] = true;
+    }
+    QVector<Op> result;
+    remap.fill(0, ops.size() + 1);
+    for(int k = 0; k < ops.size(); k++){
+        if(ops[k].code == OpLiteral && !target[k] && !result.isEmpty() && result.last().code == OpLiteral){
+            result.last().text.append(ops[k].text);
+            remap[k] = result.size() - 1;
+            continue;
+        }
+        remap[k] = result.size();
+        result.append(ops[k]);
+    }
+    remap[ops.size()] = result.size();
+    for(int k = 0; k < result.size(); k++){
+        if(result[k].code == OpIfSeverity || result[k].code == OpIfCategory)
+            result[k].jump = remap[result[k].jump];
+    }
+    program->ops = result;
+}
 
+QByteArray &LogFormatter::render(QtMsgType type, const QMessageLogContext &context, const QString &msg,
+                                 qint64 timestamp, quintptr thread)
+{
+    const LogSeverity severity = severityOf(type);
+    static thread_local QByteArray buffer;
+    if(buffer.capacity() < 256)
+        buffer.reserve(256);
+    buffer.resize(0);
+
+    const Program *program = current();
+    if(!program){
+        /** 未调用qInstallHandlers编译格式时退回Qt格式化 */
+        buffer.append(qFormatLogMessage(type, context, msg).toLocal8Bit());
+        buffer.append('\n');
+        return buffer;
     }
 
-    /** 磁盘是否满 */
-    if(!stop_writing){
-        file_->write(msg);
-        /** 判断磁盘是否已满，待完善，默认不会满 */
-        bool diskfull = false;   /// todo
-        if(diskfull){
-            stop_writing = true;
-            return;
+    static const bool utf8_locale = QTextCodec::codecForLocale()->mibEnum() == 106;
+
+    LogClock::Snapshot now;
+    bool has_time = false;
+
+    const Op *ops = program->ops.constData();
+    const int count = program->ops.size();
+    int pc = 0;
+    while(pc < count){
+        const Op &op = ops[pc];
+        switch(op.code){
+        case OpLiteral:
+            buffer.append(op.text);
+            break;
+        case OpSeverity:
+            buffer.append(op.names[severity]);
+            break;
+        case OpType:
+            buffer.append(LogTypeNames[severity]);
+            break;
+        case OpPid:
+            buffer.append(program->pid);
+            break;
+        case OpAppName:
+            buffer.append(program->appname);
+            break;
+        case OpThreadPtr:
+            buffer.append("0x", 2);
+            appendNumber(buffer, thread ? thread : reinterpret_cast<quintptr>(QThread::currentThread()), 16);
+            break;
+        case OpThreadId:
+            appendNumber(buffer, reinterpret_cast<quintptr>(QThread::currentThreadId()));
+            break;
+        case OpFile:
+            appendCString(buffer, context.file, "unknown");
+            break;
+        case OpLine:
+            appendNumber(buffer, static_cast<quint64>(context.line > 0 ? context.line : 0));
+            break;
+        case OpFunction:
+            appendCString(buffer, context.function, "unknown");
+            break;
+        case OpCategory:
+            appendCString(buffer, context.category, "");
+            break;
+        case OpMessage:
+            if(utf8_locale)
+                appendUtf8(buffer, msg);
+            else
+                buffer.append(msg.toLocal8Bit());
+            break;
+        case OpTimeHms:
+            if(!has_time){
+                if(timestamp)
+                    LogClock::at(timestamp, &now);
+                else
+                    LogClock::now(&now);
+                has_time = true;
+            }
+            if(op.width == 1 && now.hms[0] == '0')
+                buffer.append(now.hms + 1, 7);
+            else
+                buffer.append(now.hms, 8);
+            break;
+        case OpTimeField:
+            if(!has_time){
+                if(timestamp)
+                    LogClock::at(timestamp, &now);
+                else
+                    LogClock::now(&now);
+                has_time = true;
+            }
+            switch(op.arg){
+            case FieldYear:   appendNumber(buffer, static_cast<quint64>(op.width == 4 ? now.year : now.year % 100), 10, op.width); break;
+            case FieldMonth:  appendNumber(buffer, static_cast<quint64>(now.month), 10, op.width); break;
+            case FieldDay:    appendNumber(buffer, static_cast<quint64>(now.day), 10, op.width); break;
+            case FieldHour:   appendNumber(buffer, static_cast<quint64>(now.hour), 10, op.width); break;
+            case FieldMinute: appendNumber(buffer, static_cast<quint64>(now.minute), 10, op.width); break;
+            case FieldSecond: appendNumber(buffer, static_cast<quint64>(now.second), 10, op.width); break;
+            case FieldMsec:   appendNumber(buffer, static_cast<quint64>(op.width == 3 ? now.msec : now.msec / 100), 10, op.width); break;
+            }
+            break;
+        case OpTimeQt:
+            buffer.append((timestamp ? QDateTime::fromMSecsSinceEpoch(timestamp) : QDateTime::currentDateTime())
+                          .toString(Qt::ISODate).toLocal8Bit());
+            break;
+        case OpTimeProcess:
+        case OpTimeBoot:{
+            /** 指定时间的记录按与当前时间的差值回推 */
+            qint64 msecs;
+            if(op.code == OpTimeProcess){
+                msecs = process_timer_.elapsed();
+            }
+            else{
+                QElapsedTimer now;
+                now.start();
+                msecs = now.msecsSinceReference();
+            }
+            if(timestamp)
+                msecs -= LogClock::nowMSecs() - timestamp;
+            appendElapsed(buffer, msecs);
+            break;
         }
-        else{
-            quint32 length = static_cast<quint32>(msg.size());
-            file_length_ += length;
-            bytes_since_flush_ += length;
+        case OpIfSeverity:
+            if(op.arg != severity){
+                pc = op.jump;
+                continue;
+            }
+            break;
+        case OpIfCategory:
+            if(!context.category || strcmp(context.category, "default") == 0){
+                pc = op.jump;
+                continue;
+            }
+            break;
+        case OpEndif:
+            break;
         }
+        pc++;
     }
-    else{
-        if ( CycleClock_Now() >= next_flush_time_ )
-            stop_writing = false;  /// check to see if disk has free space.
-        return;
+    buffer.append('\n');
+    return buffer;
+}
+
+QByteArray &LogFormatter::renderRecord(QtMsgType type, const QMessageLogContext &context, const QString &msg, int format,
+                                       qint64 timestamp, quintptr thread)
+{
+    const LogSeverity severity = severityOf(type);
+    static thread_local QByteArray buffer;
+    if(buffer.capacity() < 256)
+        buffer.reserve(256);
+    buffer.resize(0);
+
+    /** 本地时间，ISO 8601格式 yyyy-MM-ddThh:mm:ss.zzz */
+    LogClock::Snapshot now;
+    if(timestamp)
+        LogClock::at(timestamp, &now);
+    else
+        LogClock::now(&now);
+    char time[23];
+    {
+        char *p = time;
+        const int fields[] = {now.year, now.month, now.day};
+        const int widths[] = {4, 2, 2};
+        for(int i = 0; i < 3; i++){
+            int value = fields[i];
+            for(int k = widths[i] - 1; k >= 0; k--){
+                p[k] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+            p += widths[i];
+            *p++ = i < 2 ? '-' : 'T';
+        }
+        memcpy(p, now.hms, 8);
+        p += 8;
+        *p++ = '.';
+        p[0] = static_cast<char>('0' + now.msec / 100);
+        p[1] = static_cast<char>('0' + now.msec / 10 % 10);
+        p[2] = static_cast<char>('0' + now.msec % 10);
+    }
+
+    const char *category = context.category ? context.category : "default";
+    if(!thread)
+        thread = reinterpret_cast<quintptr>(QThread::currentThread());
+    const ushort *text = msg.utf16();
+    const Program *program = current();
+    const QByteArray pid = program ? program->pid : QByteArray::number(QCoreApplication::applicationPid());
+
+    if(format == qtlog::OutputJson){
+        buffer.append("{\"time\":\"", 9);
+        buffer.append(time, sizeof(time));
+        buffer.append("\",\"pid\":", 8);
+        buffer.append(pid);
+        buffer.append(",\"thread\":\"0x", 13);
+        appendNumber(buffer, thread, 16);
+        buffer.append("\",\"severity\":\"", 14);
+        buffer.append(LogTypeNames[severity]);
+        buffer.append("\",\"category\":\"", 14);
+        appendEscaped(buffer, category, static_cast<int>(strlen(category)));
+        buffer.append('"');
+        /** 发布版本未定义QT_MESSAGELOGCONTEXT时Qt不提供调用位置，不输出这三项 */
+        if(context.file){
+            buffer.append(",\"file\":\"", 9);
+            appendEscaped(buffer, context.file, static_cast<int>(strlen(context.file)));
+            buffer.append("\",\"line\":", 9);
+            appendNumber(buffer, static_cast<quint64>(context.line > 0 ? context.line : 0));
+            buffer.append(",\"function\":\"", 13);
+            if(context.function)
+                appendEscaped(buffer, context.function, static_cast<int>(strlen(context.function)));
+            buffer.append('"');
+        }
+        buffer.append(",\"message\":\"", 12);
+        appendEscaped(buffer, text, msg.size());
+        buffer.append("\"}\n", 3);
+    }
+    else{
+        buffer.append("time=", 5);
+        buffer.append(time, sizeof(time));
+        buffer.append(" pid=", 5);
+        buffer.append(pid);
+        buffer.append(" thread=0x", 10);
+        appendNumber(buffer, thread, 16);
+        buffer.append(" severity=", 10);
+        buffer.append(LogTypeNames[severity]);
+        buffer.append(" category=", 10);
+        appendLogfmtValue(buffer, category);
+        if(context.file){
+            buffer.append(" file=", 6);
+            appendLogfmtValue(buffer, context.file);
+            buffer.append(" line=", 6);
+            appendNumber(buffer, static_cast<quint64>(context.line > 0 ? context.line : 0));
+            buffer.append(" function=", 10);
+            appendLogfmtValue(buffer, context.function ? context.function : "");
+        }
+        /** 消息总是加引号，多行消息的换行转义为\n，一条记录只占一行 */
+        buffer.append(" message=\"", 10);
+        appendEscaped(buffer, text, msg.size());
+        buffer.append("\"\n", 2);
+    }
+    return buffer;
+}
+
+/**
+ * @brief The LogFileBackend class
+ * @details LogFileObject的文件写入后端，日志文件切换时按当前设置创建
+ */
+class LogFileBackend{
+public:
+    virtual ~LogFileBackend(){}
+    /** 新建日志文件，文件已存在时失败 */
+    virtual bool open(const QString &filename) = 0;
+    virtual bool write(const char *data, qint64 len) = 0;
+    /** 缓存数据提交到系统 */
+    virtual void flush() = 0;
+    virtual void close() = 0;
+    /** 文件描述符，用于fdatasync，未打开时返回-1 */
+    virtual int handle() const = 0;
+#if defined(Q_OS_LINUX)
+    /** 崩溃时由信号处理函数调用，不加锁、不分配内存：缓存数据直接写入文件，再追加data */
+    virtual void crashWrite(const char *data, qint64 len) = 0;
+    virtual void crashFlush() = 0;
+#endif
+
+    static LogFileBackend* create();
+};
+
+#if defined(Q_OS_LINUX)
+/** 异步信号安全的写入，处理部分写入和EINTR */
+static void CrashWrite(int fd, const char *data, qint64 len)
+{
+    while(fd >= 0 && len > 0){
+        ssize_t written = ::write(fd, data, static_cast<size_t>(len));
+        if(written < 0 && errno == EINTR)
+            continue;
+        if(written <= 0)
+            return;
+        data += written;
+        len -= written;
+    }
+}
+#endif
+
+/**
+ * @brief The LogQFileBackend class
+ * @details 默认后端，通过QFile写入。QFile以无缓冲方式打开，日志暂存在后端自己的缓冲区中，
+ * 程序崩溃时信号处理函数可以直接把缓冲区写入文件描述符
+ */
+class LogQFileBackend : public LogFileBackend{
+public:
+    LogQFileBackend():fd_(-1),used_(0){
+    }
+
+    bool open(const QString &filename){
+        file_.setFileName(filename);
+#if (QT_VERSION >= QT_VERSION_CHECK(5,11,0))
+        if(!file_.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered | QIODevice::NewOnly))
+            return false;
+#else
+        if(file_.exists() || !file_.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered))
+            return false;
+#endif
+        fd_ = file_.handle();
+        return true;
+    }
+
+    bool write(const char *data, qint64 len){
+        if(used_ + len > kBufferSize){
+            if(!commit())
+                return false;
+            if(len >= kBufferSize)
+                return file_.write(data, len) == len;
+        }
+        memcpy(buffer_ + used_, data, static_cast<size_t>(len));
+        used_ += len;
+        return true;
+    }
+
+    void flush(){
+        commit();
+        file_.flush();
+    }
+
+    void close(){
+        commit();
+        file_.close();
+        fd_ = -1;
+    }
+
+    int handle() const{
+        return file_.handle();
+    }
+
+#if defined(Q_OS_LINUX)
+    void crashWrite(const char *data, qint64 len){
+        crashFlush();
+        CrashWrite(fd_, data, len);
+    }
+
+    void crashFlush(){
+        qint64 used = used_;
+        used_ = 0;
+        CrashWrite(fd_, buffer_, used);
+    }
+#endif
+
+private:
+    static const qint64 kBufferSize = 64 * 1024;
+
+    bool commit(){
+        if(used_ == 0)
+            return true;
+        bool ok = file_.write(buffer_, used_) == used_;
+        used_ = 0;
+        return ok;
+    }
+
+    QFile file_;
+    int fd_;
+    qint64 used_;
+    char buffer_[kBufferSize];
+};
+
+#if defined(Q_OS_LINUX)
+/**
+ * @brief The LogMmapBackend class
+ * @details 内存映射后端。文件按块预分配(fallocate，不支持时ftruncate)并映射，追加日志直接memcpy到映射区，
+ * 写满一块后映射下一块。flush对应msync，可选同步或异步。关闭时文件截断到实际长度
+ * @note 进程异常退出时文件末尾可能残留预分配的空字节
+ */
+class LogMmapBackend : public LogFileBackend{
+public:
+    LogMmapBackend(qint64 chunk_size, bool sync):
+        fd_(-1),map_(nullptr),map_offset_(0),map_size_(0),length_(0),synced_(0),
+        chunk_size_(chunk_size),sync_(sync){
+    }
+
+    ~LogMmapBackend(){
+        close();
+    }
+
+    bool open(const QString &filename){
+        fd_ = ::open(QFile::encodeName(filename).constData(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(fd_ < 0)
+            return false;
+        length_ = synced_ = 0;
+        if(!mapChunk(length_)){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const char *data, qint64 len){
+        const qint64 start = length_;
+        while(len > 0){
+            qint64 pos = length_ - map_offset_;
+            if(pos >= map_size_){
+                if(!mapChunk(length_)){
+                    /** 已拷贝的部分不计入文件长度，关闭时截掉，文件中不留下不完整的记录 */
+                    length_ = start;
+                    synced_ = qMin(synced_, length_);
+                    return false;
+                }
+                pos = length_ - map_offset_;
+            }
+            qint64 n = qMin(len, map_size_ - pos);
+            memcpy(map_ + pos, data, static_cast<size_t>(n));
+            length_ += n;
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void flush(){
+        if(!map_ || synced_ >= length_)
+            return;
+        /** 只同步上次flush之后写入的页 */
+        static const qint64 page = sysconf(_SC_PAGESIZE);
+        qint64 start = qMax(synced_, map_offset_) & ~(page - 1);
+        msync(map_ + (start - map_offset_), static_cast<size_t>(length_ - start), sync_ ? MS_SYNC : MS_ASYNC);
+        synced_ = length_;
+    }
+
+    void close(){
+        if(map_){
+            flush();
+            munmap(map_, static_cast<size_t>(map_size_));
+            map_ = nullptr;
+        }
+        if(fd_ >= 0){
+            if(ftruncate(fd_, length_) != 0){
+                /** 截断失败时文件末尾保留预分配的空字节 */
+            }
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int handle() const{
+        return fd_;
+    }
+
+    /** 映射区中的数据在进程退出后仍由内核写回，崩溃时只需追加数据并截掉预分配的空字节 */
+    void crashWrite(const char *data, qint64 len){
+        if(fd_ < 0)
+            return;
+        while(len > 0){
+            ssize_t written = ::pwrite(fd_, data, static_cast<size_t>(len), static_cast<off_t>(length_));
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                return;
+            data += written;
+            len -= written;
+            length_ += written;
+        }
+    }
+
+    void crashFlush(){
+        if(fd_ >= 0 && ftruncate(fd_, static_cast<off_t>(length_)) != 0){
+            /** 截断失败时文件末尾保留预分配的空字节 */
+        }
+    }
+
+private:
+    bool mapChunk(qint64 offset){
+        static const qint64 page = sysconf(_SC_PAGESIZE);
+        if(map_){
+            flush();
+            munmap(map_, static_cast<size_t>(map_size_));
+            map_ = nullptr;
+        }
+        /** 映射失败时map_offset_和map_size_保持为空映射，之后的写入重新尝试映射 */
+        map_offset_ = map_size_ = 0;
+        qint64 map_offset = offset & ~(page - 1);
+        qint64 map_size = (chunk_size_ + page - 1) & ~(page - 1);
+        off_t end = static_cast<off_t>(map_offset + map_size);
+        if(fallocate(fd_, 0, static_cast<off_t>(map_offset), static_cast<off_t>(map_size)) != 0){
+            /**
+             * 只有文件系统不支持预分配时才退回ftruncate。磁盘已满等其他错误时扩展出的空洞没有实际空间，
+             * 写入映射区会触发SIGBUS，此时让写入失败
+             */
+            if(errno != EOPNOTSUPP && errno != ENOSYS)
+                return false;
+            struct stat st;
+            if(fstat(fd_, &st) != 0 || (st.st_size < end && ftruncate(fd_, end) != 0))
+                return false;
+        }
+        void* map = mmap(nullptr, static_cast<size_t>(map_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(map_offset));
+        if(map == MAP_FAILED)
+            return false;
+        map_ = static_cast<char*>(map);
+        map_offset_ = map_offset;
+        map_size_ = map_size;
+        return true;
+    }
+
+    int fd_;
+    char* map_;
+    qint64 map_offset_;
+    qint64 map_size_;
+    /** 文件实际长度 */
+    qint64 length_;
+    /** 已msync的长度 */
+    qint64 synced_;
+    qint64 chunk_size_;
+    bool sync_;
+};
+
+/**
+ * @brief The LogWritevBackend class
+ * @details 直接写文件描述符的后端。文件以O_APPEND打开，写入的记录依次拷贝到固定大小的缓冲块中，
+ * flush时所有缓冲块作为iovec由一次writev提交。提交时机仍由LogFileObject的
+ * bytes_since_flush_ 和 logbufsecs 阈值以及显式flush决定，缓冲块在文件关闭前循环复用
+ */
+class LogWritevBackend : public LogFileBackend{
+public:
+    LogWritevBackend():fd_(-1),count_(0),tail_(0){
+    }
+
+    ~LogWritevBackend(){
+        close();
+        for(char* block : blocks_)
+            delete[] block;
+    }
+
+    bool open(const QString &filename){
+        fd_ = ::open(QFile::encodeName(filename).constData(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+        return fd_ >= 0;
+    }
+
+    bool write(const char *data, qint64 len){
+        if(fd_ < 0)
+            return false;
+        while(len > 0){
+            if(count_ == 0 || tail_ == kBlockSize){
+                /** 缓冲块用完时先提交，正常情况下flush阈值先到达 */
+                if(count_ == kMaxBlocks && !submit())
+                    return false;
+                if(count_ == blocks_.size())
+                    blocks_.append(new char[kBlockSize]);
+                count_++;
+                tail_ = 0;
+            }
+            qint64 n = qMin(len, kBlockSize - tail_);
+            memcpy(blocks_[count_ - 1] + tail_, data, static_cast<size_t>(n));
+            tail_ += n;
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    void flush(){
+        submit();
+    }
+
+    void close(){
+        if(fd_ < 0)
+            return;
+        submit();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    int handle() const{
+        return fd_;
+    }
+
+    void crashWrite(const char *data, qint64 len){
+        submit();
+        CrashWrite(fd_, data, len);
+    }
+
+    void crashFlush(){
+        submit();
+    }
+
+private:
+    static const qint64 kBlockSize = 64 * 1024;
+    static const int kMaxBlocks = 64;
+
+    bool submit(){
+        if(count_ == 0)
+            return true;
+
+        struct iovec iov[kMaxBlocks];
+        int n = count_;
+        for(int i = 0; i < n; i++){
+            iov[i].iov_base = blocks_[i];
+            iov[i].iov_len = static_cast<size_t>(i == n - 1 ? tail_ : kBlockSize);
+        }
+        count_ = 0;
+        tail_ = 0;
+
+        /** 部分写入时跳过已写部分继续提交 */
+        int first = 0;
+        while(first < n){
+            ssize_t written = ::writev(fd_, iov + first, n - first);
+            if(written < 0){
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            while(first < n && static_cast<size_t>(written) >= iov[first].iov_len){
+                written -= static_cast<ssize_t>(iov[first].iov_len);
+                first++;
+            }
+            if(first < n){
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+                iov[first].iov_len -= static_cast<size_t>(written);
+            }
+        }
+        return true;
+    }
+
+    int fd_;
+    QVector<char*> blocks_;
+    /** 使用中的缓冲块数量和最后一块已用字节数 */
+    int count_;
+    qint64 tail_;
+};
+#endif
+
+LogFileBackend* LogFileBackend::create()
+{
+#if defined(Q_OS_LINUX)
+    if(file_backend == qtlog::FileBackendMmap)
+        return new LogMmapBackend(static_cast<qint64>(mmap_chunk_size > 0 ? mmap_chunk_size : 8) << 20, mmap_sync_flush);
+    if(file_backend == qtlog::FileBackendWritev)
+        return new LogWritevBackend;
+#endif
+    return new LogQFileBackend;
+}
+
+/**
+ * @brief The LogSyncHandle class
+ * @details 日志文件句柄的副本。在文件锁内复制句柄，在锁外执行fdatasync，
+ * 同步期间其他线程可继续写入，文件切换关闭原句柄也不影响正在进行的同步
+ */
+class LogSyncHandle{
+public:
+#if defined(Q_OS_WIN)
+    LogSyncHandle():handle_(INVALID_HANDLE_VALUE){}
+
+    bool duplicate(int fd){
+        if(fd < 0)
+            return false;
+        HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+        return DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &handle_, 0, FALSE, DUPLICATE_SAME_ACCESS) != 0;
+    }
+
+    /** 同步到磁盘并关闭句柄副本 */
+    void sync(){
+        if(handle_ == INVALID_HANDLE_VALUE)
+            return;
+        FlushFileBuffers(handle_);
+        CloseHandle(handle_);
+        handle_ = INVALID_HANDLE_VALUE;
+    }
+
+private:
+    HANDLE handle_;
+#else
+    LogSyncHandle():handle_(-1){}
+
+    bool duplicate(int fd){
+        if(fd < 0)
+            return false;
+        handle_ = ::dup(fd);
+        return handle_ >= 0;
+    }
+
+    /** 同步到磁盘并关闭句柄副本 */
+    void sync(){
+        if(handle_ < 0)
+            return;
+#if defined(Q_OS_LINUX)
+        fdatasync(handle_);
+#else
+        fsync(handle_);
+#endif
+        ::close(handle_);
+        handle_ = -1;
+    }
+
+private:
+    int handle_;
+#endif
+};
+
+/**
+ * @brief The LogCompressor class
+ * @details 切换后的旧日志文件由后台线程池压缩，压缩到临时文件，完成后重命名并删除原文件。
+ * 线程池限制并发数，压缩线程以最低CPU和IO优先级运行。程序退出时取消未完成的压缩，原文件保留
+ */
+class LogCompressor : public QRunnable{
+public:
+    static void submit(const QString &path);
+    static void setThreads(int threads);
+    void run();
+
+private:
+    LogCompressor(const QString &path, int mode, int level);
+
+    bool compressGzip(QFile &in, QFile &out);
+#ifdef QTLOG_HAVE_ZSTD
+    bool compressZstd(QFile &in, QFile &out);
+#endif
+    static void lowerPriority();
+    static void shutdown();
+
+    QString path_;
+    int mode_;
+    int level_;
+
+    static QMutex mutex_;
+    static QThreadPool* pool_;
+    static std::atomic<bool> stopping_;
+};
+
+QMutex LogCompressor::mutex_;
+QThreadPool* LogCompressor::pool_ = nullptr;
+std::atomic<bool> LogCompressor::stopping_(false);
+
+/** 压缩读写块大小 */
+static const int kCompressChunk = 256 * 1024;
+
+LogCompressor::LogCompressor(const QString &path, int mode, int level):path_(path),mode_(mode),level_(level)
+{
+}
+
+void LogCompressor::submit(const QString &path)
+{
+    int mode = compression_mode;
+    if(mode == qtlog::CompressionNone || path.isEmpty() || stopping_.load())
+        return;
+    /** 分块格式文件按块压缩，整体压缩后无法按块随机读取 */
+    if(path.endsWith(QString(".") + QTLOGF_SUFFIX))
+        return;
+#ifndef QTLOG_HAVE_ZSTD
+    mode = qtlog::CompressionGzip;
+#endif
+
+    QMutexLocker locker(&mutex_);
+    if(!pool_){
+        pool_ = new QThreadPool;
+        pool_->setMaxThreadCount(qMax(1, compression_threads));
+        qAddPostRoutine(LogCompressor::shutdown);
+    }
+    pool_->start(new LogCompressor(path, mode, compression_level));
+}
+
+void LogCompressor::setThreads(int threads)
+{
+    QMutexLocker locker(&mutex_);
+    compression_threads = qMax(1, threads);
+    if(pool_)
+        pool_->setMaxThreadCount(compression_threads);
+}
+
+void LogCompressor::shutdown()
+{
+    QMutexLocker locker(&mutex_);
+    stopping_.store(true);
+    if(pool_){
+        /** 丢弃未开始的任务，正在压缩的任务检测到退出标志后删除临时文件 */
+        pool_->clear();
+        pool_->waitForDone();
+    }
+}
+
+void LogCompressor::lowerPriority()
+{
+#if defined(Q_OS_LINUX)
+    /** 线程池线程复用，每个任务开始时设置，对当前线程(tid)生效 */
+    static const int kIoprioClassShift = 13;
+    static const int kIoprioClassBestEffort = 2;
+    static const int kIoprioClassIdle = 3;
+    static const int kIoprioWhoProcess = 1;
+    int priority = compression_io_priority;
+    int ioprio = priority < 0 ? (kIoprioClassIdle << kIoprioClassShift)
+                              : ((kIoprioClassBestEffort << kIoprioClassShift) | qMin(priority, 7));
+    syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, ioprio);
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#elif defined(Q_OS_WIN)
+    /** 后台模式同时降低CPU和IO优先级 */
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#endif
+}
+
+void LogCompressor::run()
+{
+    if(stopping_.load())
+        return;
+    lowerPriority();
+
+    QFile in(path_);
+    if(!in.open(QIODevice::ReadOnly))
+        return;
+
+    QString target = path_ + (mode_ == qtlog::CompressionZstd ? ".zst" : ".gz");
+    QString temp = target + ".tmp";
+    QFile out(temp);
+    if(!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+
+    bool ok;
+#ifdef QTLOG_HAVE_ZSTD
+    if(mode_ == qtlog::CompressionZstd)
+        ok = compressZstd(in, out);
+    else
+#endif
+        ok = compressGzip(in, out);
+
+    ok = out.flush() && ok;
+    out.close();
+    in.close();
+
+    if(ok){
+        QFile::remove(target);
+        ok = QFile::rename(temp, target);
+    }
+    if(ok){
+        /** 索引中的偏移对应未压缩的文件，压缩后不再使用 */
+        QFile::remove(path_);
+        QFile::remove(path_ + QTLOGI_SUFFIX);
+    }
+    else
+        QFile::remove(temp);
+}
+
+bool LogCompressor::compressGzip(QFile &in, QFile &out)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    /** windowBits 15+16 输出gzip格式 */
+    int level = (level_ < 0 || level_ > 9) ? Z_DEFAULT_COMPRESSION : level_;
+    if(deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    QByteArray input(kCompressChunk, Qt::Uninitialized);
+    QByteArray output(kCompressChunk, Qt::Uninitialized);
+    bool ok = true;
+    int flush = Z_NO_FLUSH;
+    while(ok && flush != Z_FINISH){
+        qint64 length = in.read(input.data(), kCompressChunk);
+        if(length < 0 || stopping_.load()){
+            ok = false;
+            break;
+        }
+        flush = in.atEnd() ? Z_FINISH : Z_NO_FLUSH;
+        stream.next_in = reinterpret_cast<Bytef*>(input.data());
+        stream.avail_in = static_cast<uInt>(length);
+        do{
+            stream.next_out = reinterpret_cast<Bytef*>(output.data());
+            stream.avail_out = kCompressChunk;
+            if(deflate(&stream, flush) == Z_STREAM_ERROR){
+                ok = false;
+                break;
+            }
+            qint64 have = kCompressChunk - stream.avail_out;
+            if(out.write(output.constData(), have) != have){
+                ok = false;
+                break;
+            }
+        }while(stream.avail_out == 0);
+    }
+    deflateEnd(&stream);
+    return ok;
+}
+
+#ifdef QTLOG_HAVE_ZSTD
+bool LogCompressor::compressZstd(QFile &in, QFile &out)
+{
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+    if(!context)
+        return false;
+    ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, (level_ < 1 || level_ > 19) ? 3 : level_);
+
+    QByteArray input(kCompressChunk, Qt::Uninitialized);
+    QByteArray output(static_cast<int>(ZSTD_CStreamOutSize()), Qt::Uninitialized);
+    bool ok = true;
+    bool last = false;
+    while(ok && !last){
+        qint64 length = in.read(input.data(), kCompressChunk);
+        if(length < 0 || stopping_.load()){
+            ok = false;
+            break;
+        }
+        last = in.atEnd();
+        ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer source = { input.constData(), static_cast<size_t>(length), 0 };
+        bool finished;
+        do{
+            ZSTD_outBuffer target = { output.data(), static_cast<size_t>(output.size()), 0 };
+            size_t remaining = ZSTD_compressStream2(context, &target, &source, mode);
+            if(ZSTD_isError(remaining) || out.write(output.constData(), static_cast<qint64>(target.pos)) != static_cast<qint64>(target.pos)){
+                ok = false;
+                break;
+            }
+            finished = last ? (remaining == 0) : (source.pos == source.size);
+        }while(!finished);
+    }
+    ZSTD_freeCCtx(context);
+    return ok;
+}
+#endif
+
+struct LogCallSite;
+
+/**
+ * @brief The LogSpareFile struct
+ * @details 已创建目录、打开并写入文件头的日志文件，文件切换时直接替换当前文件
+ */
+struct LogSpareFile{
+    LogFileBackend* file = nullptr;
+    QString path;
+    QString directory;
+    bool binary = false;
+    /** 文本文件的输出格式，qtlog::OutputFormat，结构化格式不写文件头 */
+    int format = qtlog::OutputText;
+    /** 文件名和文件头中的创建时间，epoch毫秒 */
+    qint64 created = 0;
+    /** 文件头长度 */
+    qint64 length = 0;
+    /** 时间索引文件，未开启时为空 */
+    QFile* index = nullptr;
+    /** 分块格式的块大小，0表示不分块 */
+    int block_size = 0;
+    bool block_compress = false;
+};
+
+/**
+ * @brief WriteBlock
+ * @details 封装一个分块写入file，compress为true且压缩后更小时存储压缩内容。
+ * head、compressed为复用的缓冲区，返回写入文件的字节数
+ */
+static qint64 WriteBlock(LogFileBackend *file, const char *data, int len, qtlogformat::BlockHeader &header,
+                         bool compress, QByteArray &head, QByteArray &compressed)
+{
+    const char* stored = data;
+    int stored_length = len;
+    header.flags = 0;
+    if(compress && len > 0){
+        uLongf bound = compressBound(static_cast<uLong>(len));
+        compressed.resize(static_cast<int>(bound));
+        if(compress2(reinterpret_cast<Bytef*>(compressed.data()), &bound, reinterpret_cast<const Bytef*>(data),
+                     static_cast<uLong>(len), Z_BEST_SPEED) == Z_OK && bound < static_cast<uLongf>(len)){
+            stored = compressed.constData();
+            stored_length = static_cast<int>(bound);
+            header.flags |= QTLOGF_BLOCK_COMPRESSED;
+        }
+    }
+    header.storedLength = static_cast<quint32>(stored_length);
+    header.rawLength = static_cast<quint32>(len);
+    header.crc = 0;
+
+    /** CRC覆盖块头前44字节和存储内容 */
+    head.resize(0);
+    qtlogformat::appendBlockHeader(head, header);
+    quint32 crc = qtlogcrc32c::compute(0, head.constData(), QTLOGF_BLOCK_HEADER_SIZE - 4);
+    header.crc = qtlogcrc32c::compute(crc, stored, static_cast<size_t>(stored_length));
+    head.resize(QTLOGF_BLOCK_HEADER_SIZE - 4);
+    qtlogformat::appendFixed(head, header.crc, 4);
+
+    if(!file->write(head.constData(), head.size()) || !file->write(stored, stored_length))
+        return -1;
+    return head.size() + stored_length;
+}
+
+/** 关闭并删除日志文件及其索引文件 */
+static void RemoveSpare(LogSpareFile &spare)
+{
+    if(spare.file){
+        spare.file->close();
+        delete spare.file;
+        QFile::remove(spare.path);
+    }
+    if(spare.index){
+        delete spare.index;
+        QFile::remove(spare.path + QTLOGI_SUFFIX);
+    }
+    spare = LogSpareFile();
+}
+
+/** 距离零点多少秒时预先创建第二天的日志文件 */
+static const qint64 kSpareLeadSecs = 60;
+
+class LogFileObject{
+
+public:
+    LogFileObject(LogSeverity severity, QString &base_filename);
+    LogFileObject(QByteArray category,QString &base_filename);
+    ~LogFileObject();
+    void setBasename(QString &basename);
+    void write(int durability, LogSeverity severity, QByteArray &msg );
+
+    /**
+     * @brief writeBinary
+     * @details 以二进制格式写入一条消息，调用点定义在当前文件中首次出现时一并写入
+     */
+    void writeBinary(int durability, const LogCallSite *site, qint64 timestamp, quintptr thread, const QByteArray &payload);
+    void flushUnlocked();
+    void flush();
+
+    /** 有未flush的数据时刷新，后台刷新线程调用 */
+    void flushIfDirty();
+
+    /** 执行不等待落盘的写入发起的组提交，后台刷新线程调用 */
+    void syncPending();
+
+#if defined(Q_OS_LINUX)
+    /** 崩溃时写出当前块和后端缓存，不加锁、不分配内存 */
+    void crashFlush();
+#endif
+
+    /**
+     * @brief flushBefore
+     * @details fatal日志返回前调用，在deadline前取得文件锁时刷新缓存，sync为true且仍有剩余时间时同步到磁盘。
+     * 超时未取得文件锁时返回false
+     */
+    bool flushBefore(quint64 deadline, bool sync);
+
+    /** 二进制格式设置，当前文件格式不同时切换新文件 */
+    void setBinary(bool binary);
+    bool isBinary() const;
+
+    /**
+     * @brief setDurability
+     * @details 持久化级别设置，durability为-1时按全局 should_flush 设置。
+     * wait为true时DurabilityDataSync级别的写入等待本条记录落盘后返回
+     */
+    void setDurability(int durability, bool wait);
+    int durability() const;
+
+    /** 统计信息累加到stats */
+    void collectStats(quint64 &bytes_written, quint64 &rotations, qtlog::Stats &stats) const;
+
+    /**
+     * 日志根目录、当前日志目录以及正在使用的文件(当前文件和预备文件)的绝对路径，
+     * 由LogRetention调用，未设置日志目录时返回false
+     */
+    bool retentionInfo(QString &base, QString &directory, QStringList &active);
+
+    /** 后台线程预先打开的文件，由LogRotator调用 */
+    void storeSpare(LogSpareFile &spare);
+    void spareFailed();
+    void discardSpare();
+
+    /** 创建目录、打开日志文件并写入文件头，不访问成员，可在后台线程调用 */
+    static bool openLogfile(const QString &directory, qint64 created, bool binary, LogSpareFile &spare);
+
+private:
+    bool base_filename_selected_;
+    QString base_filename_;
+    QMutex mutex_;
+    LogFileBackend* file_;
+    LogSeverity severity_;
+
+    QByteArray category_;
+    qint64 file_length_ = 0;
+    qint64 bytes_since_flush_ = 0;
+    qint64 next_flush_time_ = 0;
+
+    /** 下一个本地零点，到达后切换新文件 */
+    qint64 rollover_time_ = 0;
+
+    /** 当前日志文件路径，切换后交给压缩线程 */
+    QString file_path_;
+
+    /** 设置的文件格式和当前打开文件的格式 */
+    std::atomic<bool> binary_{false};
+    bool file_binary_ = false;
+    int file_format_ = qtlog::OutputText;
+    /** 当前二进制文件中已写入定义的调用点，按调用点id索引 */
+    QVector<bool> sites_written_;
+    /** 当前二进制文件中已写入定义的线程及其编号，与调用点定义同时重新开始 */
+    QHash<quintptr, quint32> threads_;
+    /** 二进制消息内容的UTF-8编码缓冲区 */
+    QByteArray utf8_;
+    /** 上一条二进制记录的时间，消息记录只保存时间差 */
+    qint64 last_timestamp_ = 0;
+    /** 二进制记录编码缓冲区，在文件锁内复用 */
+    QByteArray record_;
+
+    /** 有写入但未flush(或未完成同步)的数据，后台刷新线程据此跳过空闲的文件 */
+    std::atomic<bool> dirty_{false};
+
+    /** 持久化级别，-1表示按全局 should_flush 设置 */
+    std::atomic<int> durability_{-1};
+    std::atomic<bool> durability_wait_{true};
+
+    /**
+     * 组提交：written_seq_ 为已写入记录的序号(文件锁内)，synced_seq_ 为已落盘的序号(sync_mutex_内)。
+     * 同一时间只有一个线程执行fdatasync，其余等待的写入由这一次同步一并覆盖
+     */
+    quint64 written_seq_ = 0;
+    QMutex sync_mutex_;
+    QWaitCondition synced_;
+    quint64 synced_seq_ = 0;
+    bool syncing_ = false;
+    bool sync_pending_ = false;
+    /** 切换文件时复制的旧文件句柄(文件锁内)，由下一轮同步在文件锁外先于当前文件落盘 */
+    QVector<LogSyncHandle> rotated_handles_;
+
+    /** 运行统计，在文件锁内更新 */
+    std::atomic<quint64> bytes_written_{0};
+    std::atomic<quint64> rotations_{0};
+    std::atomic<quint64> write_failures_{0};
+    /** 当前文件写入失败，下一次写入前切换新文件 */
+    bool file_broken_ = false;
+    LogHistogram write_latency_;
+    LogHistogram flush_latency_;
+
+    /** 分块格式的块大小(0不分块)和当前块，块头在封装时写入 */
+    int file_block_size_ = 0;
+    bool file_block_compress_ = false;
+    QByteArray block_;
+    qtlogformat::BlockHeader block_header_;
+    QByteArray block_head_;
+    QByteArray block_compressed_;
+
+    /** 时间索引文件，index_bucket_为上一索引项所在的秒，index_offset_为其文件偏移 */
+    QFile* index_ = nullptr;
+    qint64 index_bucket_ = -1;
+    qint64 index_offset_ = 0;
+    QByteArray index_entry_;
+
+    /** 后台预先打开的下一个日志文件，spare_mutex_保护，不占用文件锁 */
+    QMutex spare_mutex_;
+    LogSpareFile spare_;
+    std::atomic<bool> spare_requested_{false};
+
+    bool prepareLogfile(bool binary);
+    bool takeSpare(bool binary, const QString &directory, LogSpareFile &spare);
+    void install(LogSpareFile &spare);
+    void markUnlocked(qint64 timestamp);
+    void sealBlockUnlocked();
+    void requestSpare();
+    QString logDirectory() const;
+    static QByteArray fileHeader(bool binary, int format, qint64 created);
+    void writeUnlocked(int durability, LogSeverity severity, qint64 timestamp, const char *data, int len);
+    void writeFailedUnlocked(quint64 records);
+    void commit(quint64 seq, bool wait);
+    void syncRound(QMutexLocker &locker);
+    quint64 syncFile();
+};
+
+/**
+ * @brief The LogFlusher class
+ * @details 后台刷新线程，每隔logbufsecs唤醒一次，只刷新有未flush数据的日志文件，
+ * 保证停止写入的日志在logbufsecs内提交到系统，不需要依赖下一次写入检查刷新时间。
+ * 同时为不等待落盘的DurabilityDataSync写入执行组提交，写日志的线程只发起请求
+ */
+class LogFlusher : public QThread{
+public:
+    static void enable();
+    static void disable();
+    /** 刷新间隔变化时立即按新间隔计时 */
+    static void wakeUp();
+    /**
+     * 请求后台线程尽快执行等待中的组提交(DurabilityDataSync且不等待落盘的写入)，
+     * 未开启后台刷新线程时返回false，由调用者自行同步。不能在持有sync_mutex_时调用
+     */
+    static bool requestSync();
+
+protected:
+    void run();
+
+private:
+    LogFlusher():stopping_(false){}
+    static void shutdown();
+
+    QMutex mutex_;
+    QWaitCondition wake_;
+    bool stopping_;
+
+    static LogFlusher* instance_;
+    static std::atomic<bool> sync_requested_;
+    static QMutex control_mutex_;
+    static bool post_routine_added_;
+};
+
+LogFlusher* LogFlusher::instance_ = nullptr;
+std::atomic<bool> LogFlusher::sync_requested_(false);
+QMutex LogFlusher::control_mutex_;
+bool LogFlusher::post_routine_added_ = false;
+
+/**
+ * @brief The LogRetention class
+ * @details 磁盘空间和旧日志保留管理线程。每秒检查一次日志所在磁盘的可用空间，
+ * 按setqtLogMinFreeSpace阈值设置shed_severity和stop_writing标志，写日志路径只读取标志；
+ * 文件切换后或每分钟按setqtLogRetention限制从旧到新删除各日志目录下的旧文件
+ */
+class LogRetention : public QThread{
+public:
+    static void enable();
+    static void disable();
+    /** 文件切换后请求尽快检查保留限制，只设置标志，可在文件锁内调用 */
+    static void requestScan();
+
+protected:
+    void run();
+
+private:
+    LogRetention():stopping_(false){}
+    static void shutdown();
+
+    void checkDiskSpace(const QStringList &bases);
+    /** listed为取得active快照前的时间，epoch毫秒 */
+    void enforce(const QStringList &directories, const QStringList &active, qint64 listed);
+
+    QMutex mutex_;
+    QWaitCondition wake_;
+    bool stopping_;
+
+    static std::atomic<bool> scan_requested_;
+    static LogRetention* instance_;
+    static QMutex control_mutex_;
+    static bool post_routine_added_;
+};
+
+/**
+ * @brief The LogRotator class
+ * @details 日志文件接近大小上限或零点时，在后台线程创建目录、打开下一个文件并写入文件头，
+ * 写线程切换文件时直接替换，不在文件锁内执行mkpath、打开文件等耗时操作
+ */
+class LogRotator : public QRunnable{
+public:
+    static void submit(LogFileObject *object, const QString &directory, qint64 created, bool binary);
+    void run();
+
+private:
+    LogRotator(LogFileObject *object, const QString &directory, qint64 created, bool binary);
+    static void shutdown();
+
+    LogFileObject* object_;
+    QString directory_;
+    /** 文件创建时间，0表示使用打开时的时间 */
+    qint64 created_;
+    bool binary_;
+
+    static QMutex mutex_;
+    static QThreadPool* pool_;
+    static bool stopping_;
+};
+
+QMutex LogRotator::mutex_;
+QThreadPool* LogRotator::pool_ = nullptr;
+bool LogRotator::stopping_ = false;
+
+class LogDestination;
+
+/**
+ * @brief The LogRateState struct
+ * @details 一个调用点或分类的限流状态，见LogRateLimiter
+ */
+struct LogRateState{
+    /** 令牌桶的理论到达时间，MonotonicNanos */
+    std::atomic<quint64> tat{0};
+    /** 采样计数 */
+    std::atomic<quint64> seen{0};
+    /** 上一条消息的哈希，合并重复消息使用 */
+    std::atomic<quint64> last_hash{0};
+    /** 未报告的抑制数量和最近被抑制消息的等级 */
+    std::atomic<quint64> suppressed{0};
+    std::atomic<int> severity{QDEBUG};
+};
+
+/**
+ * @brief The LogCounterShard struct
+ * @details 分类计数器的一个分片，按线程分配分片，按缓存行对齐并占满一个缓存行，避免不同线程的分片伪共享
+ */
+struct alignas(64) LogCounterShard{
+    std::atomic<quint64> messages[NUM_SEVERITIES];
+    std::atomic<quint64> bytes;
+    char padding[64 - (NUM_SEVERITIES + 1) * sizeof(quint64)];
+};
+
+static const int kCounterShards = 16;
+
+/** 当前线程使用的计数器分片，线程首次记录日志时轮流分配 */
+static inline int CounterShard()
+{
+    static std::atomic<int> next(0);
+    static thread_local int shard = next.fetch_add(1, std::memory_order_relaxed) % kCounterShards;
+    return shard;
+}
+
+/**
+ * @brief The LogCategory struct
+ * @details 分类索引中的一个分类，创建后不释放，指针可在线程间安全传递
+ */
+struct LogCategory{
+    LogCategory():destination(nullptr),binary(false),durability(-1),durability_wait(true),dropped_total(0){
+        for(int i = 0; i < NUM_SEVERITIES; i++)
+            dropped[i].store(0, std::memory_order_relaxed);
+        for(int shard = 0; shard < kCounterShards; shard++){
+            for(int i = 0; i < NUM_SEVERITIES; i++)
+                counters[shard].messages[i].store(0, std::memory_order_relaxed);
+            counters[shard].bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /** 记录一条消息 */
+    inline void count(LogSeverity severity, quint64 size){
+        LogCounterShard &shard = counters[CounterShard()];
+        shard.messages[severity].fetch_add(1, std::memory_order_relaxed);
+        shard.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    QByteArray name;
+    quint64 hash = 0;
+    /** 分类模式下该分类的日志目标，首次使用时创建，普通模式下为空 */
+    std::atomic<LogDestination*> destination;
+    /** 分类模式下该分类是否写入二进制格式，创建日志目标时应用 */
+    std::atomic<bool> binary;
+    /** 分类模式下该分类的持久化级别，-1为全局设置，创建日志目标时应用 */
+    std::atomic<int> durability;
+    std::atomic<bool> durability_wait;
+    /** 异步模式队列满时各等级丢弃的数量，写入丢弃提示后清零 */
+    std::atomic<quint64> dropped[NUM_SEVERITIES];
+    /** 丢弃总数，不清零 */
+    std::atomic<quint64> dropped_total;
+    /** 各等级消息数和字节数 */
+    LogCounterShard counters[kCounterShards];
+    /** 按分类限流时的状态 */
+    LogRateState rate;
+};
+
+/**
+ * @brief The LogCategoryIndex class
+ * @details 读多写少的分类索引。先按context.category指针查找(通常为QLoggingCategory的静态名称)，
+ * 未命中时按字符串哈希查找。查找不加锁也不分配内存，只有插入新分类或新指针别名时加锁。
+ * 开放寻址表只增不删，扩容时发布新表，旧表保留到进程退出，正在读取旧表的线程不受影响
+ */
+class LogCategoryIndex{
+public:
+    static LogCategory* lookup(const char *name);
+
+    /** 当前全部分类的快照 */
+    static QVector<LogCategory*> categories();
+
+    /** 不加锁、不分配内存遍历全部分类，崩溃处理时使用 */
+    static void visit(void (*function)(LogCategory*));
+
+private:
+    struct Slot{
+        std::atomic<quintptr> key;
+        std::atomic<LogCategory*> value;
+    };
+
+    struct Table{
+        explicit Table(quint32 capacity):mask(capacity - 1),pointers(new Slot[capacity]),hashes(new Slot[capacity]){
+            for(quint32 i = 0; i < capacity; i++){
+                pointers[i].key.store(0, std::memory_order_relaxed);
+                pointers[i].value.store(nullptr, std::memory_order_relaxed);
+                hashes[i].key.store(0, std::memory_order_relaxed);
+                hashes[i].value.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        quint32 mask;
+        Slot* pointers;
+        Slot* hashes;
+    };
+
+    static quint64 hashString(const char *name);
+    static quint32 hashPointer(const char *name);
+    static LogCategory* findHash(Table *table, const char *name, quint64 hash);
+    static LogCategory* insert(const char *name, quint64 hash);
+    static void addAlias(const char *name, LogCategory *category);
+    static void store(Slot *entries, quint32 mask, quint32 index, quintptr key, LogCategory *category);
+    static bool reserve(int count);
+
+    static std::atomic<Table*> table_;
+    static QMutex mutex_;
+    static QVector<LogCategory*> categories_;
+    static QVector<QPair<const char*,LogCategory*> > aliases_;
+    /** 别名数量已达上限，查找时不再加锁尝试添加，新增分类时清除 */
+    static std::atomic<bool> aliases_full_;
+};
+
+std::atomic<LogCategoryIndex::Table*> LogCategoryIndex::table_(nullptr);
+QMutex LogCategoryIndex::mutex_;
+QVector<LogCategory*> LogCategoryIndex::categories_;
+QVector<QPair<const char*,LogCategory*> > LogCategoryIndex::aliases_;
+std::atomic<bool> LogCategoryIndex::aliases_full_(false);
+
+inline quint64 LogCategoryIndex::hashString(const char *name)
+{
+    /** FNV-1a，最低位置1保证不为0，0表示空槽 */
+    quint64 hash = 14695981039346656037ull;
+    for(const unsigned char *p = reinterpret_cast<const unsigned char*>(name); *p; ++p){
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash | 1;
+}
+
+inline quint32 LogCategoryIndex::hashPointer(const char *name)
+{
+    quint64 key = static_cast<quint64>(reinterpret_cast<quintptr>(name));
+    return static_cast<quint32>((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+inline LogCategory* LogCategoryIndex::findHash(Table *table, const char *name, quint64 hash)
+{
+    quint32 i = static_cast<quint32>(hash >> 32) & table->mask;
+    for(;;){
+        quintptr key = table->hashes[i].key.load(std::memory_order_acquire);
+        if(key == 0)
+            return nullptr;
+        if(key == static_cast<quintptr>(hash)){
+            LogCategory* category = table->hashes[i].value.load(std::memory_order_relaxed);
+            if(strcmp(category->name.constData(), name) == 0)
+                return category;
+        }
+        i = (i + 1) & table->mask;
+    }
+}
+
+LogCategory* LogCategoryIndex::lookup(const char *name)
+{
+    if(!name)
+        name = "default";
+
+    Table* table = table_.load(std::memory_order_acquire);
+    if(table){
+        /** 指针命中后仍比较字符串，防止临时字符串释放后地址被其他分类复用 */
+        quint32 i = hashPointer(name) & table->mask;
+        for(;;){
+            quintptr key = table->pointers[i].key.load(std::memory_order_acquire);
+            if(key == 0)
+                break;
+            if(key == reinterpret_cast<quintptr>(name)){
+                LogCategory* category = table->pointers[i].value.load(std::memory_order_relaxed);
+                if(strcmp(category->name.constData(), name) == 0)
+                    return category;
+            }
+            i = (i + 1) & table->mask;
+        }
+
+        quint64 hash = hashString(name);
+        LogCategory* category = findHash(table, name, hash);
+        if(category){
+            if(!aliases_full_.load(std::memory_order_relaxed))
+                addAlias(name, category);
+            return category;
+        }
+        return insert(name, hash);
+    }
+    return insert(name, hashString(name));
+}
+
+void LogCategoryIndex::visit(void (*function)(LogCategory*))
+{
+    Table* table = table_.load(std::memory_order_acquire);
+    if(!table)
+        return;
+    for(quint32 i = 0; i <= table->mask; i++){
+        if(table->hashes[i].key.load(std::memory_order_acquire) == 0)
+            continue;
+        LogCategory* category = table->hashes[i].value.load(std::memory_order_relaxed);
+        if(category)
+            function(category);
+    }
+}
+
+QVector<LogCategory*> LogCategoryIndex::categories()
+{
+    QMutexLocker locker(&mutex_);
+    return categories_;
+}
+
+void LogCategoryIndex::store(Slot *entries, quint32 mask, quint32 index, quintptr key, LogCategory *category)
+{
+    quint32 i = index & mask;
+    while(entries[i].key.load(std::memory_order_relaxed) != 0)
+        i = (i + 1) & mask;
+    entries[i].value.store(category, std::memory_order_relaxed);
+    entries[i].key.store(key, std::memory_order_release);
+}
+
+bool LogCategoryIndex::reserve(int count)
+{
+    /** 负载因子不超过1/2，扩容时按全部分类和别名重建新表，返回true表示已重建 */
+    Table* table = table_.load(std::memory_order_relaxed);
+    if(table && static_cast<quint32>(count) * 2 <= table->mask + 1)
+        return false;
+
+    quint32 capacity = table ? (table->mask + 1) * 2 : 64;
+    while(static_cast<quint32>(count) * 2 > capacity)
+        capacity *= 2;
+
+    Table* grown = new Table(capacity);
+    for(LogCategory* category : categories_)
+        store(grown->hashes, grown->mask, static_cast<quint32>(category->hash >> 32), static_cast<quintptr>(category->hash), category);
+    for(const QPair<const char*,LogCategory*> &alias : aliases_)
+        store(grown->pointers, grown->mask, hashPointer(alias.first), reinterpret_cast<quintptr>(alias.first), alias.second);
+    table_.store(grown, std::memory_order_release);
+    return true;
+}
+
+LogCategory* LogCategoryIndex::insert(const char *name, quint64 hash)
+{
+    QMutexLocker locker(&mutex_);
+    Table* table = table_.load(std::memory_order_relaxed);
+    if(table){
+        LogCategory* category = findHash(table, name, hash);
+        if(category)
+            return category;
+    }
+
+    /** 计数分片按缓存行对齐，C++11的new不保证超过16字节的对齐。分类创建后不释放 */
+    void* storage = qMallocAligned(sizeof(LogCategory), alignof(LogCategory));
+    LogCategory* category = new (storage) LogCategory;
+    category->name = QByteArray(name);
+    category->hash = hash;
+    categories_.append(category);
+    aliases_.append(qMakePair(name, category));
+    aliases_full_.store(false, std::memory_order_relaxed);
+    if(reserve(qMax(categories_.size(), aliases_.size())))
+        return category;
+
+    table = table_.load(std::memory_order_relaxed);
+    store(table->hashes, table->mask, static_cast<quint32>(hash >> 32), static_cast<quintptr>(hash), category);
+    store(table->pointers, table->mask, hashPointer(name), reinterpret_cast<quintptr>(name), category);
+    return category;
+}
+
+void LogCategoryIndex::addAlias(const char *name, LogCategory *category)
+{
+    QMutexLocker locker(&mutex_);
+    /** 动态生成的分类名每次地址不同，别名数量设上限，超出后只走哈希查找 */
+    if(aliases_.size() >= categories_.size() * 4 + 64){
+        aliases_full_.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    Table* table = table_.load(std::memory_order_relaxed);
+    quint32 i = hashPointer(name) & table->mask;
+    for(;;){
+        quintptr key = table->pointers[i].key.load(std::memory_order_relaxed);
+        if(key == 0)
+            break;
+        if(key == reinterpret_cast<quintptr>(name) && table->pointers[i].value.load(std::memory_order_relaxed) == category)
+            return;
+        i = (i + 1) & table->mask;
+    }
+
+    aliases_.append(qMakePair(name, category));
+    if(reserve(qMax(categories_.size(), aliases_.size())))
+        return;
+    table = table_.load(std::memory_order_relaxed);
+    store(table->pointers, table->mask, hashPointer(name), reinterpret_cast<quintptr>(name), category);
+}
+
+/**
+ * @brief The LogCallSite struct
+ * @details 一个日志调用点(文件、行号、函数、分类、等级)，二进制格式中消息只记录调用点id，
+ * 调用点的字符串信息每个文件只写一次。创建后不释放
+ */
+struct LogCallSite{
+    quint32 id = 0;
+    LogSeverity severity = 0;
+    int line = 0;
+    quint64 hash = 0;
+    /** 查找用的原始指针，通常为__FILE__和Q_FUNC_INFO的静态字符串 */
+    const char* file_key = nullptr;
+    const char* function_key = nullptr;
+    LogCategory* category = nullptr;
+    QByteArray file;
+    QByteArray function;
+    /** 按调用点限流时的状态 */
+    LogRateState rate;
+};
+
+/**
+ * @brief The LogCallSiteIndex class
+ * @details 全局调用点注册表，结构与LogCategoryIndex相同：查找不加锁，首次出现的调用点加锁插入，
+ * 开放寻址表只增不删，扩容时发布新表
+ */
+class LogCallSiteIndex{
+public:
+    static LogCallSite* lookup(const QMessageLogContext &context, LogSeverity severity, LogCategory *category);
+
+    /** 当前全部调用点的快照 */
+    static QVector<LogCallSite*> sites();
+
+private:
+    struct Table{
+        explicit Table(quint32 capacity):mask(capacity - 1),entries(new std::atomic<LogCallSite*>[capacity]){
+            for(quint32 i = 0; i < capacity; i++)
+                entries[i].store(nullptr, std::memory_order_relaxed);
+        }
+        quint32 mask;
+        std::atomic<LogCallSite*>* entries;
+    };
+
+    static quint64 hashKey(const QMessageLogContext &context, LogSeverity severity, LogCategory *category);
+    static LogCallSite* find(Table *table, const QMessageLogContext &context, LogSeverity severity,
+                             LogCategory *category, quint64 hash);
+    static LogCallSite* insert(const QMessageLogContext &context, LogSeverity severity, LogCategory *category, quint64 hash);
+    static void store(Table *table, LogCallSite *site);
+
+    static std::atomic<Table*> table_;
+    static QMutex mutex_;
+    static QVector<LogCallSite*> sites_;
+};
+
+std::atomic<LogCallSiteIndex::Table*> LogCallSiteIndex::table_(nullptr);
+QMutex LogCallSiteIndex::mutex_;
+QVector<LogCallSite*> LogCallSiteIndex::sites_;
+
+inline quint64 LogCallSiteIndex::hashKey(const QMessageLogContext &context, LogSeverity severity, LogCategory *category)
+{
+    quint64 hash = static_cast<quint64>(reinterpret_cast<quintptr>(context.file));
+    hash = (hash ^ static_cast<quint64>(reinterpret_cast<quintptr>(context.function))) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ static_cast<quint64>(reinterpret_cast<quintptr>(category))) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (static_cast<quint64>(static_cast<quint32>(context.line)) << 3 | static_cast<quint64>(severity))) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 29);
+}
+
+inline LogCallSite* LogCallSiteIndex::find(Table *table, const QMessageLogContext &context, LogSeverity severity,
+                                           LogCategory *category, quint64 hash)
+{
+    quint32 i = static_cast<quint32>(hash >> 32) & table->mask;
+    for(;;){
+        LogCallSite* site = table->entries[i].load(std::memory_order_acquire);
+        if(!site)
+            return nullptr;
+        if(site->hash == hash && site->line == context.line && site->severity == severity && site->category == category
+                && site->file_key == context.file && site->function_key == context.function)
+            return site;
+        i = (i + 1) & table->mask;
+    }
+}
+
+LogCallSite* LogCallSiteIndex::lookup(const QMessageLogContext &context, LogSeverity severity, LogCategory *category)
+{
+    quint64 hash = hashKey(context, severity, category);
+    Table* table = table_.load(std::memory_order_acquire);
+    if(table){
+        LogCallSite* site = find(table, context, severity, category, hash);
+        if(site)
+            return site;
+    }
+    return insert(context, severity, category, hash);
+}
+
+QVector<LogCallSite*> LogCallSiteIndex::sites()
+{
+    QMutexLocker locker(&mutex_);
+    return sites_;
+}
+
+void LogCallSiteIndex::store(Table *table, LogCallSite *site)
+{
+    quint32 i = static_cast<quint32>(site->hash >> 32) & table->mask;
+    while(table->entries[i].load(std::memory_order_relaxed))
+        i = (i + 1) & table->mask;
+    table->entries[i].store(site, std::memory_order_release);
+}
+
+LogCallSite* LogCallSiteIndex::insert(const QMessageLogContext &context, LogSeverity severity, LogCategory *category, quint64 hash)
+{
+    QMutexLocker locker(&mutex_);
+    Table* table = table_.load(std::memory_order_relaxed);
+    if(table){
+        LogCallSite* site = find(table, context, severity, category, hash);
+        if(site)
+            return site;
+    }
+
+    LogCallSite* site = new LogCallSite;
+    /** id 0 保留给内部文本行 */
+    site->id = static_cast<quint32>(sites_.size()) + 1;
+    site->severity = severity;
+    site->line = context.line;
+    site->hash = hash;
+    site->file_key = context.file;
+    site->function_key = context.function;
+    site->category = category;
+    site->file = QByteArray(context.file ? context.file : "unknown");
+    site->function = QByteArray(context.function ? context.function : "unknown");
+    sites_.append(site);
+
+    /** 负载因子不超过1/2，扩容时重建新表 */
+    if(!table || static_cast<quint32>(sites_.size()) * 2 > table->mask + 1){
+        quint32 capacity = table ? (table->mask + 1) * 2 : 256;
+        Table* grown = new Table(capacity);
+        for(LogCallSite* entry : sites_)
+            store(grown, entry);
+        table_.store(grown, std::memory_order_release);
+    }
+    else{
+        store(table, site);
+    }
+    return site;
+}
+
+class LogDestination{
+public:
+    static void setCategoryMode(bool mode);
+    static void setLogDestination(LogSeverity severity,
+                                  QString &pathdir);
+    static void setLogDestination(QString &pathdir);
+
+    static void LogToAllLogfiles(LogSeverity severity, QByteArray &msg, LogCategory *category);
+
+    static bool getCategoryMode();
+
+    static void flushAllLogs();
+
+#if defined(Q_OS_LINUX)
+    /** 崩溃处理时写出全部日志目标的缓存，不加锁、不分配内存 */
+    static void crashFlushAll();
+#endif
+
+    /** fatal日志返回前在deadline前刷新全部日志目标，返回未能刷新的数量 */
+    static int flushAllBefore(quint64 deadline, bool sync);
+
+    /** 只刷新有未flush数据的日志文件 */
+    static void flushDirtyLogs();
+
+    /** 执行全部日志文件等待中的组提交 */
+    static void syncPendingLogs();
+
+    /** 删除全部未使用的预备文件 */
+    static void discardSpares();
+
+    /** 全部日志目标的根目录、日志目录和正在使用的文件，供LogRetention检查 */
+    static void retentionTargets(QStringList &bases, QStringList &directories, QStringList &active);
+
+    /** 各分类计数和日志文件统计累加到stats */
+    static void collectStats(qtlog::Stats &stats);
+
+    /**
+     * @brief destination
+     * @param severity
+     * @param category
+     * @return LogDestination指针
+     * @details 按当前模式获取日志目标，分类模式下根据category，普通模式下根据severity
+     */
+    static LogDestination* destination(LogSeverity severity, LogCategory *category);
+
+    /**
+     * @brief setBinary
+     * @details 普通模式下设置severity等级日志文件的格式
+     */
+    static void setBinary(LogSeverity severity, bool binary);
+
+    /**
+     * @brief setBinary
+     * @details 分类模式下设置category分类日志文件的格式
+     */
+    static void setBinary(const QByteArray &category, bool binary);
+
+    /** 普通模式下设置severity等级日志文件的持久化级别 */
+    static void setDurability(LogSeverity severity, int durability, bool wait);
+
+    /** 分类模式下设置category分类日志文件的持久化级别 */
+    static void setDurability(const QByteArray &category, int durability, bool wait);
+
+    void write(LogSeverity severity, QByteArray &msg);
+
+    void writeBinary(const LogCallSite *site, qint64 timestamp, quintptr thread, const QByteArray &payload);
+
+    bool isBinary() const;
+
+private:
+    LogDestination(LogSeverity severity,QString &base_filename);
+    LogDestination(QByteArray category,QString &base_filename);
+    ~LogDestination();
+
+    /** LogDestination的文件句柄 */
+    LogFileObject fileobject_;
+
+    /** 声明LogDestination指针数组 */
+    static std::atomic<LogDestination*> log_destinations_[NUM_SEVERITIES];
+
+    /** 创建LogDestination时加锁，查找不加锁 */
+    static QMutex create_mutex_;
+
+    static bool CategoryMode_;
+
+    static QString category_base_filename_;
+
+    /**
+     * @brief log_destinations
+     * @param severity
+     * @return LogDestination指针
+     * @details 根据serverity获取对应的LogDestination指针
+     */
+    static LogDestination* log_destinations(LogSeverity severity);
+
+    static LogDestination* log_destinations(LogCategory *category);
+
+
+};
+
+
+LogFileObject::LogFileObject(LogSeverity severity, QString &base_filename):
+    base_filename_selected_(base_filename.size() != 0),
+    base_filename_((base_filename.size() != 0) ? base_filename : QString()),
+    file_(nullptr),
+    severity_(severity),file_length_(0){
+    category_.clear();
+}
+
+LogFileObject::LogFileObject(QByteArray category,QString &base_filename):base_filename_selected_(true),file_(nullptr)
+{
+    base_filename_ = base_filename;
+    category_ = category;
+    severity_ = -1;
+}
+
+LogFileObject::~LogFileObject(){
+    for(LogSyncHandle &old : rotated_handles_)
+        old.sync();
+    if(file_)
+        delete file_;
+    if(index_)
+        delete index_;
+    discardSpare();
+}
+
+void LogFileObject::setBasename(QString &basename){
+    base_filename_selected_ = true;
+    if (base_filename_ != basename) {
+        base_filename_ = basename;
+    }
+}
+
+void LogFileObject::write(int durability, LogSeverity severity, QByteArray &msg){
+    QMutexLocker locker(&mutex_);
+
+    if(!prepareLogfile(binary_.load(std::memory_order_relaxed)))
+        return;
+
+    qint64 timestamp = LogClock::nowMSecs();
+    markUnlocked(timestamp);
+
+    if(file_binary_){
+        /** 二进制文件中的内部文本行(不含换行)作为id为0的消息记录 */
+        int length = msg.endsWith('\n') ? msg.size() - 1 : msg.size();
+        record_.resize(0);
+        record_.append(QTLOGB_RECORD_MESSAGE);
+        qtlogformat::appendVarint(record_, QTLOGB_SITE_RAW);
+        qtlogformat::appendZigzag(record_, 0);
+        qtlogformat::appendVarint(record_, 0);
+        record_.append(static_cast<char>(QTLOGB_ENCODING_UTF8));
+        qtlogformat::appendString(record_, msg.constData(), length);
+        writeUnlocked(durability, severity, timestamp, record_.constData(), record_.size());
+    }
+    else{
+        writeUnlocked(durability, severity, timestamp, msg.constData(), msg.size());
+    }
+
+    if(durability == qtlog::DurabilityDataSync){
+        quint64 seq = written_seq_;
+        locker.unlock();
+        commit(seq, durability_wait_.load(std::memory_order_relaxed));
+    }
+}
+
+void LogFileObject::writeBinary(int durability, const LogCallSite *site, qint64 timestamp, quintptr thread, const QByteArray &payload)
+{
+    QMutexLocker locker(&mutex_);
+
+    if(!prepareLogfile(true))
+        return;
+
+    markUnlocked(timestamp);
+
+    record_.resize(0);
+    if(static_cast<int>(site->id) >= sites_written_.size())
+        sites_written_.resize(static_cast<int>(site->id) + 1);
+    if(!sites_written_[static_cast<int>(site->id)]){
+        record_.append(QTLOGB_RECORD_SITE);
+        qtlogformat::appendVarint(record_, site->id);
+        record_.append(static_cast<char>(site->severity));
+        qtlogformat::appendVarint(record_, static_cast<quint32>(site->line));
+        qtlogformat::appendString(record_, site->file.constData(), site->file.size());
+        qtlogformat::appendString(record_, site->function.constData(), site->function.size());
+        qtlogformat::appendString(record_, site->category->name.constData(), site->category->name.size());
+        sites_written_[static_cast<int>(site->id)] = true;
+    }
+
+    /** 线程指针按文件编号，消息中只记录1到2字节的编号 */
+    quint32 &thread_id = threads_[thread];
+    if(thread_id == 0){
+        thread_id = static_cast<quint32>(threads_.size());
+        record_.append(QTLOGB_RECORD_THREAD);
+        qtlogformat::appendVarint(record_, thread_id);
+        qtlogformat::appendVarint(record_, static_cast<quint64>(thread));
+    }
+
+    /** payload为UTF-16，写入时编码为UTF-8，常见的ASCII消息只占一半空间 */
+    const ushort* text = reinterpret_cast<const ushort*>(payload.constData());
+    const int len = payload.size() / 2;
+    utf8_.resize(len * 3);
+    char* begin = utf8_.data();
+    char* out = begin;
+    for(int i = 0; i < len; i++)
+        out = putUtf8(out, text, i, len);
+
+    record_.append(QTLOGB_RECORD_MESSAGE);
+    qtlogformat::appendVarint(record_, site->id);
+    qtlogformat::appendZigzag(record_, timestamp - last_timestamp_);
+    last_timestamp_ = timestamp;
+    qtlogformat::appendVarint(record_, thread_id);
+    record_.append(static_cast<char>(QTLOGB_ENCODING_UTF8));
+    qtlogformat::appendString(record_, begin, static_cast<int>(out - begin));
+
+    writeUnlocked(durability, site->severity, timestamp, record_.constData(), record_.size());
+
+    if(durability == qtlog::DurabilityDataSync){
+        quint64 seq = written_seq_;
+        locker.unlock();
+        commit(seq, durability_wait_.load(std::memory_order_relaxed));
+    }
+}
+
+void LogFileObject::setBinary(bool binary)
+{
+    binary_.store(binary, std::memory_order_relaxed);
+}
+
+bool LogFileObject::isBinary() const
+{
+    return binary_.load(std::memory_order_relaxed);
+}
+
+void LogFileObject::setDurability(int durability, bool wait)
+{
+    durability_.store(durability, std::memory_order_relaxed);
+    durability_wait_.store(wait, std::memory_order_relaxed);
+}
+
+int LogFileObject::durability() const
+{
+    int durability = durability_.load(std::memory_order_relaxed);
+    if(durability < 0)
+        return should_flush ? qtlog::DurabilityFlush : qtlog::DurabilityNone;
+    return durability;
+}
+
+void LogFileObject::commit(quint64 seq, bool wait)
+{
+    QMutexLocker locker(&sync_mutex_);
+    if(!wait){
+        if(synced_seq_ >= seq)
+            return;
+        /** 不等待的写入只发起同步：正在同步时由执行同步的线程在本轮结束后补提交，否则交给后台刷新线程 */
+        sync_pending_ = true;
+        dirty_.store(true, std::memory_order_relaxed);
+        if(syncing_)
+            return;
+        locker.unlock();
+        if(LogFlusher::requestSync())
+            return;
+        /** 未开启后台刷新线程时在当前线程同步 */
+        locker.relock();
+    }
+
+    while(synced_seq_ < seq){
+        if(syncing_){
+            synced_.wait(&sync_mutex_);
+            continue;
+        }
+        syncRound(locker);
+    }
+
+    /** 上一轮同步期间有未等待的写入，再提交一轮 */
+    while(sync_pending_ && !syncing_)
+        syncRound(locker);
+}
+
+void LogFileObject::syncPending()
+{
+    QMutexLocker locker(&sync_mutex_);
+    while(sync_pending_ && !syncing_)
+        syncRound(locker);
+}
+
+void LogFileObject::syncRound(QMutexLocker &locker)
+{
+    syncing_ = true;
+    sync_pending_ = false;
+    locker.unlock();
+
+    quint64 target = syncFile();
+
+    locker.relock();
+    synced_seq_ = qMax(synced_seq_, target);
+    syncing_ = false;
+    synced_.wakeAll();
+}
+
+quint64 LogFileObject::syncFile()
+{
+    LogSyncHandle handle;
+    QVector<LogSyncHandle> rotated;
+    quint64 target;
+    {
+        /** 文件锁内提交缓存并复制句柄，fdatasync在锁外执行，不阻塞其他写入 */
+        QMutexLocker locker(&mutex_);
+        flushUnlocked();
+        target = written_seq_;
+        rotated.swap(rotated_handles_);
+        if(file_)
+            handle.duplicate(file_->handle());
+    }
+    /** target之前的记录可能在切换前的文件中 */
+    for(LogSyncHandle &old : rotated)
+        old.sync();
+    handle.sync();
+    return target;
+}
+
+bool LogFileObject::prepareLogfile(bool binary){
+    if(base_filename_selected_&&base_filename_.isEmpty()){
+        return false;
+    }
+
+    /** 超过大小、跨天或文件格式变化时切换新文件 */
+    if ( file_broken_ || (file_length_ >> 20) >= static_cast<qint64>(MaxLogSize()) || CycleClock_Now() >= rollover_time_ ||
+         (file_ && (binary != file_binary_ || block_framing != (file_block_size_ > 0) ||
+                    (!binary && output_format != file_format_))) ) {
+        if (file_){
+            /** 当前块封装后再关闭 */
+            if(!block_.isEmpty())
+                sealBlockUnlocked();
+            if(durability() == qtlog::DurabilityDataSync){
+                /** 之前的写入可能还未被组提交覆盖，关闭前提交缓存并复制句柄，fdatasync不在文件锁内执行 */
+                file_->flush();
+                LogSyncHandle handle;
+                if(handle.duplicate(file_->handle()))
+                    rotated_handles_.append(handle);
+            }
+            file_->close();
+            delete file_;
+            file_ = nullptr;
+            if(index_){
+                index_->close();
+                delete index_;
+                index_ = nullptr;
+            }
+            rotations_.fetch_add(1, std::memory_order_relaxed);
+            LogCompressor::submit(file_path_);
+            LogRetention::requestScan();
+        }
+        file_length_ = bytes_since_flush_ = 0;
+    }
+
+    if(!file_){
+        if(!base_filename_selected_){
+            /** We don't log if the base_name_ is "" */
+            return false;
+        }
+
+        /** 优先使用后台预先打开的文件，切换只是替换指针 */
+        QString directory = logDirectory();
+        LogSpareFile spare;
+        if(!takeSpare(binary, directory, spare) &&
+                !openLogfile(directory, LogClock::nowMSecs(), binary, spare)){
+            //创建失败
+            printf("log file create failed!\r\n");
+            printf("%s\r\n",category_.toStdString().c_str());
+            return false;
+        }
+        install(spare);
+    }
+    return true;
+}
+
+void LogFileObject::install(LogSpareFile &spare)
+{
+    file_ = spare.file;
+    file_broken_ = false;
+    file_path_ = spare.path;
+    file_binary_ = spare.binary;
+    file_format_ = spare.format;
+    file_length_ = spare.length;
+    bytes_since_flush_ = spare.length;
+    bytes_written_.fetch_add(static_cast<quint64>(spare.length), std::memory_order_relaxed);
+    rollover_time_ = LogClock::nextMidnight();
+    if(file_binary_){
+        last_timestamp_ = spare.created;
+        sites_written_.clear();
+        threads_.clear();
+    }
+    index_ = spare.index;
+    index_bucket_ = -1;
+    index_offset_ = 0;
+    file_block_size_ = spare.block_size;
+    file_block_compress_ = spare.block_compress;
+    block_.resize(0);
+    spare.file = nullptr;
+    spare.index = nullptr;
+}
+
+void LogFileObject::markUnlocked(qint64 timestamp)
+{
+    /** 分块格式下每块从时间基准和调用点定义重新开始，可以独立解码，不再写时间索引 */
+    if(file_block_size_ > 0){
+        if(block_.isEmpty()){
+            block_header_ = qtlogformat::BlockHeader();
+            block_header_.firstTimestamp = timestamp;
+            block_header_.lastTimestamp = timestamp;
+            block_header_.base = file_binary_ ? last_timestamp_ : timestamp;
+            if(file_binary_){
+                sites_written_.clear();
+                threads_.clear();
+            }
+        }
+        return;
+    }
+
+    if(!index_)
+        return;
+
+    /** 进入新的一秒或距上一索引项超过64K字节时追加索引项 */
+    qint64 bucket = timestamp / QTLOGI_BUCKET_MSECS;
+    if(bucket == index_bucket_ && file_length_ - index_offset_ < QTLOGI_BUCKET_BYTES)
+        return;
+    index_bucket_ = bucket;
+    index_offset_ = file_length_;
+
+    qtlogformat::IndexEntry entry = {timestamp, file_length_, file_binary_ ? last_timestamp_ : timestamp};
+    index_entry_.resize(0);
+    qtlogformat::appendIndexEntry(index_entry_, entry);
+    index_->write(index_entry_);
+
+    /** 索引点之后重新写入调用点和线程定义，从索引点开始可以独立解码 */
+    if(file_binary_){
+        sites_written_.clear();
+        threads_.clear();
+    }
+}
+
+bool LogFileObject::takeSpare(bool binary, const QString &directory, LogSpareFile &spare)
+{
+    QMutexLocker locker(&spare_mutex_);
+    if(!spare_.file)
+        return false;
+
+    spare = spare_;
+    spare_ = LogSpareFile();
+    spare_requested_.store(false, std::memory_order_relaxed);
+
+    /** 格式、目录或日期不一致(如跨天前预先创建的文件在当天按大小切换)时不能使用 */
+    QDate today = QDateTime::fromMSecsSinceEpoch(LogClock::nowMSecs()).date();
+    if(spare.binary == binary && (binary || spare.format == output_format) &&
+            (spare.block_size > 0) == block_framing && spare.directory == directory &&
+            QDateTime::fromMSecsSinceEpoch(spare.created).date() == today)
+        return true;
+
+    RemoveSpare(spare);
+    return false;
+}
+
+void LogFileObject::storeSpare(LogSpareFile &spare)
+{
+    QMutexLocker locker(&spare_mutex_);
+    if(spare_.file){
+        RemoveSpare(spare);
+        return;
+    }
+    spare_ = spare;
+    spare.file = nullptr;
+    spare.index = nullptr;
+}
+
+void LogFileObject::discardSpare()
+{
+    QMutexLocker locker(&spare_mutex_);
+    if(!spare_.file)
+        return;
+    RemoveSpare(spare_);
+}
+
+void LogFileObject::spareFailed()
+{
+    spare_requested_.store(false, std::memory_order_relaxed);
+}
+
+void LogFileObject::requestSpare()
+{
+    /** 接近大小上限时按当前时间命名；接近零点时按零点命名，供跨天切换使用 */
+    qint64 now = CycleClock_Now();
+    bool near_midnight = now >= rollover_time_ - kSpareLeadSecs;
+    bool near_size = file_length_ >= (static_cast<qint64>(MaxLogSize()) << 20) / 4 * 3;
+    if(!near_midnight && !near_size)
+        return;
+    if(spare_requested_.exchange(true, std::memory_order_relaxed))
+        return;
+    LogRotator::submit(this, logDirectory(), near_midnight ? rollover_time_ * 1000 : 0, file_binary_);
+}
+
+QByteArray LogFileObject::fileHeader(bool binary, int format, qint64 created)
+{
+    static std::string hostname_;
+    static QMutex hostname_mutex;
+    {
+        QMutexLocker locker(&hostname_mutex);
+        if (hostname_.empty()) {
+            GetHostName(&hostname_);
+            if (hostname_.empty()) {
+                hostname_ = "(unknown)";
+            }
+        }
+    }
+
+    QByteArray file_header_string;
+    if(binary){
+        /** 二进制文件头，解码工具据此还原文本格式的文件头和日志行 */
+        quint32 flags = 0;
+        if(fileLine)
+            flags |= QTLOGB_FLAG_FILELINE;
+        if(!LogDestination::getCategoryMode())
+            flags |= QTLOGB_FLAG_CATEGORY;
+
+        file_header_string.append(QTLOGB_MAGIC, QTLOGB_MAGIC_SIZE);
+        qtlogformat::appendFixed(file_header_string, static_cast<quint64>(created), 8);
+        qtlogformat::appendFixed(file_header_string, static_cast<quint64>(QCoreApplication::applicationPid()), 8);
+        qtlogformat::appendFixed(file_header_string, flags, 4);
+        qtlogformat::appendString(file_header_string, hostname_.c_str(), static_cast<int>(hostname_.size()));
+    }
+    else if(format != qtlog::OutputText){
+        /** JSON和logfmt每行都是完整记录，不写文本文件头，便于日志管线直接逐行解析 */
+    }
+    else{
+        QTextStream file_header_stream(&file_header_string,QIODevice::Text | QIODevice::WriteOnly);
+
+        // Write a header message into the log file
+        file_header_stream << "Log file created at: "
+                           << QDateTime::fromMSecsSinceEpoch(created).toString("yyyy/MM/dd hh:mm:ss")<< endl
+                           << "Running on machine: "
+                           << hostname_.c_str() << endl
+                           << "Log line format: [DIWEF]pid hh:mm:ss.zzz ";
+        if(fileLine){
+            file_header_stream<<"threadid](file:line _function) msg" << endl;
+        }
+        else{
+            file_header_stream<<"threadid] msg" << endl;
+        }
+
+        file_header_stream.flush();
+    }
+    return file_header_string;
+}
+
+void LogFileObject::writeUnlocked(int durability, LogSeverity severity, qint64 timestamp, const char *data, int len){
+    /** 磁盘是否满，LogRetention线程检查可用空间后设置，空间恢复后继续写入 */
+    if(stop_writing.load(std::memory_order_relaxed))
+        return;
+
+    if(file_block_size_ > 0){
+        /** 分块格式先写入当前块，达到块大小时封装写入文件 */
+        block_.append(data, len);
+        block_header_.records++;
+        block_header_.firstTimestamp = qMin(block_header_.firstTimestamp, timestamp);
+        block_header_.lastTimestamp = qMax(block_header_.lastTimestamp, timestamp);
+        block_header_.severities |= static_cast<quint8>(1 << severity);
+        if(block_.size() >= file_block_size_)
+            sealBlockUnlocked();
+    }
+    else{
+        quint64 begin = MonotonicNanos();
+        bool ok = file_->write(data,len);
+        write_latency_.record(MonotonicNanos() - begin);
+        if(!ok){
+            /** 写入失败的记录不计入长度和序号，索引偏移与文件保持一致，组提交不会把它当作已落盘 */
+            writeFailedUnlocked(1);
+            return;
+        }
+        bytes_written_.fetch_add(static_cast<quint64>(len), std::memory_order_relaxed);
+        file_length_ += len;
+        bytes_since_flush_ += len;
+    }
+    written_seq_++;
+    if(!spare_requested_.load(std::memory_order_relaxed))
+        requestSpare();
+
+    /** DurabilityDataSync级别由组提交统一flush和同步 */
+    if(durability == qtlog::DurabilityFlush||(bytes_since_flush_ >= 1000000) ||
+            ( CycleClock_Now() >= next_flush_time_ ) ){
+        flushUnlocked();
+    }
+    else if(!dirty_.load(std::memory_order_relaxed)){
+        dirty_.store(true, std::memory_order_relaxed);
+    }
+}
+
+void LogFileObject::sealBlockUnlocked()
+{
+    quint64 begin = MonotonicNanos();
+    qint64 written = WriteBlock(file_, block_.constData(), block_.size(), block_header_,
+                                file_block_compress_, block_head_, block_compressed_);
+    write_latency_.record(MonotonicNanos() - begin);
+    /** 块内记录的序号已分配，可能有线程在等待组提交，失败时不回退序号，只计数并切换文件 */
+    quint64 records = block_header_.records;
+    block_.resize(0);
+    if(written < 0){
+        writeFailedUnlocked(records);
+        return;
+    }
+    bytes_written_.fetch_add(static_cast<quint64>(written), std::memory_order_relaxed);
+    file_length_ += written;
+    bytes_since_flush_ += written;
+}
+
+void LogFileObject::writeFailedUnlocked(quint64 records)
+{
+    write_failures_.fetch_add(records, std::memory_order_relaxed);
+    if(!file_broken_){
+        file_broken_ = true;
+        fprintf(stderr, "qtlog: write to %s failed, switching to a new log file\n", qPrintable(file_path_));
+    }
+}
+
+bool LogFileObject::flushBefore(quint64 deadline, bool sync)
+{
+    LogSyncHandle handle;
+    QVector<LogSyncHandle> rotated;
+    if(!mutex_.tryLock(RemainingMSecs(deadline)))
+        return false;
+    flushUnlocked();
+    if(sync && MonotonicNanos() < deadline){
+        rotated.swap(rotated_handles_);
+        if(file_)
+            handle.duplicate(file_->handle());
+    }
+    mutex_.unlock();
+    for(LogSyncHandle &old : rotated)
+        old.sync();
+    handle.sync();
+    return true;
+}
+
+#if defined(Q_OS_LINUX)
+void LogFileObject::crashFlush()
+{
+    /** 崩溃线程可能正持有文件锁，这里不加锁，最多与其他线程正在进行的写入交错 */
+    LogFileBackend* file = file_;
+    if(file == nullptr)
+        return;
+    if(file_block_size_ > 0 && !block_.isEmpty()){
+        /** 未满的块不压缩，块头在栈上生成 */
+        qtlogformat::BlockHeader header = block_header_;
+        header.storedLength = static_cast<quint32>(block_.size());
+        header.rawLength = header.storedLength;
+        header.flags = 0;
+        header.crc = 0;
+        char head[QTLOGF_BLOCK_HEADER_SIZE];
+        qtlogformat::writeBlockHeader(head, header);
+        quint32 crc = qtlogcrc32c::compute(0, head, QTLOGF_BLOCK_HEADER_SIZE - 4);
+        header.crc = qtlogcrc32c::compute(crc, block_.constData(), static_cast<size_t>(block_.size()));
+        qtlogformat::writeBlockHeader(head, header);
+        file->crashWrite(head, QTLOGF_BLOCK_HEADER_SIZE);
+        file->crashWrite(block_.constData(), block_.size());
+    }
+    file->crashFlush();
+}
+#endif
+
+void LogFileObject::flushUnlocked()
+{
+    if(file_ != nullptr){
+        /** 未满的块在flush时封装，已提交的日志不会停留在块缓冲中 */
+        if(!block_.isEmpty())
+            sealBlockUnlocked();
+        quint64 begin = MonotonicNanos();
+        file_->flush();
+        flush_latency_.record(MonotonicNanos() - begin);
+        /** 先提交日志再提交索引，索引项不会指向未提交的数据 */
+        if(index_)
+            index_->flush();
+        bytes_since_flush_ = 0;
+        dirty_.store(false, std::memory_order_relaxed);
+    }
+
+    next_flush_time_ = CycleClock_Now() + logbufsecs;
+}
+
+void LogFileObject::flushIfDirty()
+{
+    if(dirty_.load(std::memory_order_relaxed))
+        flush();
+}
+
+void LogFileObject::collectStats(quint64 &bytes_written, quint64 &rotations, qtlog::Stats &stats) const
+{
+    bytes_written = bytes_written_.load(std::memory_order_relaxed);
+    rotations = rotations_.load(std::memory_order_relaxed);
+    stats.bytesWritten += bytes_written;
+    stats.rotations += rotations;
+    stats.writeFailures += write_failures_.load(std::memory_order_relaxed);
+    write_latency_.addTo(stats.writeLatency);
+    flush_latency_.addTo(stats.flushLatency);
+}
+
+void LogFileObject::flush()
+{
+    QMutexLocker locker(&mutex_);
+    flushUnlocked();
+
+    /** 持久化级别为DurabilityDataSync时等待已写入的记录全部落盘 */
+    if(durability() == qtlog::DurabilityDataSync && written_seq_ > 0){
+        quint64 seq = written_seq_;
+        locker.unlock();
+        commit(seq, true);
+    }
+}
+
+QString LogFileObject::logDirectory() const{
+    QString base_filename = base_filename_;
+    /** 分类模式，根据category增加目录 */
+    if(LogDestination::getCategoryMode()){
+        QList<QByteArray> categoryList = category_.split('.');
+        for(auto value : categoryList){
+            base_filename.append(value).append("/");
+        }
+    }
+    /** 普通模式下增加日志分级目录 */
+    else{
+        base_filename.append(LogSeverityNames[severity_]).append("/");
+    }
+    return base_filename;
+}
+
+bool LogFileObject::retentionInfo(QString &base, QString &directory, QStringList &active)
+{
+    QMutexLocker locker(&mutex_);
+    if(!base_filename_selected_ || base_filename_.isEmpty())
+        return false;
+
+    base = base_filename_;
+    directory = QFileInfo(logDirectory()).absoluteFilePath();
+    if(file_)
+        active << QFileInfo(file_path_).absoluteFilePath();
+
+    /** 与takeSpare相同的加锁顺序，预备文件不会在两次读取之间被切换为当前文件而遗漏 */
+    QMutexLocker spare_locker(&spare_mutex_);
+    if(spare_.file)
+        active << QFileInfo(spare_.path).absoluteFilePath();
+    return true;
+}
+
+bool LogFileObject::openLogfile(const QString &directory, qint64 created, bool binary, LogSpareFile &spare){
+    QDir basedir(directory);
+    if(!basedir.exists()){
+        basedir.mkpath(directory);
+
+    }
+    QString base_datefilename;
+
+    base_datefilename = directory;
+
+    // 程序PID
+#if defined (Q_OS_WIN)
+    QString pid = QString("%1.").arg(_getpid(),8,16,QLatin1Char('0')).toUpper();
+#elif defined (Q_OS_LINUX)
+    QString pid = QString("%1.").arg(getpid(),8,16,QLatin1Char('0')).toUpper();
+#endif
+    // 格式说明
+    base_datefilename
+            .append(QDateTime::fromMSecsSinceEpoch(created).toString("yyyyMMdd-hhmmss"))
+            .append(".")
+            .append(pid);
+    const QString stem = base_datefilename.left(base_datefilename.size() - 1);
+    const QString suffix = block_framing ? QTLOGF_SUFFIX : (binary ? QTLOGB_SUFFIX : "log");
+    base_datefilename.append(suffix);
+
+    /** 同一秒内切换的文件(如按大小切换时预先打开的下一文件)加序号区分，序号排在原文件名之后，按名称排序仍从旧到新 */
+    LogFileBackend* file = LogFileBackend::create();
+    int sequence = 0;
+    while(!file->open(base_datefilename)){
+        if(!QFile::exists(base_datefilename) || ++sequence > 999){
+            delete file;
+            return false;
+        }
+        base_datefilename = QString("%1_%2.%3").arg(stem).arg(sequence, 3, 10, QLatin1Char('0')).arg(suffix);
+    }
+
+    int format = binary ? static_cast<int>(qtlog::OutputText) : output_format;
+    QByteArray header = fileHeader(binary, format, created);
+    qint64 length = header.size();
+    if(block_framing){
+        /** 分块格式的文件头之后，第一块为文本或二进制日志的文件头 */
+        spare.block_size = qMax(block_size, 1024);
+        spare.block_compress = block_compress;
+        QByteArray framing(QTLOGF_MAGIC, QTLOGF_MAGIC_SIZE);
+        qtlogformat::appendFixed(framing, static_cast<quint32>(spare.block_size), 4);
+        qtlogformat::appendFixed(framing, binary ? QTLOGF_FORMAT_BINARY : QTLOGF_FORMAT_TEXT, 1);
+        qtlogformat::appendFixed(framing, block_compress ? QTLOGF_COMPRESSION_ZLIB : QTLOGF_COMPRESSION_NONE, 1);
+        qtlogformat::appendFixed(framing, 0, 2);
+        file->write(framing.constData(), framing.size());
+
+        qtlogformat::BlockHeader block = qtlogformat::BlockHeader();
+        block.firstTimestamp = block.lastTimestamp = block.base = created;
+        QByteArray head, compressed;
+        length = framing.size() + WriteBlock(file, header.constData(), header.size(), block, block_compress, head, compressed);
+    }
+    else{
+        file->write(header.constData(), header.size());
+    }
+
+    /** 时间索引创建失败时日志文件照常写入，分块格式由块头记录时间 */
+    if(time_index && !block_framing){
+        QFile* index = new QFile(base_datefilename + QTLOGI_SUFFIX);
+        if(index->open(QIODevice::WriteOnly | QIODevice::Truncate) &&
+                index->write(QTLOGI_MAGIC, QTLOGI_MAGIC_SIZE) == QTLOGI_MAGIC_SIZE){
+            spare.index = index;
+        }
+        else{
+            delete index;
+        }
+    }
+
+    spare.file = file;
+    spare.path = base_datefilename;
+    spare.directory = directory;
+    spare.binary = binary;
+    spare.format = format;
+    spare.created = created;
+    spare.length = length;
+    return true;
+}
+
+LogRotator::LogRotator(LogFileObject *object, const QString &directory, qint64 created, bool binary):
+    object_(object),directory_(directory),created_(created),binary_(binary)
+{
+}
+
+void LogRotator::submit(LogFileObject *object, const QString &directory, qint64 created, bool binary)
+{
+    QMutexLocker locker(&mutex_);
+    if(stopping_){
+        object->spareFailed();
+        return;
+    }
+    if(!pool_){
+        pool_ = new QThreadPool;
+        pool_->setMaxThreadCount(1);
+        qAddPostRoutine(LogRotator::shutdown);
+    }
+    pool_->start(new LogRotator(object, directory, created, binary));
+}
+
+void LogRotator::run()
+{
+    LogSpareFile spare;
+    if(!stopping_ && LogFileObject::openLogfile(directory_, created_ > 0 ? created_ : LogClock::nowMSecs(), binary_, spare))
+        object_->storeSpare(spare);
+    else
+        object_->spareFailed();
+}
+
+void LogRotator::shutdown()
+{
+    {
+        QMutexLocker locker(&mutex_);
+        stopping_ = true;
+    }
+    if(pool_){
+        pool_->clear();
+        pool_->waitForDone();
+    }
+    /** 程序退出时删除未使用的预备文件 */
+    LogDestination::discardSpares();
+}
+
+LogDestination::LogDestination(LogSeverity severity,QString &base_filename):fileobject_(severity,base_filename){
+
+}
+
+LogDestination::LogDestination(QByteArray category,QString &base_filename):fileobject_(category,base_filename)
+{
+
+}
+
+LogDestination::~LogDestination(){
+
+}
+
+/** 普通模式目标地址存放，分类模式的目标地址存放在LogCategory中 */
+std::atomic<LogDestination*> LogDestination::log_destinations_[NUM_SEVERITIES];
+
+QMutex LogDestination::create_mutex_;
+
+/** 默认为普通模式 */
+bool LogDestination::CategoryMode_ = false;
+
+QString LogDestination::category_base_filename_;
+
+inline LogDestination* LogDestination::log_destinations(LogSeverity severity){
+    LogDestination* destination = log_destinations_[severity].load(std::memory_order_acquire);
+    if(!destination){
+        QMutexLocker locker(&create_mutex_);
+        destination = log_destinations_[severity].load(std::memory_order_relaxed);
+        if(!destination){
+            QString null;
+            destination = new LogDestination(severity,null);
+            log_destinations_[severity].store(destination, std::memory_order_release);
+        }
+    }
+    return destination;
+}
+
+inline LogDestination *LogDestination::log_destinations(LogCategory *category)
+{
+    LogDestination* destination = category->destination.load(std::memory_order_acquire);
+    if(!destination){
+        QMutexLocker locker(&create_mutex_);
+        destination = category->destination.load(std::memory_order_relaxed);
+        if(!destination){
+            destination = new LogDestination(category->name,category_base_filename_);
+            destination->fileobject_.setBinary(category->binary.load(std::memory_order_relaxed));
+            destination->fileobject_.setDurability(category->durability.load(std::memory_order_relaxed),
+                                                  category->durability_wait.load(std::memory_order_relaxed));
+            category->destination.store(destination, std::memory_order_release);
+        }
+    }
+    return destination;
+}
+
+void LogDestination::setBinary(LogSeverity severity, bool binary)
+{
+    if(severity < 0 || severity >= NUM_SEVERITIES)
+        return;
+    log_destinations(severity)->fileobject_.setBinary(binary);
+}
+
+void LogDestination::setBinary(const QByteArray &category, bool binary)
+{
+    LogCategory* entry = LogCategoryIndex::lookup(category.isEmpty() ? "default" : category.constData());
+    QMutexLocker locker(&create_mutex_);
+    entry->binary.store(binary, std::memory_order_relaxed);
+    LogDestination* destination = entry->destination.load(std::memory_order_relaxed);
+    if(destination)
+        destination->fileobject_.setBinary(binary);
+}
+
+void LogDestination::setDurability(LogSeverity severity, int durability, bool wait)
+{
+    if(severity < 0 || severity >= NUM_SEVERITIES)
+        return;
+    log_destinations(severity)->fileobject_.setDurability(durability, wait);
+}
+
+void LogDestination::setDurability(const QByteArray &category, int durability, bool wait)
+{
+    LogCategory* entry = LogCategoryIndex::lookup(category.isEmpty() ? "default" : category.constData());
+    QMutexLocker locker(&create_mutex_);
+    entry->durability.store(durability, std::memory_order_relaxed);
+    entry->durability_wait.store(wait, std::memory_order_relaxed);
+    LogDestination* destination = entry->destination.load(std::memory_order_relaxed);
+    if(destination)
+        destination->fileobject_.setDurability(durability, wait);
+}
+
+void LogDestination::setCategoryMode(bool mode)
+{
+    CategoryMode_ = mode;
+}
+
+void LogDestination::setLogDestination(LogSeverity severity, QString &pathdir){
+    log_destinations(severity)->fileobject_.setBasename(pathdir);
+}
+
+void LogDestination::setLogDestination(QString &pathdir)
+{
+    category_base_filename_ = pathdir;
+}
+
+
+void LogDestination::LogToAllLogfiles(LogSeverity severity, QByteArray &msg, LogCategory *category){
+    //    for(int i = severity; i >= 0; --i)
+    //        LogDestination::maybeLogToLogfile(i, msg, category);
+    destination(severity, category)->write(severity, msg);
+}
+
+bool LogDestination::getCategoryMode()
+{
+    return CategoryMode_;
+}
+
+void LogDestination::flushAllLogs()
+{
+    if(LogDestination::CategoryMode_){
+        /** 分类模式下遍历分类索引,刷新缓存 */
+        for(LogCategory* category : LogCategoryIndex::categories()){
+            LogDestination* destination = category->destination.load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.flush();
+        }
+    }
+    else{
+        /** 普通模式遍历日志等级,刷新缓存 */
+        for(int i=0;i<NUM_SEVERITIES;i++){
+            LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+            if(destination){
+                destination->fileobject_.flush();
+            }
+        }
+    }
+}
+
+int LogDestination::flushAllBefore(quint64 deadline, bool sync)
+{
+    int failed = 0;
+    if(LogDestination::CategoryMode_){
+        for(LogCategory* category : LogCategoryIndex::categories()){
+            LogDestination* destination = category->destination.load(std::memory_order_acquire);
+            if(destination && !destination->fileobject_.flushBefore(deadline, sync))
+                failed++;
+        }
+    }
+    else{
+        for(int i=0;i<NUM_SEVERITIES;i++){
+            LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+            if(destination && !destination->fileobject_.flushBefore(deadline, sync))
+                failed++;
+        }
+    }
+    return failed;
+}
+
+#if defined(Q_OS_LINUX)
+void LogDestination::crashFlushAll()
+{
+    if(LogDestination::CategoryMode_){
+        LogCategoryIndex::visit([](LogCategory *category){
+            LogDestination* destination = category->destination.load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.crashFlush();
+        });
+    }
+    else{
+        for(int i=0;i<NUM_SEVERITIES;i++){
+            LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.crashFlush();
+        }
+    }
+}
+#endif
+
+void LogDestination::flushDirtyLogs()
+{
+    if(LogDestination::CategoryMode_){
+        for(LogCategory* category : LogCategoryIndex::categories()){
+            LogDestination* destination = category->destination.load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.flushIfDirty();
+        }
+    }
+    else{
+        for(int i=0;i<NUM_SEVERITIES;i++){
+            LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.flushIfDirty();
+        }
+    }
+}
+
+void LogDestination::syncPendingLogs()
+{
+    if(LogDestination::CategoryMode_){
+        for(LogCategory* category : LogCategoryIndex::categories()){
+            LogDestination* destination = category->destination.load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.syncPending();
+        }
+    }
+    else{
+        for(int i=0;i<NUM_SEVERITIES;i++){
+            LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+            if(destination)
+                destination->fileobject_.syncPending();
+        }
+    }
+}
+
+void LogDestination::retentionTargets(QStringList &bases, QStringList &directories, QStringList &active)
+{
+    QVector<LogDestination*> destinations;
+    for(LogCategory* category : LogCategoryIndex::categories()){
+        LogDestination* destination = category->destination.load(std::memory_order_acquire);
+        if(destination)
+            destinations.append(destination);
+    }
+    for(int i=0;i<NUM_SEVERITIES;i++){
+        LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+        if(destination)
+            destinations.append(destination);
+    }
+
+    for(LogDestination* destination : destinations){
+        QString base, directory;
+        if(!destination->fileobject_.retentionInfo(base, directory, active))
+            continue;
+        if(!bases.contains(base))
+            bases.append(base);
+        if(!directories.contains(directory))
+            directories.append(directory);
+    }
+}
+
+void LogDestination::discardSpares()
+{
+    for(LogCategory* category : LogCategoryIndex::categories()){
+        LogDestination* destination = category->destination.load(std::memory_order_acquire);
+        if(destination)
+            destination->fileobject_.discardSpare();
+    }
+    for(int i=0;i<NUM_SEVERITIES;i++){
+        LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+        if(destination)
+            destination->fileobject_.discardSpare();
+    }
+}
+
+void LogDestination::collectStats(qtlog::Stats &stats)
+{
+    for(LogCategory* category : LogCategoryIndex::categories()){
+        qtlog::CategoryStats entry;
+        entry.name = category->name;
+        for(int shard = 0; shard < kCounterShards; shard++){
+            for(int i = 0; i < NUM_SEVERITIES; i++)
+                entry.messages[i] += category->counters[shard].messages[i].load(std::memory_order_relaxed);
+            entry.bytes += category->counters[shard].bytes.load(std::memory_order_relaxed);
+        }
+        entry.dropped = category->dropped_total.load(std::memory_order_relaxed);
+
+        LogDestination* destination = category->destination.load(std::memory_order_acquire);
+        if(destination)
+            destination->fileobject_.collectStats(entry.bytesWritten, entry.rotations, stats);
+
+        for(int i = 0; i < NUM_SEVERITIES; i++)
+            stats.messages[i] += entry.messages[i];
+        stats.bytes += entry.bytes;
+        stats.dropped += entry.dropped;
+        stats.categories.append(entry);
+    }
+
+    for(int i = 0; i < NUM_SEVERITIES; i++){
+        LogDestination* destination = log_destinations_[i].load(std::memory_order_acquire);
+        if(destination){
+            quint64 bytes_written, rotations;
+            destination->fileobject_.collectStats(bytes_written, rotations, stats);
+        }
+    }
+}
+
+inline LogDestination* LogDestination::destination(LogSeverity severity, LogCategory *category){
+    if(LogDestination::CategoryMode_)
+        return log_destinations(category);
+    return log_destinations(severity);
+}
+
+inline void LogDestination::write(LogSeverity severity, QByteArray &msg){
+    fileobject_.write(fileobject_.durability(),severity,msg);
+}
+
+inline void LogDestination::writeBinary(const LogCallSite *site, qint64 timestamp, quintptr thread, const QByteArray &payload){
+    fileobject_.writeBinary(fileobject_.durability(), site, timestamp, thread, payload);
+}
+
+inline bool LogDestination::isBinary() const{
+    return fileobject_.isBinary();
+}
+
+/**
+ * @brief The LogRecord struct
+ * @details 异步模式下在队列中传递的一条日志记录，done非空时为flush请求，写线程刷新全部日志后释放该信号量
+ */
+struct LogRecord{
+    LogSeverity severity = 0;
+    LogCategory* category = nullptr;
+    QByteArray msg;
+    QSemaphore* done = nullptr;
+    /** 二进制格式消息的调用点、时间和线程，site非空时msg为UTF-16消息内容 */
+    LogCallSite* site = nullptr;
+    qint64 timestamp = 0;
+    quintptr thread = 0;
+};
+
+/**
+ * @brief The LogRingQueue class
+ * @details 有界无锁队列(Dmitry Vyukov bounded MPMC queue)，多生产者写入，后台写线程取出。
+ * 容量向上取整为2的幂，每个单元通过序号判断是否可写/可读，入队出队均不加锁
+ */
+template <typename T>
+class LogRingQueue{
+public:
+    explicit LogRingQueue(quint32 capacity){
+        quint32 size = 2;
+        while(size < capacity && size < (1u << 30))
+            size <<= 1;
+        mask_ = size - 1;
+        cells_ = new Cell[size];
+        for(quint32 i = 0; i < size; i++)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    ~LogRingQueue(){
+        delete[] cells_;
+    }
+
+    /** 入队成功时value内容被交换进队列，队列满返回false。tag随内容一起发布，供tryPopIf判断 */
+    bool tryPush(T &value, int tag = 0){
+        Cell* cell;
+        quint32 pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for(;;){
+            cell = &cells_[pos & mask_];
+            quint32 seq = cell->sequence.load(std::memory_order_acquire);
+            qint32 dif = static_cast<qint32>(seq - pos);
+            if(dif == 0){
+                if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0){
+                return false;
+            }
+            else{
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        qSwap(cell->data, value);
+        cell->tag.store(tag, std::memory_order_relaxed);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * 队首内容的tag等于tag时出队，队列空或tag不同时返回false。
+     * tag为原子变量，在取得出队位置前读取不会与其他出队者的交换冲突，取得位置失败时重新判断新的队首
+     */
+    bool tryPopIf(T &value, int tag){
+        Cell* cell;
+        quint32 pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for(;;){
+            cell = &cells_[pos & mask_];
+            quint32 seq = cell->sequence.load(std::memory_order_acquire);
+            qint32 dif = static_cast<qint32>(seq - (pos + 1));
+            if(dif == 0){
+                if(cell->tag.load(std::memory_order_relaxed) != tag)
+                    return false;
+                if(dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0){
+                return false;
+            }
+            else{
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        qSwap(cell->data, value);
+        cell->data = T();
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** 出队成功时取出的内容交换到value，队列空返回false */
+    bool tryPop(T &value){
+        Cell* cell;
+        quint32 pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for(;;){
+            cell = &cells_[pos & mask_];
+            quint32 seq = cell->sequence.load(std::memory_order_acquire);
+            qint32 dif = static_cast<qint32>(seq - (pos + 1));
+            if(dif == 0){
+                if(dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0){
+                return false;
+            }
+            else{
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        qSwap(cell->data, value);
+        cell->data = T();
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** 近似的当前队列长度 */
+    quint32 size() const{
+        quint32 tail = enqueue_pos_.load(std::memory_order_seq_cst);
+        quint32 head = dequeue_pos_.load(std::memory_order_seq_cst);
+        return tail - head;
+    }
+
+    quint32 capacity() const{
+        return mask_ + 1;
+    }
+
+private:
+    struct Cell{
+        std::atomic<quint32> sequence;
+        std::atomic<int> tag;
+        T data;
+    };
+
+    Cell* cells_;
+    quint32 mask_;
+    /** 生产者与消费者位置分开缓存行，避免伪共享 */
+    char pad0_[64];
+    std::atomic<quint32> enqueue_pos_;
+    char pad1_[64];
+    std::atomic<quint32> dequeue_pos_;
+    char pad2_[64];
+
+    Q_DISABLE_COPY(LogRingQueue)
+};
+
+/**
+ * @brief The LogAsyncWriter class
+ * @details 异步模式后台写线程，生产者线程只做格式化和入队，写线程取出记录后调用LogDestination写入文件。
+ * 队列满时按日志等级对应的溢出策略处理：阻塞等待、丢弃新消息或丢弃队列中最旧的消息。
+ * 丢弃的消息按分类计数，写线程定期向对应日志文件写入"N messages dropped"提示
+ */
+class LogAsyncWriter : public QThread{
+public:
+    static bool enable(quint32 capacity);
+    static void disable();
+    static bool enqueue(LogSeverity severity, const QByteArray &msg, LogCategory *category);
+    static bool enqueue(LogSeverity severity, LogCallSite *site, qint64 timestamp, quintptr thread,
+                        const QByteArray &payload, LogCategory *category);
+    static bool flush();
+
+    /** fatal日志使用，等待写线程排空队列，最多等待到deadline，超时返回false，未开启异步模式时返回true */
+    static bool flushBefore(quint64 deadline);
+    static void setOverflowPolicy(LogSeverity severity, int policy);
+    static void queueStats(quint32 &depth, quint32 &capacity);
+
+protected:
+    void run();
+
+private:
+    explicit LogAsyncWriter(quint32 capacity);
+    ~LogAsyncWriter();
+
+    void wakeUp();
+    static bool submit(LogRecord &record);
+    void push(LogRecord &record);
+    void pushDropOldest(LogRecord &record);
+    void notify();
+    void drain();
+    void notifySpace();
+    void countDropped(LogRecord &record);
+    void reportDropped();
+    static void shutdown();
+
+    LogRingQueue<LogRecord> queue_;
+    QSemaphore wake_;
+    std::atomic<bool> sleeping_;
+    std::atomic<bool> stopping_;
+
+    /** 队列满时阻塞的生产者在space_上等待，写线程取出记录后按等待数量释放 */
+    QSemaphore space_;
+    std::atomic<int> space_waiters_;
+
+    /** 有丢弃记录，丢弃数量记录在LogCategory中 */
+    std::atomic<bool> has_dropped_;
+    qint64 next_report_time_;
+
+    /** 各日志等级的队列溢出策略 */
+    static std::atomic<int> policies_[NUM_SEVERITIES];
+
+    /** 当前写线程实例，未开启异步模式时为空 */
+    static std::atomic<LogAsyncWriter*> instance_;
+    /** 正在入队的生产者数量，停止时等待其归零，保证停止后队列中不再有新记录 */
+    static std::atomic<int> producers_;
+    static QMutex control_mutex_;
+    static bool post_routine_added_;
+};
+
+std::atomic<LogAsyncWriter*> LogAsyncWriter::instance_(nullptr);
+std::atomic<int> LogAsyncWriter::producers_(0);
+QMutex LogAsyncWriter::control_mutex_;
+bool LogAsyncWriter::post_routine_added_ = false;
+std::atomic<int> LogAsyncWriter::policies_[NUM_SEVERITIES] = {
+    {qtlog::OverflowBlock}, {qtlog::OverflowBlock}, {qtlog::OverflowBlock},
+    {qtlog::OverflowBlock}, {qtlog::OverflowBlock}
+};
+
+/** 丢弃提示写入间隔，单位s */
+static const qint64 kDroppedReportSecs = 1;
+/** 队列中记录的tag，队列满时只有等级策略允许丢弃的记录可以被DropOldest挤出，阻塞策略的记录和flush请求为0 */
+static const int kRecordDroppable = 1;
+/** 队列满时生产者先让出CPU重试的次数，之后挂起等待写线程腾出空间 */
+static const int kPushSpinCount = 16;
+/** 挂起等待的超时，单位ms，防止错过唤醒时长时间阻塞 */
+static const int kPushWaitMSecs = 10;
+
+LogAsyncWriter::LogAsyncWriter(quint32 capacity):queue_(capacity),sleeping_(false),stopping_(false),
+    space_waiters_(0),has_dropped_(false),next_report_time_(0)
+{
+}
+
+LogAsyncWriter::~LogAsyncWriter()
+{
+}
+
+bool LogAsyncWriter::enable(quint32 capacity)
+{
+    QMutexLocker locker(&control_mutex_);
+    if(instance_.load())
+        return true;
+
+    LogAsyncWriter* writer = new LogAsyncWriter(capacity > 0 ? capacity : 8192);
+    writer->start(QThread::NormalPriority);
+    instance_.store(writer);
+
+    if(!post_routine_added_){
+        /** 程序退出时排空队列 */
+        qAddPostRoutine(LogAsyncWriter::shutdown);
+        post_routine_added_ = true;
+    }
+    return true;
+}
+
+void LogAsyncWriter::disable()
+{
+    QMutexLocker locker(&control_mutex_);
+    LogAsyncWriter* writer = instance_.exchange(nullptr);
+    if(!writer)
+        return;
+
+    /** 等待已进入入队流程的生产者完成 */
+    while(producers_.load() != 0)
+        QThread::yieldCurrentThread();
+
+    writer->stopping_.store(true);
+    writer->wakeUp();
+    writer->wait();
+
+    /** 写线程退出后剩余记录由当前线程写完 */
+    writer->drain();
+    writer->reportDropped();
+    LogDestination::flushAllLogs();
+    delete writer;
+}
+
+void LogAsyncWriter::shutdown()
+{
+    LogAsyncWriter::disable();
+}
+
+bool LogAsyncWriter::enqueue(LogSeverity severity, const QByteArray &msg, LogCategory *category)
+{
+    if(!instance_.load(std::memory_order_relaxed))
+        return false;
+
+    LogRecord record;
+    record.severity = severity;
+    /** msg为线程局部的渲染缓冲区，入队需深拷贝 */
+    record.msg = QByteArray(msg.constData(), msg.size());
+    record.category = category;
+    return submit(record);
+}
+
+bool LogAsyncWriter::enqueue(LogSeverity severity, LogCallSite *site, qint64 timestamp, quintptr thread,
+                             const QByteArray &payload, LogCategory *category)
+{
+    if(!instance_.load(std::memory_order_relaxed))
+        return false;
+
+    LogRecord record;
+    record.severity = severity;
+    /** payload引用调用方QString的数据，入队需深拷贝 */
+    record.msg = QByteArray(payload.constData(), payload.size());
+    record.category = category;
+    record.site = site;
+    record.timestamp = timestamp;
+    record.thread = thread;
+    return submit(record);
+}
+
+bool LogAsyncWriter::submit(LogRecord &record)
+{
+    producers_.fetch_add(1);
+    LogAsyncWriter* writer = instance_.load();
+    if(!writer || QThread::currentThread() == writer){
+        /** 未开启异步模式，或写线程自身产生的日志，直接同步写入 */
+        producers_.fetch_sub(1);
+        return false;
+    }
+
+    switch(policies_[record.severity].load(std::memory_order_relaxed)){
+    case qtlog::OverflowDropNewest:
+        if(writer->queue_.tryPush(record, kRecordDroppable))
+            writer->notify();
+        else
+            writer->countDropped(record);
+        break;
+
+    case qtlog::OverflowDropOldest:
+        writer->pushDropOldest(record);
+        break;
+
+    default:
+        writer->push(record);
+        break;
+    }
+
+    producers_.fetch_sub(1);
+    return true;
+}
+
+void LogAsyncWriter::setOverflowPolicy(LogSeverity severity, int policy)
+{
+    if(severity < 0 || severity >= NUM_SEVERITIES)
+        return;
+    policies_[severity].store(policy);
+}
+
+void LogAsyncWriter::queueStats(quint32 &depth, quint32 &capacity)
+{
+    /** 计入生产者，保证读取期间写线程不被释放 */
+    producers_.fetch_add(1);
+    LogAsyncWriter* writer = instance_.load();
+    depth = writer ? writer->queue_.size() : 0;
+    capacity = writer ? writer->queue_.capacity() : 0;
+    producers_.fetch_sub(1);
+}
+
+bool LogAsyncWriter::flush()
+{
+    producers_.fetch_add(1);
+    LogAsyncWriter* writer = instance_.load();
+    if(!writer || QThread::currentThread() == writer){
+        producers_.fetch_sub(1);
+        return false;
+    }
+
+    /** 插入flush请求，写线程处理到该记录时之前的记录都已写入 */
+    QSemaphore done;
+    LogRecord record;
+    record.done = &done;
+    writer->push(record);
+    producers_.fetch_sub(1);
+
+    done.acquire();
+    return true;
+}
+
+bool LogAsyncWriter::flushBefore(quint64 deadline)
+{
+    producers_.fetch_add(1);
+    LogAsyncWriter* writer = instance_.load();
+    if(!writer || QThread::currentThread() == writer){
+        producers_.fetch_sub(1);
+        return true;
+    }
+
+    /**
+     * 超时返回后写线程仍可能释放信号量，不能使用栈上的对象；多个线程可能同时产生fatal日志，每次调用使用各自的对象。
+     * fatal日志之后进程即终止，有意不释放
+     */
+    QSemaphore* done = new QSemaphore;
+    LogRecord record;
+    record.done = done;
+    bool queued = writer->queue_.tryPush(record);
+    if(!queued){
+        /** 队列已满，与阻塞策略的生产者一样挂起等待腾出空间，直到deadline */
+        writer->space_waiters_.fetch_add(1);
+        while(!(queued = writer->queue_.tryPush(record))){
+            writer->wakeUp();
+            if(MonotonicNanos() >= deadline)
+                break;
+            writer->space_.tryAcquire(1, qMin(kPushWaitMSecs, RemainingMSecs(deadline)));
+        }
+        writer->space_waiters_.fetch_sub(1);
+    }
+    if(!queued){
+        producers_.fetch_sub(1);
+        return false;
+    }
+    writer->notify();
+    producers_.fetch_sub(1);
+
+    return done->tryAcquire(1, RemainingMSecs(deadline));
+}
+
+void LogAsyncWriter::push(LogRecord &record)
+{
+    for(int spin = 0; !queue_.tryPush(record); spin++){
+        /** 队列已满，唤醒写线程，短暂重试后挂起等待腾出空间 */
+        wakeUp();
+        if(spin < kPushSpinCount){
+            QThread::yieldCurrentThread();
+            continue;
+        }
+
+        /** 先登记再重试，写线程取出记录后检查等待数量，保证不会错过唤醒 */
+        space_waiters_.fetch_add(1);
+        if(!queue_.tryPush(record)){
+            do{
+                space_.tryAcquire(1, kPushWaitMSecs);
+                wakeUp();
+            } while(!queue_.tryPush(record));
+        }
+        space_waiters_.fetch_sub(1);
+        break;
+    }
+    notify();
+}
+
+void LogAsyncWriter::pushDropOldest(LogRecord &record)
+{
+    while(!queue_.tryPush(record, kRecordDroppable)){
+        /** 队列已满，最旧的一条本身允许丢弃时丢弃它 */
+        LogRecord oldest;
+        if(queue_.tryPopIf(oldest, kRecordDroppable)){
+            countDropped(oldest);
+            continue;
+        }
+        /** 最旧的是阻塞策略等级的记录或flush请求，不能丢弃，改为丢弃当前消息 */
+        if(!queue_.tryPush(record, kRecordDroppable))
+            countDropped(record);
+        break;
+    }
+    notify();
+}
+
+void LogAsyncWriter::notify()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping_.load(std::memory_order_relaxed))
+        wakeUp();
+}
+
+void LogAsyncWriter::countDropped(LogRecord &record)
+{
+    record.category->dropped[record.severity].fetch_add(1, std::memory_order_relaxed);
+    record.category->dropped_total.fetch_add(1, std::memory_order_relaxed);
+    has_dropped_.store(true, std::memory_order_relaxed);
+}
+
+void LogAsyncWriter::reportDropped()
+{
+    if(!has_dropped_.exchange(false))
+        return;
+
+    const int format = output_format;
+    for(LogCategory* category : LogCategoryIndex::categories()){
+        quint64 count[NUM_SEVERITIES];
+        quint64 total = 0;
+        for(int severity = 0; severity < NUM_SEVERITIES; severity++){
+            count[severity] = category->dropped[severity].exchange(0, std::memory_order_relaxed);
+            total += count[severity];
+        }
+        if(total == 0)
+            continue;
+
+        /** 按分类上下文渲染，与普通日志使用相同的格式 */
+        QMessageLogContext context(nullptr, 0, nullptr, category->name.constData());
+        if(LogDestination::getCategoryMode()){
+            /** 分类模式下同一分类写入同一文件，合并各等级数量 */
+            QString msg = QString("%1 messages dropped, async log queue full").arg(total);
+            QByteArray &line = format == qtlog::OutputText ? LogFormatter::render(QtWarningMsg, context, msg)
+                                                           : LogFormatter::renderRecord(QtWarningMsg, context, msg, format);
+            LogDestination::LogToAllLogfiles(QWARING, line, category);
+        }
+        else{
+            for(int severity = 0; severity < NUM_SEVERITIES; severity++){
+                if(count[severity] == 0)
+                    continue;
+                QString msg = QString("%1 messages dropped (category: %2), async log queue full")
+                        .arg(count[severity]).arg(QString::fromLocal8Bit(category->name));
+                const QtMsgType type = typeOf(static_cast<LogSeverity>(severity));
+                QByteArray &line = format == qtlog::OutputText ? LogFormatter::render(type, context, msg)
+                                                               : LogFormatter::renderRecord(type, context, msg, format);
+                LogDestination::LogToAllLogfiles(severity, line, category);
+            }
+        }
+    }
+}
+
+void LogAsyncWriter::wakeUp()
+{
+    if(sleeping_.exchange(false))
+        wake_.release();
+}
+
+void LogAsyncWriter::notifySpace()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int waiters = space_waiters_.load(std::memory_order_relaxed);
+    if(waiters <= 0)
+        return;
+    /** 每个等待者最多保留一个许可，避免连续取出时许可堆积 */
+    int available = space_.available();
+    if(available < waiters)
+        space_.release(waiters - available);
+}
+
+void LogAsyncWriter::drain()
+{
+    LogRecord record;
+    while(queue_.tryPop(record)){
+        notifySpace();
+        if(record.done){
+            reportDropped();
+            LogDestination::flushAllLogs();
+            record.done->release();
+            record.done = nullptr;
+        }
+        else if(record.site){
+            LogDestination::destination(record.severity, record.category)
+                    ->writeBinary(record.site, record.timestamp, record.thread, record.msg);
+        }
+        else{
+            LogDestination::LogToAllLogfiles(record.severity, record.msg, record.category);
+        }
+    }
+}
+
+void LogAsyncWriter::run()
+{
+    for(;;){
+        drain();
+        if(stopping_.load())
+            break;
+
+        if(has_dropped_.load(std::memory_order_relaxed)){
+            qint64 now = CycleClock_Now();
+            if(now >= next_report_time_){
+                reportDropped();
+                next_report_time_ = now + kDroppedReportSecs;
+            }
+        }
+
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(queue_.size() != 0){
+            sleeping_.store(false);
+            continue;
+        }
+        /** 超时保证即使错过唤醒也能及时处理队列 */
+        wake_.tryAcquire(1, 100);
+        sleeping_.store(false);
+    }
+}
+
+/**
+ * @brief The LogRateLimiter class
+ * @details 按调用点或分类限流。限流状态保存在LogCallSite或LogCategory中，查找不加锁，判断只用原子操作：
+ * 令牌桶按GCRA实现，只保存一个"理论到达时间"；每N条采样一条；与上一条完全相同的消息合并。
+ * 被抑制的消息计数，该调用点或分类下一条消息通过时，或后台刷新线程定期检查时，写入"suppressed N similar messages"
+ */
+class LogRateLimiter{
+public:
+    static void configure(int key, double per_second, int burst, int sample_every, bool collapse, LogSeverity max_severity);
+
+    /** 返回false表示该消息被抑制 */
+    static bool allow(const QMessageLogContext &context, LogSeverity severity, LogCategory *category, const QString &msg);
+
+    /** 写入全部未报告的抑制数量 */
+    static void reportSuppressed();
+
+    static quint64 suppressedTotal();
+
+private:
+    static bool check(LogRateState &state, const QString &msg);
+    static void report(LogRateState &state, LogCategory *category, const LogCallSite *site);
+
+    static std::atomic<int> key_;
+    /** 令牌桶每条消息的间隔(纳秒)，0表示不限速 */
+    static std::atomic<quint64> interval_;
+    static std::atomic<int> burst_;
+    static std::atomic<int> sample_every_;
+    static std::atomic<bool> collapse_;
+    /** 高于该等级的日志不限流 */
+    static std::atomic<int> max_severity_;
+    static std::atomic<quint64> suppressed_total_;
+};
+
+std::atomic<int> LogRateLimiter::key_(qtlog::RateLimitNone);
+std::atomic<quint64> LogRateLimiter::interval_(0);
+std::atomic<int> LogRateLimiter::burst_(1);
+std::atomic<int> LogRateLimiter::sample_every_(1);
+std::atomic<bool> LogRateLimiter::collapse_(false);
+std::atomic<int> LogRateLimiter::max_severity_(QERROR);
+std::atomic<quint64> LogRateLimiter::suppressed_total_(0);
+
+void LogRateLimiter::configure(int key, double per_second, int burst, int sample_every, bool collapse, LogSeverity max_severity)
+{
+    key_.store(qtlog::RateLimitNone);
+    interval_.store(per_second > 0 ? static_cast<quint64>(1e9 / per_second) + 1 : 0);
+    burst_.store(qMax(burst, 1));
+    sample_every_.store(qMax(sample_every, 1));
+    collapse_.store(collapse);
+    max_severity_.store(qBound(QDEBUG, max_severity, QERROR));
+    key_.store(key);
+}
+
+bool LogRateLimiter::check(LogRateState &state, const QString &msg)
+{
+    if(collapse_.load(std::memory_order_relaxed)){
+        /** FNV-1a，最低位置1保证不为0 */
+        quint64 hash = 14695981039346656037ull;
+        const ushort* text = msg.utf16();
+        for(int i = 0; i < msg.size(); i++){
+            hash ^= text[i];
+            hash *= 1099511628211ull;
+        }
+        hash |= 1;
+        if(state.last_hash.exchange(hash, std::memory_order_relaxed) == hash)
+            return false;
+    }
+
+    const int every = sample_every_.load(std::memory_order_relaxed);
+    if(every > 1 && state.seen.fetch_add(1, std::memory_order_relaxed) % static_cast<quint64>(every) != 0)
+        return false;
+
+    const quint64 interval = interval_.load(std::memory_order_relaxed);
+    if(interval > 0){
+        /** 理论到达时间超前当前时间不超过burst-1个间隔时放行，并推后一个间隔 */
+        const quint64 now = MonotonicNanos();
+        const quint64 tolerance = interval * static_cast<quint64>(burst_.load(std::memory_order_relaxed) - 1);
+        quint64 tat = state.tat.load(std::memory_order_relaxed);
+        for(;;){
+            quint64 base = qMax(tat, now);
+            if(base - now > tolerance)
+                return false;
+            if(state.tat.compare_exchange_weak(tat, base + interval, std::memory_order_relaxed))
+                break;
+        }
+    }
+    return true;
+}
+
+bool LogRateLimiter::allow(const QMessageLogContext &context, LogSeverity severity, LogCategory *category, const QString &msg)
+{
+    const int key = key_.load(std::memory_order_relaxed);
+    if(key == qtlog::RateLimitNone || severity > max_severity_.load(std::memory_order_relaxed))
+        return true;
+
+    LogCallSite* site = nullptr;
+    LogRateState* state = &category->rate;
+    if(key == qtlog::RateLimitCallSite){
+        site = LogCallSiteIndex::lookup(context, severity, category);
+        state = &site->rate;
+    }
+
+    if(!check(*state, msg)){
+        state->severity.store(severity, std::memory_order_relaxed);
+        state->suppressed.fetch_add(1, std::memory_order_relaxed);
+        suppressed_total_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /** 通过时先写出之前的抑制数量，提示排在这条消息前面 */
+    if(state->suppressed.load(std::memory_order_relaxed) != 0)
+        report(*state, category, site);
+    return true;
+}
+
+void LogRateLimiter::report(LogRateState &state, LogCategory *category, const LogCallSite *site)
+{
+    quint64 count = state.suppressed.exchange(0, std::memory_order_relaxed);
+    if(count == 0)
+        return;
+
+    /** 按被抑制消息的等级、分类和调用点渲染，与普通日志使用相同的格式 */
+    LogSeverity severity = state.severity.load(std::memory_order_relaxed);
+    QMessageLogContext context(site ? site->file.constData() : nullptr, site ? site->line : 0,
+                               site ? site->function.constData() : nullptr, category->name.constData());
+    QString msg = QString("suppressed %1 similar messages").arg(count);
+    if(site)
+        msg.append(QString(" (%1:%2)").arg(QString::fromLocal8Bit(site->file)).arg(site->line));
+    const int format = output_format;
+    const QtMsgType type = typeOf(severity);
+    QByteArray &line = format == qtlog::OutputText ? LogFormatter::render(type, context, msg)
+                                                   : LogFormatter::renderRecord(type, context, msg, format);
+    if(!LogAsyncWriter::enqueue(severity, line, category))
+        LogDestination::LogToAllLogfiles(severity, line, category);
+}
+
+void LogRateLimiter::reportSuppressed()
+{
+    const int key = key_.load(std::memory_order_relaxed);
+    if(key == qtlog::RateLimitCallSite){
+        for(LogCallSite* site : LogCallSiteIndex::sites())
+            report(site->rate, site->category, site);
+    }
+    else if(key == qtlog::RateLimitCategory){
+        for(LogCategory* category : LogCategoryIndex::categories())
+            report(category->rate, category, nullptr);
+    }
+}
+
+quint64 LogRateLimiter::suppressedTotal()
+{
+    return suppressed_total_.load(std::memory_order_relaxed);
+}
+
+void LogFlusher::enable()
+{
+    QMutexLocker locker(&control_mutex_);
+    if(instance_)
+        return;
+
+    instance_ = new LogFlusher;
+    instance_->start(QThread::LowPriority);
+    if(!post_routine_added_){
+        qAddPostRoutine(LogFlusher::shutdown);
+        post_routine_added_ = true;
+    }
+}
+
+void LogFlusher::disable()
+{
+    QMutexLocker locker(&control_mutex_);
+    if(!instance_)
+        return;
+
+    {
+        QMutexLocker flusher_locker(&instance_->mutex_);
+        instance_->stopping_ = true;
+        instance_->wake_.wakeAll();
+    }
+    instance_->wait();
+    delete instance_;
+    instance_ = nullptr;
+}
+
+void LogFlusher::shutdown()
+{
+    LogFlusher::disable();
+    /** 程序退出时提交缓存中的日志，包括分块格式未满的块 */
+    LogDestination::flushAllLogs();
+}
+
+void LogFlusher::wakeUp()
+{
+    QMutexLocker locker(&control_mutex_);
+    if(!instance_)
+        return;
+    QMutexLocker flusher_locker(&instance_->mutex_);
+    instance_->wake_.wakeAll();
+}
+
+bool LogFlusher::requestSync()
+{
+    QMutexLocker locker(&control_mutex_);
+    if(!instance_)
+        return false;
+    /** 先设置标志再唤醒，线程在等待前检查标志，不会错过请求 */
+    sync_requested_.store(true, std::memory_order_relaxed);
+    QMutexLocker flusher_locker(&instance_->mutex_);
+    instance_->wake_.wakeAll();
+    return true;
+}
+
+void LogFlusher::run()
+{
+    QMutexLocker locker(&mutex_);
+    qint64 next_flush = LogClock::nowMSecs() + qMax<qint64>(logbufsecs, 1) * 1000;
+    while(!stopping_){
+        const qint64 interval = qMax<qint64>(logbufsecs, 1) * 1000;
+        const qint64 remaining = next_flush - LogClock::nowMSecs();
+        bool woken = sync_requested_.load(std::memory_order_relaxed) ||
+                (remaining > 0 && wake_.wait(&mutex_, static_cast<unsigned long>(remaining)));
+        if(stopping_)
+            break;
+        bool sync = sync_requested_.exchange(false, std::memory_order_relaxed);
+        /** 其他唤醒为刷新间隔变化，按新间隔重新计时 */
+        if(woken && !sync){
+            next_flush = LogClock::nowMSecs() + interval;
+            continue;
+        }
+        const bool due = LogClock::nowMSecs() >= next_flush;
+
+        locker.unlock();
+        if(sync)
+            LogDestination::syncPendingLogs();
+        if(due){
+            LogRateLimiter::reportSuppressed();
+            LogDestination::flushDirtyLogs();
+        }
+        locker.relock();
+        if(due)
+            next_flush = LogClock::nowMSecs() + interval;
+    }
+    /** 退出前完成已发起的同步 */
+    locker.unlock();
+    LogDestination::syncPendingLogs();
+}
+
+/** 磁盘可用空间检查间隔 */
+static const unsigned long kDiskCheckMSecs = 1000;
+/** 未切换文件时按保留时间检查旧文件的间隔 */
+static const qint64 kRetentionScanSecs = 60;
+/** 可用空间低于该值时视为磁盘已满，停止写入文件 */
+static const qint64 kDiskReserveBytes = 4 * 1024 * 1024;
+
+std::atomic<bool> LogRetention::scan_requested_{true};
+LogRetention* LogRetention::instance_ = nullptr;
+QMutex LogRetention::control_mutex_;
+bool LogRetention::post_routine_added_ = false;
+
+/** path所在磁盘对当前用户可用的字节数 */
+static bool FreeDiskSpace(const QString &path, qint64 &bytes)
+{
+#if defined(Q_OS_WIN)
+    ULARGE_INTEGER available;
+    if(!GetDiskFreeSpaceExW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(path).utf16()), &available, nullptr, nullptr))
+        return false;
+    bytes = static_cast<qint64>(available.QuadPart);
+    return true;
+#elif defined(Q_OS_UNIX)
+    struct statvfs st;
+    if(statvfs(QFile::encodeName(path).constData(), &st) != 0)
+        return false;
+    bytes = static_cast<qint64>(st.f_bavail) * static_cast<qint64>(st.f_frsize);
+    return true;
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(bytes);
+    return false;
+#endif
+}
+
+void LogRetention::enable()
+{
+    QMutexLocker locker(&control_mutex_);
+    if(instance_)
+        return;
+
+    instance_ = new LogRetention;
+    instance_->start(QThread::LowPriority);
+    if(!post_routine_added_){
+        qAddPostRoutine(LogRetention::shutdown);
+        post_routine_added_ = true;
+    }
+}
+
+void LogRetention::disable()
+{
+    QMutexLocker locker(&control_mutex_);
+    if(!instance_)
+        return;
+
+    {
+        QMutexLocker retention_locker(&instance_->mutex_);
+        instance_->stopping_ = true;
+        instance_->wake_.wakeAll();
+    }
+    instance_->wait();
+    delete instance_;
+    instance_ = nullptr;
+}
+
+void LogRetention::shutdown()
+{
+    LogRetention::disable();
+}
+
+void LogRetention::requestScan()
+{
+    scan_requested_.store(true, std::memory_order_relaxed);
+}
+
+void LogRetention::run()
+{
+    qint64 next_scan = 0;
+    QMutexLocker locker(&mutex_);
+    while(!stopping_){
+        locker.unlock();
+
+        QStringList bases, directories, active;
+        const qint64 listed = QDateTime::currentMSecsSinceEpoch();
+        LogDestination::retentionTargets(bases, directories, active);
+        checkDiskSpace(bases);
+
+        /** 磁盘空间不足时每次检查都清理，尽快恢复写入 */
+        qint64 now = CycleClock_Now();
+        if(scan_requested_.exchange(false, std::memory_order_relaxed) || now >= next_scan ||
+                shed_severity.load(std::memory_order_relaxed) != QDEBUG){
+            enforce(directories, active, listed);
+            next_scan = now + kRetentionScanSecs;
+        }
+
+        locker.relock();
+        if(stopping_)
+            break;
+        wake_.wait(&mutex_, kDiskCheckMSecs);
+    }
+}
+
+void LogRetention::checkDiskSpace(const QStringList &bases)
+{
+    qint64 free_bytes = -1;
+    for(const QString &base : bases){
+        qint64 bytes;
+        if(FreeDiskSpace(base, bytes) && (free_bytes < 0 || bytes < free_bytes))
+            free_bytes = bytes;
+    }
+    if(free_bytes < 0)
+        return;
+
+    /** 可用空间越少丢弃的等级越高，fatal日志只在磁盘已满时丢弃 */
+    int severity = QDEBUG;
+    if(min_free_space > 0 && free_bytes < min_free_space){
+        if(free_bytes >= min_free_space / 2)
+            severity = QWARING;
+        else if(free_bytes >= min_free_space / 4)
+            severity = QERROR;
+        else
+            severity = QFATAL;
+    }
+    shed_severity.store(severity, std::memory_order_relaxed);
+    stop_writing.store(free_bytes < kDiskReserveBytes, std::memory_order_relaxed);
+}
+
+void LogRetention::enforce(const QStringList &directories, const QStringList &active, qint64 listed)
+{
+    qint64 max_bytes = retention_max_bytes;
+    int max_files = retention_max_files;
+    qint64 max_age = retention_max_age;
+    if(max_bytes <= 0 && max_files <= 0 && max_age <= 0)
+        return;
+
+    qint64 expired = LogClock::nowMSecs() - max_age * 1000;
+    QStringList filters;
+    filters << "*.log" << QString("*.%1").arg(QTLOGB_SUFFIX) << QString("*.%1").arg(QTLOGF_SUFFIX) << "*.gz" << "*.zst";
+
+    for(const QString &directory : directories){
+        /** 文件名以创建时间开头，按名称排序即从旧到新 */
+        QFileInfoList files = QDir(directory).entryInfoList(filters, QDir::Files, QDir::Name);
+        qint64 total = 0;
+        for(const QFileInfo &info : files)
+            total += info.size();
+        int count = files.size();
+
+        /**
+         * 取得快照之后新打开的预备文件或切换后的当前文件不在active中：目录中最新的文件总是保留，
+         * 快照前后修改过的文件也不删除(文件系统时间戳精度较粗，留2s余量)，留到下一次检查
+         */
+        if(!files.isEmpty())
+            files.removeLast();
+        for(const QFileInfo &info : files){
+            bool over_size = max_bytes > 0 && total > max_bytes;
+            bool over_count = max_files > 0 && count > max_files;
+            bool over_age = max_age > 0 && info.lastModified().toMSecsSinceEpoch() < expired;
+            if(!over_size && !over_count && !over_age)
+                continue;
+            if(active.contains(info.absoluteFilePath()) || info.lastModified().toMSecsSinceEpoch() >= listed - 2000)
+                continue;
+            if(QFile::remove(info.absoluteFilePath())){
+                QFile::remove(info.absoluteFilePath() + QTLOGI_SUFFIX);
+                total -= info.size();
+                count--;
+                retention_deleted.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/**
+ * @brief The LogNetworkRecord struct
+ * @details 生产者线程交给网络线程的一条日志，只拷贝原始UTF-16消息，syslog格式化和发送都在网络线程完成
+ */
+struct LogNetworkRecord{
+    LogSeverity severity = 0;
+    LogCallSite* site = nullptr;
+    qint64 timestamp = 0;
+    quintptr thread = 0;
+    QByteArray msg;
+};
+
+/** 格式化后等待发送的syslog消息，连接断开时在暂存区累积 */
+struct LogSpillEntry{
+    QByteArray packet;
+    /** packet中MSG部分(BOM之后)的起始位置，写入日志文件时只取消息内容 */
+    int message_offset = 0;
+    LogSeverity severity = 0;
+    LogCallSite* site = nullptr;
+    qint64 timestamp = 0;
+    quintptr thread = 0;
+};
+
+/**
+ * @brief The LogNetworkSink class
+ * @details 网络日志线程，按RFC5424格式将日志发送到本地或远程日志收集器，支持UDP、TCP和Unix域套接字。
+ * 生产者线程只拷贝消息入队，队列满时不等待；网络线程每次取出队列中的全部记录成批发送(UDP和Unix数据报用sendmmsg，
+ * TCP按RFC6587 octet-counting分帧后一次send)。连接失败或断开后按100ms到30s指数退避重连，
+ * 期间记录暂存在有上限的暂存区，超出上限的最旧记录写入对应的日志文件，程序退出时未发送的记录同样写入日志文件
+ */
+class LogNetworkSink : public QThread{
+public:
+    static void enable(int transport, const QString &address, quint16 port, LogSeverity min_severity, bool files);
+    static void disable();
+    /**
+     * 转发一条日志，返回true表示该日志只发送到网络，不再写入日志文件。
+     * 未开启、等级低于设置或同时写文件时返回false，队列满时由调用线程写入日志文件
+     */
+    static bool forward(LogSeverity severity, const QMessageLogContext &context, LogCategory *category, const QString &msg);
+
+protected:
+    void run();
+
+private:
+    LogNetworkSink(int transport, const QString &address, quint16 port, LogSeverity min_severity, bool files);
+    ~LogNetworkSink();
+    static void shutdown();
+
+    void wakeUp();
+    void notify();
+    void collect();
+    void format(LogNetworkRecord &record, LogSpillEntry &entry);
+    bool connectSocket();
+    void closeSocket();
+    void failed();
+    bool sendBatch();
+    void fallback(LogSpillEntry &entry);
+    void trimSpill();
+
+    LogRingQueue<LogNetworkRecord> queue_;
+    QSemaphore wake_;
+    std::atomic<bool> sleeping_;
+    std::atomic<bool> stopping_;
+
+    int transport_;
+    QByteArray address_;
+    quint16 port_;
+    LogSeverity min_severity_;
+    /** 同时写入日志文件，此时暂存区溢出的记录直接丢弃 */
+    bool files_;
+
+    int fd_;
+    /** 流式连接(TCP或流式Unix域套接字)，按octet-counting分帧 */
+    bool stream_;
+    qint64 retry_at_;
+    qint64 backoff_;
+
+    std::deque<LogSpillEntry> spill_;
+    qint64 spill_bytes_;
+    /** " HOSTNAME APP-NAME PROCID "，每条消息相同 */
+    QByteArray header_;
+    QByteArray batch_;
+
+    static std::atomic<LogNetworkSink*> instance_;
+    /** 正在转发的生产者数量，停止时等待其归零 */
+    static std::atomic<int> producers_;
+    static QMutex control_mutex_;
+    static bool post_routine_added_;
+};
+
+std::atomic<LogNetworkSink*> LogNetworkSink::instance_(nullptr);
+std::atomic<int> LogNetworkSink::producers_(0);
+QMutex LogNetworkSink::control_mutex_;
+bool LogNetworkSink::post_routine_added_ = false;
+
+/** 网络线程队列容量 */
+static const quint32 kNetworkQueueCapacity = 8192;
+/** 每次发送的最多记录数和字节数 */
+static const int kNetworkBatchRecords = 64;
+static const int kNetworkBatchBytes = 64 * 1024;
+/** 重连退避的初始和最大间隔，单位ms */
+static const qint64 kNetworkBackoffMin = 100;
+static const qint64 kNetworkBackoffMax = 30 * 1000;
+/** TCP连接和发送超时，单位ms */
+static const int kNetworkTimeout = 1000;
+
+LogNetworkSink::LogNetworkSink(int transport, const QString &address, quint16 port, LogSeverity min_severity, bool files):
+    queue_(kNetworkQueueCapacity),sleeping_(false),stopping_(false),
+    transport_(transport),address_(QFile::encodeName(address)),port_(port),min_severity_(min_severity),files_(files),
+    fd_(-1),stream_(false),retry_at_(0),backoff_(kNetworkBackoffMin),spill_bytes_(0)
+{
+    std::string hostname;
+    GetHostName(&hostname);
+    QByteArray appname = QCoreApplication::applicationName().toUtf8();
+    header_.append(' ');
+    header_.append(hostname.empty() ? "-" : hostname.c_str());
+    header_.append(' ');
+    header_.append(appname.isEmpty() ? QByteArray("-") : appname.replace(' ', '_').left(48));
+    header_.append(' ');
+    header_.append(QByteArray::number(QCoreApplication::applicationPid()));
+    header_.append(' ');
+}
+
+LogNetworkSink::~LogNetworkSink()
+{
+    closeSocket();
+}
+
+void LogNetworkSink::enable(int transport, const QString &address, quint16 port, LogSeverity min_severity, bool files)
+{
+    disable();
+#ifdef Q_OS_LINUX
+    if(transport == qtlog::NetworkNone)
+        return;
+
+    QMutexLocker locker(&control_mutex_);
+    LogNetworkSink* sink = new LogNetworkSink(transport, address, port, min_severity, files);
+    sink->start(QThread::LowPriority);
+    instance_.store(sink);
+    if(!post_routine_added_){
+        /** 程序退出时发送或写入剩余记录 */
+        qAddPostRoutine(LogNetworkSink::shutdown);
+        post_routine_added_ = true;
+    }
+#else
+    Q_UNUSED(transport);
+    Q_UNUSED(address);
+    Q_UNUSED(port);
+    Q_UNUSED(min_severity);
+    Q_UNUSED(files);
+#endif
+}
+
+void LogNetworkSink::disable()
+{
+    QMutexLocker locker(&control_mutex_);
+    LogNetworkSink* sink = instance_.exchange(nullptr);
+    if(!sink)
+        return;
+
+    while(producers_.load() != 0)
+        QThread::yieldCurrentThread();
+
+    sink->stopping_.store(true);
+    sink->wakeUp();
+    sink->wait();
+    delete sink;
+    LogDestination::flushAllLogs();
+}
+
+void LogNetworkSink::shutdown()
+{
+    LogNetworkSink::disable();
+}
+
+bool LogNetworkSink::forward(LogSeverity severity, const QMessageLogContext &context, LogCategory *category, const QString &msg)
+{
+    if(!instance_.load(std::memory_order_relaxed))
+        return false;
+
+    producers_.fetch_add(1);
+    LogNetworkSink* sink = instance_.load();
+    if(!sink || severity < sink->min_severity_ || QThread::currentThread() == sink){
+        producers_.fetch_sub(1);
+        return false;
+    }
+
+    LogNetworkRecord record;
+    record.severity = severity;
+    record.site = LogCallSiteIndex::lookup(context, severity, category);
+    record.timestamp = LogClock::nowMSecs();
+    record.thread = reinterpret_cast<quintptr>(QThread::currentThread());
+    record.msg = QByteArray(reinterpret_cast<const char*>(msg.utf16()), msg.size() * 2);
+
+    bool queued = sink->queue_.tryPush(record);
+    if(queued)
+        sink->notify();
+    else if(sink->files_)
+        network_dropped.fetch_add(1, std::memory_order_relaxed);
+    else
+        network_fallback.fetch_add(1, std::memory_order_relaxed);
+    bool exclusive = queued && !sink->files_;
+    producers_.fetch_sub(1);
+    return exclusive;
+}
+
+void LogNetworkSink::wakeUp()
+{
+    if(sleeping_.exchange(false))
+        wake_.release();
+}
+
+void LogNetworkSink::notify()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping_.load(std::memory_order_relaxed))
+        wakeUp();
+}
+
+void LogNetworkSink::collect()
+{
+    LogNetworkRecord record;
+    while(queue_.tryPop(record)){
+        spill_.emplace_back();
+        format(record, spill_.back());
+        spill_bytes_ += spill_.back().packet.size();
+    }
+}
+
+/** SD-PARAM的值中 " \ ] 需要转义 */
+static void appendSdValue(QByteArray &out, const char *str, int len)
+{
+    for(int i = 0; i < len; i++){
+        if(str[i] == '"' || str[i] == '\\' || str[i] == ']')
+            out.append('\\');
+        out.append(str[i]);
+    }
+}
+
+void LogNetworkSink::format(LogNetworkRecord &record, LogSpillEntry &entry)
+{
+    /** facility为user(1)，等级对应 debug(7) info(6) warning(4) err(3) crit(2) */
+    static const int kSyslogSeverity[NUM_SEVERITIES] = {7, 6, 4, 3, 2};
+    QByteArray &packet = entry.packet;
+    packet.reserve(128 + header_.size() + record.msg.size() * 3 / 2);
+    packet.append('<');
+    appendNumber(packet, static_cast<quint64>(8 + kSyslogSeverity[record.severity]));
+    packet.append(">1 ", 3);
+
+    /** UTC时间 yyyy-MM-ddThh:mm:ss.zzzZ，按日数换算公历日期，不依赖gmtime */
+    qint64 msecs = record.timestamp;
+    qint64 days = msecs / 86400000;
+    qint64 rest = msecs % 86400000;
+    qint64 z = days + 719468;
+    qint64 era = z / 146097;
+    qint64 doe = z - era * 146097;
+    qint64 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    qint64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    qint64 mp = (5 * doy + 2) / 153;
+    qint64 day = doy - (153 * mp + 2) / 5 + 1;
+    qint64 month = mp < 10 ? mp + 3 : mp - 9;
+    qint64 year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+    appendNumber(packet, static_cast<quint64>(year), 10, 4);
+    packet.append('-');
+    appendNumber(packet, static_cast<quint64>(month), 10, 2);
+    packet.append('-');
+    appendNumber(packet, static_cast<quint64>(day), 10, 2);
+    packet.append('T');
+    appendNumber(packet, static_cast<quint64>(rest / 3600000), 10, 2);
+    packet.append(':');
+    appendNumber(packet, static_cast<quint64>(rest / 60000 % 60), 10, 2);
+    packet.append(':');
+    appendNumber(packet, static_cast<quint64>(rest / 1000 % 60), 10, 2);
+    packet.append('.');
+    appendNumber(packet, static_cast<quint64>(rest % 1000), 10, 3);
+    packet.append('Z');
+    packet.append(header_);
+
+    /** MSGID为分类名，超过32字符或含不可打印字符时省略 */
+    const LogCallSite* site = record.site;
+    const QByteArray category = site && site->category ? site->category->name : QByteArray();
+    const int category_len = category.size();
+    bool msgid = category_len > 0 && category_len <= 32 && category != "default";
+    for(int i = 0; msgid && i < category_len; i++)
+        msgid = category[i] > ' ' && category[i] < 0x7f;
+    if(msgid)
+        packet.append(category);
+    else
+        packet.append('-');
+
+    packet.append(" [qtlog@32473 thread=\"0x", 24);
+    appendNumber(packet, record.thread, 16);
+    packet.append('"');
+    if(site && !site->file.isEmpty()){
+        packet.append(" file=\"", 7);
+        appendSdValue(packet, site->file.constData(), site->file.size());
+        packet.append("\" line=\"", 8);
+        appendNumber(packet, static_cast<quint64>(site->line > 0 ? site->line : 0));
+        packet.append('"');
+    }
+    packet.append("] \xEF\xBB\xBF", 5);
+
+    entry.message_offset = packet.size();
+    const ushort* text = reinterpret_cast<const ushort*>(record.msg.constData());
+    const int len = record.msg.size() / 2;
+    int pos = packet.size();
+    packet.resize(pos + len * 3);
+    char* dst = packet.data() + pos;
+    char* begin = dst;
+    for(int i = 0; i < len; i++)
+        dst = putUtf8(dst, text, i, len);
+    packet.resize(pos + static_cast<int>(dst - begin));
+
+    entry.severity = record.severity;
+    entry.site = record.site;
+    entry.timestamp = record.timestamp;
+    entry.thread = record.thread;
+}
+
+bool LogNetworkSink::connectSocket()
+{
+#ifdef Q_OS_LINUX
+    closeSocket();
+    int fd = -1;
+    if(transport_ == qtlog::NetworkUnix){
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if(address_.size() >= static_cast<int>(sizeof(addr.sun_path)))
+            return false;
+        memcpy(addr.sun_path, address_.constData(), static_cast<size_t>(address_.size()));
+
+        /** 优先数据报(如/dev/log)，对端为流式套接字时改用流式连接 */
+        const int types[] = {SOCK_DGRAM, SOCK_STREAM};
+        for(int type : types){
+            /** 数据报套接字非阻塞，接收方队列满时返回EAGAIN稍后重试，不阻塞网络线程 */
+            fd = socket(AF_UNIX, type | SOCK_CLOEXEC | (type == SOCK_DGRAM ? SOCK_NONBLOCK : 0), 0);
+            if(fd < 0)
+                continue;
+            if(::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0){
+                stream_ = type == SOCK_STREAM;
+                break;
+            }
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    else{
+        const bool tcp = transport_ == qtlog::NetworkTcp;
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+        struct addrinfo* result = nullptr;
+        if(getaddrinfo(address_.constData(), QByteArray::number(static_cast<int>(port_)).constData(), &hints, &result) != 0)
+            return false;
+
+        for(struct addrinfo* ai = result; ai && fd < 0; ai = ai->ai_next){
+            fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | (tcp ? 0 : SOCK_NONBLOCK), ai->ai_protocol);
+            if(fd < 0)
+                continue;
+            if(!tcp){
+                /** UDP连接后对端不可达时send返回ECONNREFUSED，可据此退避 */
+                if(::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0){
+                    ::close(fd);
+                    fd = -1;
+                }
+                continue;
+            }
+
+            /** 非阻塞连接，超时后尝试下一个地址 */
+            int flags = fcntl(fd, F_GETFL, 0);
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+            bool connected = ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+            if(!connected && errno == EINPROGRESS){
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                int error = 0;
+                socklen_t error_len = sizeof(error);
+                connected = poll(&pfd, 1, kNetworkTimeout) == 1 &&
+                        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0;
+            }
+            if(!connected){
+                ::close(fd);
+                fd = -1;
+                continue;
+            }
+            fcntl(fd, F_SETFL, flags);
+            int nodelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        }
+        freeaddrinfo(result);
+        stream_ = tcp;
+    }
+    if(fd >= 0 && stream_){
+        /** 流式连接阻塞发送，收集器停止读取时超时断开重连 */
+        struct timeval timeout = {kNetworkTimeout / 1000, (kNetworkTimeout % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    fd_ = fd;
+    return fd_ >= 0;
+#else
+    return false;
+#endif
+}
+
+void LogNetworkSink::closeSocket()
+{
+#ifdef Q_OS_LINUX
+    if(fd_ >= 0)
+        ::close(fd_);
+#endif
+    fd_ = -1;
+}
+
+void LogNetworkSink::failed()
+{
+    closeSocket();
+    retry_at_ = LogClock::nowMSecs() + backoff_;
+    backoff_ = qMin(backoff_ * 2, kNetworkBackoffMax);
+}
+
+bool LogNetworkSink::sendBatch()
+{
+#ifdef Q_OS_LINUX
+    const int send_flags = MSG_NOSIGNAL;
+    int count = qMin(static_cast<int>(spill_.size()), kNetworkBatchRecords);
+    int sent = 0;
+    if(stream_){
+        /** octet-counting分帧："长度 消息"，一批记录拼接后发送 */
+        batch_.resize(0);
+        int frames[kNetworkBatchRecords];
+        int n = 0;
+        while(n < count && (n == 0 || batch_.size() + spill_[n].packet.size() < kNetworkBatchBytes)){
+            appendNumber(batch_, static_cast<quint64>(spill_[n].packet.size()));
+            batch_.append(' ');
+            batch_.append(spill_[n].packet);
+            frames[n++] = batch_.size();
+        }
+        qint64 offset = 0;
+        bool ok = true;
+        while(offset < batch_.size()){
+            ssize_t written = ::send(fd_, batch_.constData() + offset, static_cast<size_t>(batch_.size() - offset), send_flags);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0){
+                ok = false;
+                break;
+            }
+            offset += written;
+        }
+        /** 只移除完整发送的帧，断开时未发完的帧在重连后重新发送 */
+        while(sent < n && frames[sent] <= offset)
+            sent++;
+        if(!ok){
+            for(int i = 0; i < sent; i++){
+                spill_bytes_ -= spill_.front().packet.size();
+                spill_.pop_front();
+            }
+            network_sent.fetch_add(static_cast<quint64>(sent), std::memory_order_relaxed);
+            failed();
+            return false;
+        }
+    }
+    else{
+        struct mmsghdr messages[kNetworkBatchRecords];
+        struct iovec vectors[kNetworkBatchRecords];
+        memset(messages, 0, sizeof(messages));
+        for(int i = 0; i < count; i++){
+            vectors[i].iov_base = const_cast<char*>(spill_[i].packet.constData());
+            vectors[i].iov_len = static_cast<size_t>(spill_[i].packet.size());
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int result = sendmmsg(fd_, messages, static_cast<unsigned int>(count), send_flags);
+        while(result < 0 && errno == EINTR)
+            result = sendmmsg(fd_, messages, static_cast<unsigned int>(count), send_flags);
+        if(result < 0){
+            /** 只有返回-1时errno才有意义，第一条记录就发送失败 */
+            const int error = errno;
+            if(error == EMSGSIZE){
+                /** 超过报文大小上限的记录无法发送，直接按溢出处理 */
+                fallback(spill_.front());
+                spill_bytes_ -= spill_.front().packet.size();
+                spill_.pop_front();
+                return true;
+            }
+            if(error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS){
+                /** 接收方缓冲区满，稍后重试，不断开连接 */
+                retry_at_ = LogClock::nowMSecs() + kNetworkBackoffMin;
+                return false;
+            }
+            failed();
+            return false;
+        }
+        /** 部分发送时返回已发送的数量且不设置errno，移除已发送的记录后由调用者继续发送剩余记录，
+         * 剩余的第一条再失败时sendmmsg返回-1，按上面的错误码处理 */
+        sent = result;
+    }
+
+    for(int i = 0; i < sent; i++){
+        spill_bytes_ -= spill_.front().packet.size();
+        spill_.pop_front();
+    }
+    network_sent.fetch_add(static_cast<quint64>(sent), std::memory_order_relaxed);
+    backoff_ = kNetworkBackoffMin;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LogNetworkSink::fallback(LogSpillEntry &entry)
+{
+    if(files_){
+        /** 日志已同时写入文件，网络侧只计数 */
+        network_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    network_fallback.fetch_add(1, std::memory_order_relaxed);
+
+    LogCategory* category = entry.site ? entry.site->category : nullptr;
+    if(!category)
+        return;
+    LogDestination* destination = LogDestination::destination(entry.severity, category);
+    const char* message = entry.packet.constData() + entry.message_offset;
+    const int message_len = entry.packet.size() - entry.message_offset;
+    if(destination->isBinary()){
+        QString text = QString::fromUtf8(message, message_len);
+        QByteArray payload = QByteArray::fromRawData(reinterpret_cast<const char*>(text.utf16()), text.size() * 2);
+        destination->writeBinary(entry.site, entry.timestamp, entry.thread, payload);
+        return;
+    }
+
+    /** 按当前的日志格式渲染，时间和线程取原记录的值 */
+    QString text = QString::fromUtf8(message, message_len);
+    QMessageLogContext context(entry.site->file.constData(), entry.site->line, entry.site->function.constData(),
+                               category->name.constData());
+    const int format = output_format;
+    const QtMsgType type = typeOf(entry.severity);
+    QByteArray &line = format == qtlog::OutputText
+            ? LogFormatter::render(type, context, text, entry.timestamp, entry.thread)
+            : LogFormatter::renderRecord(type, context, text, format, entry.timestamp, entry.thread);
+    destination->write(entry.severity, line);
+}
+
+void LogNetworkSink::trimSpill()
+{
+    while(!spill_.empty() && spill_bytes_ > network_spill_limit){
+        fallback(spill_.front());
+        spill_bytes_ -= spill_.front().packet.size();
+        spill_.pop_front();
+    }
+}
+
+void LogNetworkSink::run()
+{
+    for(;;){
+        collect();
+        const bool stopping = stopping_.load();
+
+        if(fd_ < 0 && !spill_.empty() && LogClock::nowMSecs() >= retry_at_ && !connectSocket())
+            failed();
+        while(fd_ >= 0 && !spill_.empty() && LogClock::nowMSecs() >= retry_at_){
+            if(!sendBatch())
+                break;
+            /** 发送期间新到的记录并入下一批 */
+            collect();
+        }
+        trimSpill();
+        if(stopping)
+            break;
+
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(queue_.size() != 0){
+            sleeping_.store(false);
+            continue;
+        }
+        /** 等待重连时按退避时间唤醒，否则超时保证即使错过唤醒也能及时处理队列 */
+        int timeout = 100;
+        if(!spill_.empty())
+            timeout = static_cast<int>(qBound<qint64>(1, retry_at_ - LogClock::nowMSecs(), 100));
+        wake_.tryAcquire(1, timeout);
+        sleeping_.store(false);
+    }
+
+    /** 退出前剩余记录写入日志文件 */
+    while(!spill_.empty()){
+        fallback(spill_.front());
+        spill_.pop_front();
+    }
+    spill_bytes_ = 0;
+    closeSocket();
+}
+
+/**
+ * @brief The LogFlightRecorder class
+ * @details 共享内存飞行记录器，每条日志写入shm_open创建的固定大小环形缓冲区，格式见qtlogring.h。
+ * 生产者原子递增序号取得槽位，按序号的奇偶标记写入中和完成，写入不加锁、不经过磁盘；
+ * 外部进程(tools/qtlog-ring)可实时跟踪，或在程序退出、崩溃后读取。程序退出时不删除共享内存
+ */
+class LogFlightRecorder{
+public:
+    static bool open(const QString &name, qint64 bytes, int slot_size);
+    static void close();
+    static void record(LogSeverity severity, const QMessageLogContext &context, LogCategory *category, const QString &msg);
+
+private:
+    static std::atomic<QtlogRingHeader*> ring_;
+    /** 正在写入的生产者数量，关闭时等待其归零后解除映射 */
+    static std::atomic<int> producers_;
+    static qint64 size_;
+    static QMutex control_mutex_;
+    static bool post_routine_added_;
+};
+
+std::atomic<QtlogRingHeader*> LogFlightRecorder::ring_(nullptr);
+std::atomic<int> LogFlightRecorder::producers_(0);
+qint64 LogFlightRecorder::size_ = 0;
+QMutex LogFlightRecorder::control_mutex_;
+bool LogFlightRecorder::post_routine_added_ = false;
+
+bool LogFlightRecorder::open(const QString &name, qint64 bytes, int slot_size)
+{
+    close();
+#ifdef Q_OS_LINUX
+    QMutexLocker locker(&control_mutex_);
+    /** 槽位大小按8字节对齐，消息长度字段为16位 */
+    slot_size = qBound(QTLOGR_SLOT_HEADER_SIZE + 64, (slot_size + 7) & ~7, 65528);
+    quint32 count = 16;
+    while(QTLOGR_HEADER_SIZE + static_cast<qint64>(count) * 2 * slot_size <= bytes && count < (1u << 30))
+        count <<= 1;
+    qint64 size = QTLOGR_HEADER_SIZE + static_cast<qint64>(count) * slot_size;
+
+    /** 同名的旧缓冲区先删除，正在读取它的进程仍保留原映射 */
+    QByteArray path = QFile::encodeName(name.startsWith(QString("/")) ? name : QString("/") + name);
+    shm_unlink(path.constData());
+    int fd = shm_open(path.constData(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    if(fd < 0){
+        fprintf(stderr, "qtlog: shm_open %s failed: %s\n", path.constData(), strerror(errno));
+        return false;
+    }
+    void* base = MAP_FAILED;
+    if(ftruncate(fd, size) == 0)
+        base = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(base == MAP_FAILED){
+        fprintf(stderr, "qtlog: cannot map flight recorder %s: %s\n", path.constData(), strerror(errno));
+        shm_unlink(path.constData());
+        return false;
+    }
+
+    /** ftruncate后内容为0，所有槽位seq为0，即序号0之前的状态 */
+    QtlogRingHeader* header = static_cast<QtlogRingHeader*>(base);
+    header->version = QTLOGR_VERSION;
+    header->slotSize = static_cast<quint32>(slot_size);
+    header->slotCount = count;
+    header->pid = static_cast<quint32>(QCoreApplication::applicationPid());
+    header->created = LogClock::nowMSecs();
+    header->flags = (fileLine ? QTLOGR_FLAG_FILELINE : 0) |
+            (LogDestination::getCategoryMode() ? 0 : QTLOGR_FLAG_CATEGORY);
+    header->closed.store(0, std::memory_order_relaxed);
+    header->lost.store(0, std::memory_order_relaxed);
+    header->head.store(0, std::memory_order_relaxed);
+    /** magic最后写入，读取进程看到magic时其他字段已就绪 */
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, QTLOGR_MAGIC, QTLOGR_MAGIC_SIZE);
+
+    size_ = size;
+    ring_.store(header, std::memory_order_release);
+    if(!post_routine_added_){
+        qAddPostRoutine(LogFlightRecorder::close);
+        post_routine_added_ = true;
+    }
+    return true;
+#else
+    Q_UNUSED(name);
+    Q_UNUSED(bytes);
+    Q_UNUSED(slot_size);
+    return false;
+#endif
+}
+
+void LogFlightRecorder::close()
+{
+    QMutexLocker locker(&control_mutex_);
+    QtlogRingHeader* header = ring_.exchange(nullptr);
+    if(!header)
+        return;
+
+    while(producers_.load() != 0)
+        QThread::yieldCurrentThread();
+    header->closed.store(1, std::memory_order_release);
+#ifdef Q_OS_LINUX
+    munmap(header, static_cast<size_t>(size_));
+#endif
+}
+
+void LogFlightRecorder::record(LogSeverity severity, const QMessageLogContext &context, LogCategory *category, const QString &msg)
+{
+    if(!ring_.load(std::memory_order_relaxed))
+        return;
+
+    producers_.fetch_add(1);
+    QtlogRingHeader* header = ring_.load(std::memory_order_acquire);
+    if(!header){
+        producers_.fetch_sub(1);
+        return;
+    }
+
+    const quint64 sequence = header->head.fetch_add(1, std::memory_order_relaxed);
+    QtlogRingSlot* slot = qtlogring::slot(header, sequence);
+
+    /**
+     * 槽位只能从之前某一圈的完成状态(偶数且小于 2n+1)取得。上一圈的写入者落后一整圈仍未写完(奇数)，
+     * 或本圈已被更快的下一圈写入者占用时放弃，两个写入者不会同时写入同一槽位，seq也不会回退
+     */
+    const quint64 claim = 2 * sequence + 1;
+    quint64 current = slot->seq.load(std::memory_order_relaxed);
+    for(;;){
+        if((current & 1) != 0 || current > claim){
+            header->lost.fetch_add(1, std::memory_order_relaxed);
+            producers_.fetch_sub(1);
+            return;
+        }
+        if(slot->seq.compare_exchange_weak(current, claim, std::memory_order_relaxed))
+            break;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->timestamp = LogClock::nowMSecs();
+    slot->thread = reinterpret_cast<quintptr>(QThread::currentThread());
+    slot->severity = static_cast<quint8>(severity);
+    slot->line = static_cast<quint32>(context.line > 0 ? context.line : 0);
+
+    /** 分类、文件名、消息依次写入槽位，放不下的部分截断 */
+    char* data = reinterpret_cast<char*>(slot) + QTLOGR_SLOT_HEADER_SIZE;
+    char* end = reinterpret_cast<char*>(slot) + header->slotSize;
+    quint8 flags = 0;
+
+    int category_len = qMin(category->name.size(), static_cast<int>(end - data) / 4);
+    memcpy(data, category->name.constData(), static_cast<size_t>(category_len));
+    data += category_len;
+
+    int file_len = context.file ? static_cast<int>(strlen(context.file)) : 0;
+    if(file_len > static_cast<int>(end - data) / 4){
+        /** 文件名过长时保留末尾部分 */
+        int keep = static_cast<int>(end - data) / 4;
+        memcpy(data, context.file + file_len - keep, static_cast<size_t>(keep));
+        file_len = keep;
+        flags |= QTLOGR_SLOT_TRUNCATED;
+    }
+    else if(file_len > 0){
+        memcpy(data, context.file, static_cast<size_t>(file_len));
+    }
+    data += file_len;
+
+    char* message = data;
+    const ushort* text = msg.utf16();
+    const int len = msg.size();
+    for(int i = 0; i < len; i++){
+        if(end - data < 4){
+            flags |= QTLOGR_SLOT_TRUNCATED;
+            break;
+        }
+        data = putUtf8(data, text, i, len);
+    }
+
+    slot->flags = flags;
+    slot->categoryLength = static_cast<quint16>(category_len);
+    slot->fileLength = static_cast<quint16>(file_len);
+    slot->messageLength = static_cast<quint16>(data - message);
+    slot->seq.store(2 * sequence + 2, std::memory_order_release);
+    producers_.fetch_sub(1);
+}
+
+/**
+ * @brief The LogBacktrace class
+ * @details 错误前日志回溯。低于 below_ 等级的日志渲染后不写入文件，只保存在当前线程最近N条的环形缓冲中；
+ * 同一线程出现 trigger_ 及以上等级的日志时，先把缓冲中的日志(same_category_时只限同一分类)按原顺序写入日志文件。
+ * 缓冲只在本线程访问，不加锁
+ */
+class LogBacktrace{
+public:
+    static void configure(LogSeverity below, LogSeverity trigger, int count, bool same_category);
+
+    /** 文本或结构化格式的日志，返回true表示已缓存，不再写入文件 */
+    static bool hold(LogSeverity severity, LogCategory *category, const QByteArray &message);
+
+    /** 二进制格式的日志 */
+    static bool hold(LogSeverity severity, LogCategory *category, LogCallSite *site, qint64 timestamp,
+                     quintptr thread, const QByteArray &payload);
+
+private:
+    struct Entry{
+        LogSeverity severity = QDEBUG;
+        /** 为空表示空槽或已写入 */
+        LogCategory* category = nullptr;
+        LogCallSite* site = nullptr;
+        qint64 timestamp = 0;
+        quintptr thread = 0;
+        QByteArray data;
+    };
+
+    struct Ring{
+        QVector<Entry> entries;
+        int next = 0;
+        int generation = -1;
+    };
+
+    static Entry* slot(LogSeverity severity, LogCategory *category);
+    static void replay(Ring &ring, LogCategory *category);
+
+    static std::atomic<int> below_;
+    static std::atomic<int> trigger_;
+    static std::atomic<int> count_;
+    static std::atomic<bool> same_category_;
+    /** 设置变化时递增，各线程下次写日志时按新设置重建缓冲 */
+    static std::atomic<int> generation_;
+};
+
+std::atomic<int> LogBacktrace::below_(QDEBUG);
+std::atomic<int> LogBacktrace::trigger_(QERROR);
+std::atomic<int> LogBacktrace::count_(64);
+std::atomic<bool> LogBacktrace::same_category_(false);
+std::atomic<int> LogBacktrace::generation_(0);
+
+void LogBacktrace::configure(LogSeverity below, LogSeverity trigger, int count, bool same_category)
+{
+    trigger = qBound(QINFO, trigger, QFATAL);
+    trigger_.store(trigger);
+    count_.store(qBound(1, count, 65536));
+    same_category_.store(same_category);
+    generation_.fetch_add(1);
+    below_.store(qBound(QDEBUG, below, trigger));
+}
+
+LogBacktrace::Entry* LogBacktrace::slot(LogSeverity severity, LogCategory *category)
+{
+    const int below = below_.load(std::memory_order_relaxed);
+    if(below <= QDEBUG)
+        return nullptr;
+
+    static thread_local Ring ring;
+    const int generation = generation_.load(std::memory_order_relaxed);
+    if(ring.generation != generation){
+        /** 预留容量，之后复用缓冲不再分配内存 */
+        ring.entries = QVector<Entry>(count_.load(std::memory_order_relaxed));
+        for(Entry &entry : ring.entries)
+            entry.data.reserve(256);
+        ring.next = 0;
+        ring.generation = generation;
     }
 
-    if(flush||(bytes_since_flush_ >= 1000000) ||
-            ( CycleClock_Now() >= next_flush_time_ ) ){
-        flushUnlocked();
+    if(severity < below){
+        Entry &entry = ring.entries[ring.next];
+        ring.next = (ring.next + 1) % ring.entries.size();
+        entry.severity = severity;
+        entry.category = category;
+        return &entry;
     }
+    if(severity >= trigger_.load(std::memory_order_relaxed))
+        replay(ring, category);
+    return nullptr;
 }
 
-void LogFileObject::flushUnlocked()
+void LogBacktrace::replay(Ring &ring, LogCategory *category)
 {
-    if(file_ != nullptr){
-        file_->flush();
-        bytes_since_flush_ = 0;
+    const bool same_category = same_category_.load(std::memory_order_relaxed);
+    const int size = ring.entries.size();
+    for(int i = 0; i < size; i++){
+        Entry &entry = ring.entries[(ring.next + i) % size];
+        if(!entry.category || (same_category && entry.category != category))
+            continue;
+
+        entry.category->count(entry.severity, static_cast<quint64>(entry.data.size()));
+        if(entry.site){
+            if(!LogAsyncWriter::enqueue(entry.severity, entry.site, entry.timestamp, entry.thread, entry.data, entry.category))
+                LogDestination::destination(entry.severity, entry.category)
+                        ->writeBinary(entry.site, entry.timestamp, entry.thread, entry.data);
+        }
+        else if(!LogAsyncWriter::enqueue(entry.severity, entry.data, entry.category)){
+            LogDestination::destination(entry.severity, entry.category)->write(entry.severity, entry.data);
+        }
+        entry.category = nullptr;
     }
+}
 
-    next_flush_time_ = QDateTime::currentDateTime().toSecsSinceEpoch() + logbufsecs;
+bool LogBacktrace::hold(LogSeverity severity, LogCategory *category, const QByteArray &message)
+{
+    Entry* entry = slot(severity, category);
+    if(!entry)
+        return false;
+    entry->site = nullptr;
+    entry->data.resize(0);
+    entry->data.append(message);
+    return true;
 }
 
-void LogFileObject::flush()
+bool LogBacktrace::hold(LogSeverity severity, LogCategory *category, LogCallSite *site, qint64 timestamp,
+                        quintptr thread, const QByteArray &payload)
 {
-    QMutexLocker locker(&mutex_);
-    flushUnlocked();
+    Entry* entry = slot(severity, category);
+    if(!entry)
+        return false;
+    entry->site = site;
+    entry->timestamp = timestamp;
+    entry->thread = thread;
+    entry->data.resize(0);
+    entry->data.append(payload);
+    return true;
 }
 
-bool LogFileObject::createLogfile(QString &base_filename){
-    QString base_filename_ = base_filename;
-    /** 分类模式，根据category增加目录 */
-    if(LogDestination::getCategoryMode()){
-        QList<QByteArray> categoryList = category_.split('.');
-        for(auto value : categoryList){
-            base_filename_.append(value).append("/");
-        }
-    }
-    /** 普通模式下增加日志分级目录 */
-    else{
-        base_filename_.append(LogSeverityNames[severity_]).append("/");
-    }
-    QDir basedir(base_filename_);
-    if(!basedir.exists()){
-        basedir.mkpath(base_filename_);
+#if defined(Q_OS_LINUX)
+/**
+ * @brief The LogCrashHandler class
+ * @details Linux崩溃处理，捕获SIGSEGV、SIGBUS、SIGABRT、SIGFPE。安装时预先打开dump目录并加载backtrace，
+ * 每个写日志的线程首次写日志时分配备用信号栈和最近消息缓冲区；信号处理函数只使用这些预先准备的资源，
+ * 不加锁、不分配内存，依次写出全部日志目标的缓存、崩溃线程最近的消息和调用栈
+ */
+class LogCrashHandler{
+public:
+    static void install();
 
-    }
-    QString base_datefilename;
+    /** 打开dump目录，未安装时忽略，dump目录变更后重新打开 */
+    static void setDirectory(const QString &path);
 
-    base_datefilename = base_filename_;
+    /** 记录当前线程最近的消息 */
+    static void remember(LogSeverity severity, const QString &msg);
 
-    // 程序PID
-#if defined (Q_OS_WIN)
-    QString pid = QString("%1.").arg(_getpid(),8,16,QLatin1Char('0')).toUpper();
-#elif defined (Q_OS_LINUX)
-    QString pid = QString("%1.").arg(getpid(),8,16,QLatin1Char('0')).toUpper();
-#endif
-    // 格式说明
-    base_datefilename
-            .append(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"))
-            .append(".")
-            .append(pid)
-            .append("log");
+    /** 由Application_CrashHandler调用，写出崩溃报告 */
+    static void report(int sig, siginfo_t *info);
 
-    file_ = new QFile(base_datefilename);
-    if(!file_->open(QIODevice::WriteOnly | QIODevice::Append)){
-        delete file_;
-        file_ = nullptr;
-        return false;
-    }
-    return true;
-}
+    /** 恢复安装前的信号处理 */
+    static void restore(int sig);
 
+private:
+    static const int kSignalCount = 4;
+    static const int kRecentCount = 16;
+    static const int kRecentText = 240;
+    static const size_t kStackSize = 64 * 1024;
+
+    struct Recent{
+        char hms[8];
+        quint16 msec;
+        quint8 severity;
+        quint8 used;
+        quint16 length;
+        char text[kRecentText];
+    };
+
+    struct Thread{
+        Recent entries[kRecentCount];
+        int next;
+        long tid;
+        void* stack;
+    };
+
+    /** 线程退出时释放备用信号栈和最近消息缓冲区 */
+    struct Owner{
+        ~Owner();
+    };
+
+    /** 崩溃报告的输出缓冲，在信号栈上使用 */
+    struct Text{
+        explicit Text(int fd):fd_(fd),used_(0){
+        }
+        ~Text(){
+            flush();
+        }
+        Text& operator<<(const char *text){
+            return append(text, static_cast<int>(strlen(text)));
+        }
+        Text& append(const char *text, int len){
+            while(len > 0){
+                if(used_ == static_cast<int>(sizeof(buffer_)))
+                    flush();
+                int count = qMin(len, static_cast<int>(sizeof(buffer_)) - used_);
+                memcpy(buffer_ + used_, text, static_cast<size_t>(count));
+                used_ += count;
+                text += count;
+                len -= count;
+            }
+            return *this;
+        }
+        Text& number(quint64 value, int base = 10, int width = 0){
+            char digits[24];
+            int count = 0;
+            do{
+                digits[count++] = "0123456789abcdef"[value % static_cast<quint64>(base)];
+                value /= static_cast<quint64>(base);
+            }while(value != 0 || count < width);
+            char text[24];
+            for(int i = 0; i < count; i++)
+                text[i] = digits[count - 1 - i];
+            return append(text, count);
+        }
+        void flush(){
+            CrashWrite(fd_, buffer_, used_);
+            used_ = 0;
+        }
 
-LogDestination::LogDestination(LogSeverity severity,QString &base_filename):fileobject_(severity,base_filename){
+    private:
+        int fd_;
+        int used_;
+        char buffer_[512];
+    };
+
+    static const char* signalName(int sig);
+
+    static const int signals_[kSignalCount];
+    static struct sigaction previous_[kSignalCount];
+    static std::atomic<bool> installed_;
+    static std::atomic<int> directory_;
+    /** 正在写报告的线程tid，0表示未崩溃 */
+    static std::atomic<int> reporting_;
+    static QMutex control_mutex_;
+    static thread_local Thread* thread_;
+};
 
-}
+const int LogCrashHandler::signals_[kSignalCount] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE};
+struct sigaction LogCrashHandler::previous_[kSignalCount];
+std::atomic<bool> LogCrashHandler::installed_(false);
+std::atomic<int> LogCrashHandler::directory_(-1);
+std::atomic<int> LogCrashHandler::reporting_(0);
+QMutex LogCrashHandler::control_mutex_;
+thread_local LogCrashHandler::Thread* LogCrashHandler::thread_ = nullptr;
 
-LogDestination::LogDestination(QByteArray category,QString &base_filename):fileobject_(category,base_filename)
+void LogCrashHandler::install()
 {
+    QMutexLocker locker(&control_mutex_);
+    if(installed_.load())
+        return;
 
+    /** backtrace首次调用时加载libgcc，可能分配内存，在这里预先调用一次 */
+    void* frames[2];
+    backtrace(frames, 2);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = Application_CrashHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for(int i = 0; i < kSignalCount; i++)
+        sigaction(signals_[i], &action, &previous_[i]);
+    installed_.store(true);
+    setDirectory(dump_path);
 }
 
-LogDestination::~LogDestination(){
-    for(int i=0;i<NUM_SEVERITIES;i++){
-        if(log_destinations_[i] != nullptr)
-            delete log_destinations_[i];
-        log_destinations_[i] = nullptr;
-    }
-    QMap<QByteArray,LogDestination*>::const_iterator i = log_destinations_map_.constBegin();
-    while (i != log_destinations_map_.constEnd()) {
-        delete log_destinations_map_[i.key()];
-        ++i;
-    }
-    log_destinations_map_.clear();
-
+void LogCrashHandler::setDirectory(const QString &path)
+{
+    if(!installed_.load())
+        return;
+    QString directory = path.isEmpty() ? QDir::currentPath() : path;
+    QDir().mkpath(directory);
+    int fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int previous = directory_.exchange(fd);
+    if(previous >= 0)
+        ::close(previous);
 }
 
-/** 普通模式目标地址存放 */
-LogDestination* LogDestination::log_destinations_[NUM_SEVERITIES];
+void LogCrashHandler::remember(LogSeverity severity, const QString &msg)
+{
+    if(!installed_.load(std::memory_order_relaxed))
+        return;
+
+    Thread* thread = thread_;
+    if(!thread){
+        static thread_local Owner owner;
+        Q_UNUSED(owner)
+        thread = new Thread();
+        thread->tid = syscall(SYS_gettid);
+
+        /** 栈溢出时信号处理函数在备用栈上运行 */
+        stack_t stack;
+        stack.ss_sp = malloc(kStackSize);
+        stack.ss_size = kStackSize;
+        stack.ss_flags = 0;
+        if(stack.ss_sp && sigaltstack(&stack, nullptr) == 0)
+            thread->stack = stack.ss_sp;
+        else
+            free(stack.ss_sp);
+        thread_ = thread;
+    }
 
-/** 分类模式根据category划分目标地址 */
-QMap<QByteArray,LogDestination*> LogDestination::log_destinations_map_;
+    Recent &entry = thread->entries[thread->next];
+    thread->next = (thread->next + 1) % kRecentCount;
 
-/** 默认为普通模式 */
-bool LogDestination::CategoryMode_ = false;
+    /** 写入过程中崩溃时信号处理函数跳过这一条 */
+    entry.used = 0;
+    std::atomic_signal_fence(std::memory_order_release);
 
-QString LogDestination::category_base_filename_;
+    LogClock::Snapshot now;
+    LogClock::now(&now);
+    memcpy(entry.hms, now.hms, sizeof(entry.hms));
+    entry.msec = static_cast<quint16>(now.msec);
+    entry.severity = static_cast<quint8>(severity);
 
-inline LogDestination* LogDestination::log_destinations(LogSeverity severity){
-    if(!log_destinations_[severity]){
-        QString null;
-        log_destinations_[severity] = new LogDestination(severity,null);
-    }
-    return log_destinations_[severity];
+    char* data = entry.text;
+    const ushort* text = msg.utf16();
+    const int len = msg.size();
+    for(int i = 0; i < len && entry.text + kRecentText - data >= 4; i++)
+        data = putUtf8(data, text, i, len);
+    entry.length = static_cast<quint16>(data - entry.text);
+
+    std::atomic_signal_fence(std::memory_order_release);
+    entry.used = 1;
 }
 
-LogDestination *LogDestination::log_destinations(QByteArray &category)
+LogCrashHandler::Owner::~Owner()
 {
-    if(!log_destinations_map_.contains(category)){
-        log_destinations_map_.insert(category,new LogDestination(category,category_base_filename_));
+    Thread* thread = thread_;
+    thread_ = nullptr;
+    if(!thread)
+        return;
+    if(thread->stack){
+        stack_t stack;
+        memset(&stack, 0, sizeof(stack));
+        stack.ss_flags = SS_DISABLE;
+        sigaltstack(&stack, nullptr);
+        free(thread->stack);
     }
-    return log_destinations_map_.value(category);
+    delete thread;
 }
 
-void LogDestination::setCategoryMode(bool mode)
+const char* LogCrashHandler::signalName(int sig)
 {
-    CategoryMode_ = mode;
-}
-
-void LogDestination::setLogDestination(LogSeverity severity, QString &pathdir){
-    log_destinations(severity)->fileobject_.setBasename(pathdir);
+    switch(sig){
+    case SIGSEGV: return "SIGSEGV";
+    case SIGBUS: return "SIGBUS";
+    case SIGABRT: return "SIGABRT";
+    case SIGFPE: return "SIGFPE";
+    default: return "signal";
+    }
 }
 
-void LogDestination::setLogDestination(QString &pathdir)
+void LogCrashHandler::report(int sig, siginfo_t *info)
 {
-    category_base_filename_ = pathdir;
-}
-
-
-void LogDestination::LogToAllLogfiles(LogSeverity severity, QByteArray &msg, QByteArray &category){
-    //    for(int i = severity; i >= 0; --i)
-    //        LogDestination::maybeLogToLogfile(i, msg, category);
-    LogDestination::maybeLogToLogfile(severity, msg, category);
-}
+    /**
+     * 多个线程同时崩溃时只由第一个线程写报告，其他线程在此等待报告线程重新发出信号结束进程，
+     * 不能返回后自行重新发出信号，否则进程在报告写完前就被终止。报告过程中本线程再次崩溃时直接返回
+     */
+    const int tid = static_cast<int>(syscall(SYS_gettid));
+    int reporter = 0;
+    if(!reporting_.compare_exchange_strong(reporter, tid)){
+        if(reporter == tid)
+            return;
+        for(;;)
+            pause();
+    }
 
-bool LogDestination::getCategoryMode()
-{
-    return CategoryMode_;
-}
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const long pid = static_cast<long>(getpid());
 
-void LogDestination::flushAllLogs()
-{
-    if(LogDestination::CategoryMode_){
-        /** 分类模式下遍历map,刷新缓存 */
-        QMap<QByteArray,LogDestination*>::const_iterator i = log_destinations_map_.constBegin();
-        while (i != log_destinations_map_.constEnd()) {
-            i.value()->fileobject_.flush();
-            ++i;
+    /** crash-<epoch秒>-<pid>.log，无法创建时写到标准错误 */
+    char name[64];
+    int len = 0;
+    {
+        const char prefix[] = "crash-";
+        memcpy(name, prefix, sizeof(prefix) - 1);
+        len = sizeof(prefix) - 1;
+        const quint64 values[2] = {static_cast<quint64>(now.tv_sec), static_cast<quint64>(pid)};
+        for(int i = 0; i < 2; i++){
+            char digits[24];
+            int count = 0;
+            quint64 value = values[i];
+            do{
+                digits[count++] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }while(value != 0);
+            while(count > 0)
+                name[len++] = digits[--count];
+            name[len++] = i == 0 ? '-' : '.';
         }
+        memcpy(name + len, "log", 4);
     }
-    else{
-        /** 普通模式遍历日志等级,刷新缓存 */
-        for(int i=0;i<5;i++){
-            if(log_destinations_[i]){
-                log_destinations_[i]->fileobject_.flush();
-            }
+    int directory = directory_.load();
+    int fd = directory >= 0 ? openat(directory, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    {
+        Text notice(STDERR_FILENO);
+        notice << "qtlog: fatal " << signalName(sig);
+        if(fd >= 0)
+            notice << ", refer to " << name;
+        notice << "\n";
+    }
+    if(fd < 0)
+        fd = STDERR_FILENO;
+
+    Text out(fd);
+    out << "Fatal " << signalName(sig) << " (" ;
+    out.number(static_cast<quint64>(sig)) << ")";
+    if(info && sig != SIGABRT){
+        out << " at 0x";
+        out.number(reinterpret_cast<quintptr>(info->si_addr), 16);
+    }
+    out << ", pid ";
+    out.number(static_cast<quint64>(pid)) << ", tid ";
+    out.number(static_cast<quint64>(syscall(SYS_gettid))) << ", time ";
+    out.number(static_cast<quint64>(now.tv_sec)) << ".";
+    out.number(static_cast<quint64>(now.tv_nsec / 1000000), 10, 3) << "\n";
+    out.flush();
+
+    /** 先写出日志缓存，后面的步骤即使再次崩溃也不影响已缓存的日志 */
+    LogDestination::crashFlushAll();
+
+    Thread* thread = thread_;
+    if(thread){
+        static const char severities[] = "DIWCF";
+        out << "\nRecent messages of the crashed thread:\n";
+        for(int i = 0; i < kRecentCount; i++){
+            const Recent &entry = thread->entries[(thread->next + i) % kRecentCount];
+            if(!entry.used)
+                continue;
+            out << "[";
+            out.append(&severities[qBound(0, static_cast<int>(entry.severity), NUM_SEVERITIES - 1)], 1) << " ";
+            out.append(entry.hms, sizeof(entry.hms)) << ".";
+            out.number(entry.msec, 10, 3) << "] ";
+            out.append(entry.text, entry.length) << "\n";
         }
     }
+
+    out << "\nBacktrace:\n";
+    out.flush();
+    void* frames[64];
+    int count = backtrace(frames, 64);
+    backtrace_symbols_fd(frames, count, fd);
+
+    if(fd != STDERR_FILENO){
+        fsync(fd);
+        ::close(fd);
+    }
 }
 
-inline void LogDestination::maybeLogToLogfile(LogSeverity severity,QByteArray &msg, QByteArray &category){
-    LogDestination* destination;
-    if(LogDestination::CategoryMode_)
-        destination = log_destinations(category);
-    else {
-        destination = log_destinations(severity);
+void LogCrashHandler::restore(int sig)
+{
+    for(int i = 0; i < kSignalCount; i++){
+        if(signals_[i] != sig)
+            continue;
+        /** 原来忽略该信号时恢复默认处理，否则硬件异常会反复触发 */
+        if(!(previous_[i].sa_flags & SA_SIGINFO) && previous_[i].sa_handler == SIG_IGN)
+            previous_[i].sa_handler = SIG_DFL;
+        sigaction(sig, &previous_[i], nullptr);
     }
-    destination->fileobject_.write(should_flush,msg);
 }
+#endif
 
 qtlog::qtlog()
 {
@@ -548,36 +6156,62 @@ qtlog::~qtlog(){
 
 }
 
-static void outputMessage(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+/**
+ * @brief FatalFlush
+ * @details fatal日志处理函数返回后Qt立即abort。先排空异步队列，保证之前的日志排在fatal日志前面，
+ * 再同步写入fatal日志，最后刷新全部日志目标(按设置同步到磁盘)，全部步骤在 fatal_flush_timeout 内完成，
+ * 超时的步骤跳过。message为空时写入二进制记录
+ */
+static void FatalFlush(LogDestination *destination, LogCallSite *site, qint64 timestamp, quintptr thread,
+                       const QByteArray &payload, LogSeverity severity, QByteArray *message)
 {
-    QByteArray category(context.category);
+    const qint64 timeout = fatal_flush_timeout;
+    const quint64 deadline = MonotonicNanos() + static_cast<quint64>(qMax<qint64>(timeout, 0)) * 1000000;
+    /** 不大于0时不等待异步队列，只写入fatal日志 */
+    if(timeout > 0 && !LogAsyncWriter::flushBefore(deadline))
+        fprintf(stderr, "qtlog: async queue not drained before fatal message\n");
+
+    if(message)
+        destination->write(severity, *message);
+    else
+        destination->writeBinary(site, timestamp, thread, payload);
+
+    if(timeout > 0){
+        int failed = LogDestination::flushAllBefore(deadline, fatal_flush_sync);
+        if(failed > 0)
+            fprintf(stderr, "qtlog: %d log files not flushed before fatal message\n", failed);
+    }
+}
 
-    LogSeverity severity;
-    switch(type)
-    {
-    case QtDebugMsg:
-        severity = 0;
-        break;
+static void outputMessage(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    LogCategory* category = LogCategoryIndex::lookup(context.category);
 
-    case QtInfoMsg:
-        severity = 1;
-        break;
+    LogSeverity severity = severityOf(type);
 
-    case QtWarningMsg:
-        severity = 2;
-        break;
+    /** 限流，被抑制的消息只计数，不打印也不写入 */
+    if(type != QtFatalMsg && !LogRateLimiter::allow(context, severity, category, msg))
+        return;
 
-    case QtCriticalMsg:
-        severity = 3;
-        break;
+    LogDestination* destination = LogDestination::destination(severity, category);
+    bool binary = destination->isBinary();
 
-    case QtFatalMsg:
-        severity = 4;
-        break;
+    /** 磁盘空间不足时先丢弃低等级日志，只读取LogRetention线程设置的标志 */
+    bool shed = severity < shed_severity.load(std::memory_order_relaxed) && type != QtFatalMsg;
 
-    }
+    /** 飞行记录器记录全部日志，低于文件等级的日志不再写入日志文件 */
+    LogFlightRecorder::record(severity, context, category, msg);
+#if defined(Q_OS_LINUX)
+    LogCrashHandler::remember(severity, msg);
+#endif
+    bool skip_file = severity < file_min_severity.load(std::memory_order_relaxed) && type != QtFatalMsg;
 
-    QByteArray message;
+    /** 按编译后的格式渲染一次，控制台和日志文件共用。二进制格式只在打印到控制台时渲染，
+     * 结构化格式的日志文件另行渲染，控制台仍输出文本格式 */
+    const int format = output_format;
+    QByteArray* message = nullptr;
+    if(is_to_console || (!binary && !shed && !skip_file && format == qtlog::OutputText))
+        message = &LogFormatter::render(type, context, msg);
 
     /** 打印到控制台 */
 
@@ -585,22 +6219,68 @@ static void outputMessage(QtMsgType type, const QMessageLogContext &context, con
         bool handledStderr = false;
 #if !defined(QT_BOOTSTRAPPED)
 #if defined(Q_OS_WIN)
-        handledStderr |= win_message_handler(type, context, msg);
+        handledStderr |= win_message_handler(*message);
 #elif defined(Q_OS_UNIX)
-        handledStderr |= unix_message_handler(type, context, msg);
+        handledStderr |= unix_message_handler(*message);
 # endif
 #endif
 
         if (!handledStderr)
-            stderr_message_handler(type, context, msg);
+            stderr_message_handler(*message);
+    }
+
+    if(shed){
+        shed_total.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    /** 网络日志只拷贝消息入队，只发送到网络时不再写入文件，fatal消息仍写入文件保证落盘 */
+    if((LogNetworkSink::forward(severity, context, category, msg) && type != QtFatalMsg) || skip_file){
+        category->count(severity, static_cast<quint64>(msg.size()));
+        return;
+    }
+
+    if(binary){
+        /** 二进制格式只记录调用点id、时间、线程和原始UTF-16消息，格式化推迟到解码工具 */
+        LogCallSite* site = LogCallSiteIndex::lookup(context, severity, category);
+        qint64 timestamp = LogClock::nowMSecs();
+        quintptr thread = reinterpret_cast<quintptr>(QThread::currentThread());
+        QByteArray payload = QByteArray::fromRawData(reinterpret_cast<const char*>(msg.utf16()), msg.size() * 2);
+
+        /** 回溯模式下低等级日志只缓存，错误日志先写出缓存 */
+        if(LogBacktrace::hold(severity, category, site, timestamp, thread, payload))
+            return;
+        category->count(severity, static_cast<quint64>(payload.size()));
+
+        if(type == QtFatalMsg){
+            FatalFlush(destination, site, timestamp, thread, payload, severity, nullptr);
+            return;
+        }
+        if(LogAsyncWriter::enqueue(severity,site,timestamp,thread,payload,category)){
+            return;
+        }
+
+        destination->writeBinary(site,timestamp,thread,payload);
+        return;
     }
 
-    QString str;
-    str = qFormatLogMessage(type,context,msg);
-    str.append("\n");
-    message = str.toLocal8Bit();
+    if(format != qtlog::OutputText)
+        message = &LogFormatter::renderRecord(type, context, msg, format);
 
-    LogDestination::LogToAllLogfiles(severity,message,category);
+    if(LogBacktrace::hold(severity, category, *message))
+        return;
+    category->count(severity, static_cast<quint64>(message->size()));
+
+    /** 异步模式下入队后立即返回，fatal消息需在程序终止前落盘，先排空队列再同步写入 */
+    if(type == QtFatalMsg){
+        FatalFlush(destination, nullptr, 0, 0, QByteArray(), severity, message);
+        return;
+    }
+    if(LogAsyncWriter::enqueue(severity,*message,category)){
+        return;
+    }
+
+    destination->write(severity, *message);
 
 }
 
@@ -623,11 +6303,18 @@ void qtlog::qInstallHandlers(){
     }
 
     qSetMessagePattern(pattern);
+    LogFormatter::compile(pattern);
 
     qInstallMessageHandler(outputMessage);
 
+    if(background_flush)
+        LogFlusher::enable();
+    LogRetention::enable();
+
 #ifdef Q_OS_WIN
     SetUnhandledExceptionFilter(reinterpret_cast<LPTOP_LEVEL_EXCEPTION_FILTER>(Application_CrashHandler)); //注冊异常捕获函数
+#elif defined(Q_OS_LINUX)
+    LogCrashHandler::install();
 #endif
 
 }
@@ -656,6 +6343,7 @@ void qtlog::setqtLogMaxSize(quint32 size)
 void qtlog::setqtLogbuffsecs(qint64 secs)
 {
     logbufsecs = secs;
+    LogFlusher::wakeUp();
 }
 
 void qtlog::setqtLogCategoryMode(bool mode)
@@ -668,6 +6356,12 @@ void qtlog::setqtLogShouldflush(bool flush)
     should_flush = flush;
 }
 
+void qtlog::setqtLogFatalFlush(qint64 msecs, bool sync)
+{
+    fatal_flush_timeout = msecs;
+    fatal_flush_sync = sync;
+}
+
 void qtlog::setqtLogFileLine(bool fileline)
 {
     fileLine = fileline;
@@ -676,11 +6370,35 @@ void qtlog::setqtLogFileLine(bool fileline)
 void qtlog::setdumpPath(QString path)
 {
     dump_path = path;
+#if defined(Q_OS_LINUX)
+    LogCrashHandler::setDirectory(path);
+#endif
 }
 
 void qtlog::flushqtLogNow()
 {
-    LogDestination::flushAllLogs();
+    /** 异步模式下由写线程排空队列后刷新 */
+    if(!LogAsyncWriter::flush())
+        LogDestination::flushAllLogs();
+}
+
+void qtlog::setAsyncOverflowPolicy(LogSeverity severity, qtlog::OverflowPolicy policy)
+{
+    LogAsyncWriter::setOverflowPolicy(severity, policy);
+}
+
+void qtlog::setAsyncOverflowDropBelow(LogSeverity severity)
+{
+    for(int i = 0; i < NUM_SEVERITIES; i++)
+        LogAsyncWriter::setOverflowPolicy(i, i < severity ? OverflowDropNewest : OverflowBlock);
+}
+
+void qtlog::setAsyncMode(bool async, quint32 capacity)
+{
+    if(async)
+        LogAsyncWriter::enable(capacity);
+    else
+        LogAsyncWriter::disable();
 }
 
 void qtlog::setPrintToConsole(bool isPrint)
@@ -688,6 +6406,148 @@ void qtlog::setPrintToConsole(bool isPrint)
     is_to_console = isPrint;
 }
 
+void qtlog::setqtLogFileBackend(qtlog::FileBackend backend)
+{
+    file_backend = backend;
+}
+
+void qtlog::setqtLogMmapChunkSize(quint32 size)
+{
+    mmap_chunk_size = size;
+}
+
+void qtlog::setqtLogMmapSyncMode(bool sync)
+{
+    mmap_sync_flush = sync;
+}
+
+void qtlog::setqtLogBinary(LogSeverity severity, bool binary)
+{
+    LogDestination::setBinary(severity, binary);
+}
+
+void qtlog::setqtLogBinary(const QByteArray &category, bool binary)
+{
+    LogDestination::setBinary(category, binary);
+}
+
+void qtlog::setqtLogCompression(qtlog::Compression compression, int level)
+{
+    compression_mode = compression;
+    compression_level = level;
+}
+
+void qtlog::setqtLogCompressionThreads(int threads)
+{
+    LogCompressor::setThreads(threads);
+}
+
+void qtlog::setqtLogCompressionIoPriority(int priority)
+{
+    compression_io_priority = priority;
+}
+
+void qtlog::setqtLogDurability(LogSeverity severity, qtlog::Durability durability, bool wait)
+{
+    LogDestination::setDurability(severity, durability, wait);
+}
+
+void qtlog::setqtLogDurability(const QByteArray &category, qtlog::Durability durability, bool wait)
+{
+    LogDestination::setDurability(category, durability, wait);
+}
+
+void qtlog::setqtLogBackgroundFlush(bool enable)
+{
+    background_flush = enable;
+    if(enable)
+        LogFlusher::enable();
+    else
+        LogFlusher::disable();
+}
+
+qtlog::Stats qtlog::stats()
+{
+    Stats stats;
+    stats.timestamp = LogClock::nowMSecs();
+    LogDestination::collectStats(stats);
+    LogAsyncWriter::queueStats(stats.queueDepth, stats.queueCapacity);
+    stats.shed = shed_total.load(std::memory_order_relaxed);
+    stats.deletedFiles = retention_deleted.load(std::memory_order_relaxed);
+    stats.networkSent = network_sent.load(std::memory_order_relaxed);
+    stats.networkDropped = network_dropped.load(std::memory_order_relaxed);
+    stats.networkFallback = network_fallback.load(std::memory_order_relaxed);
+    stats.rateLimited = LogRateLimiter::suppressedTotal();
+    return stats;
+}
+
+void qtlog::setqtLogRetention(qint64 maxBytes, int maxFiles, qint64 maxAgeSecs)
+{
+    retention_max_bytes = maxBytes;
+    retention_max_files = maxFiles;
+    retention_max_age = maxAgeSecs;
+    LogRetention::requestScan();
+}
+
+void qtlog::setqtLogMinFreeSpace(qint64 bytes)
+{
+    min_free_space = bytes;
+}
+
+void qtlog::setqtLogTimeIndex(bool enable)
+{
+    time_index = enable;
+}
+
+void qtlog::setqtLogBlockFormat(bool enable, int blockSize, bool compress)
+{
+    block_size = blockSize;
+    block_compress = compress;
+    block_framing = enable;
+}
+
+void qtlog::setqtLogOutputFormat(OutputFormat format)
+{
+    output_format = format;
+}
+
+void qtlog::setqtLogNetworkSink(NetworkTransport transport, const QString &address, quint16 port,
+                                LogSeverity minSeverity, bool toFiles)
+{
+    LogNetworkSink::enable(transport, address, port, minSeverity, toFiles);
+}
+
+void qtlog::setqtLogNetworkSpillSize(qint64 bytes)
+{
+    network_spill_limit = bytes;
+}
+
+void qtlog::setqtLogRateLimit(qtlog::RateLimitKey key, double perSecond, int burst, int sampleEvery,
+                              bool collapseDuplicates, LogSeverity maxSeverity)
+{
+    LogRateLimiter::configure(key, perSecond, burst, sampleEvery, collapseDuplicates, maxSeverity);
+}
+
+void qtlog::setqtLogBacktrace(LogSeverity below, LogSeverity trigger, int count, bool sameCategory)
+{
+    LogBacktrace::configure(below, trigger, count, sameCategory);
+}
+
+bool qtlog::setqtLogFlightRecorder(const QString &name, qint64 bytes, LogSeverity fileSeverity, int slotSize)
+{
+    if(name.isEmpty()){
+        LogFlightRecorder::close();
+        file_min_severity.store(QDEBUG);
+        return true;
+    }
+    if(!LogFlightRecorder::open(name, bytes, slotSize)){
+        file_min_severity.store(QDEBUG);
+        return false;
+    }
+    file_min_severity.store(fileSeverity);
+    return true;
+}
+
 
 #ifdef Q_OS_WIN
 LONG Application_CrashHandler(EXCEPTION_POINTERS *pException){
@@ -725,5 +6585,12 @@ LONG Application_CrashHandler(EXCEPTION_POINTERS *pException){
     return EXCEPTION_EXECUTE_HANDLER;
 }
 #elif defined(Q_OS_LINUX)
+void Application_CrashHandler(int signal, siginfo_t *info, void *context){
+    Q_UNUSED(context)
+    LogCrashHandler::report(signal, info);
 
+    //恢复原来的处理并重新发出信号，保留core dump和进程退出状态
+    LogCrashHandler::restore(signal);
+    raise(signal);
+}
 #endif
@@ -10,6 +10,7 @@
 #include <QThread>
 #include <QTextStream>
 #include <QDate>
+#include <QVector>
 #include <time.h>
 
 #ifdef _WIN32
@@ -19,6 +20,10 @@
 LONG Application_CrashHandler(EXCEPTION_POINTERS *pException);
 #else
 #include <unistd.h>
+#ifdef __linux__
+#include <signal.h>
+void Application_CrashHandler(int signal, siginfo_t *info, void *context);
+#endif
 #endif
 
 typedef int LogSeverity;
@@ -44,6 +49,119 @@ typedef int LogSeverity;
 class qtlog
 {
 public:
+    /** 异步模式下队列满时的处理策略 */
+    enum OverflowPolicy{
+        OverflowBlock,          ///< 阻塞等待写线程腾出空间，日志不丢失
+        OverflowDropNewest,     ///< 丢弃当前消息
+        OverflowDropOldest      ///< 丢弃队列中最旧的消息，当前消息入队
+    };
+
+    /** 日志文件写入后端 */
+    enum FileBackend{
+        FileBackendQFile,       ///< QFile写入，默认
+        FileBackendMmap,        ///< 内存映射写入，仅Linux支持，其他平台使用QFile
+        FileBackendWritev       ///< O_APPEND文件描述符批量writev写入，仅Linux支持，其他平台使用QFile
+    };
+
+    /** 切换后旧日志文件的压缩方式 */
+    enum Compression{
+        CompressionNone,        ///< 不压缩，默认
+        CompressionGzip,        ///< gzip压缩，生成.gz文件
+        CompressionZstd         ///< zstd压缩，生成.zst文件，需以 CONFIG += qtlog_zstd 编译，否则使用gzip
+    };
+
+    /** 日志文件持久化级别 */
+    enum Durability{
+        DurabilityNone,         ///< 按1M字节或logbufsecs间隔提交到系统
+        DurabilityFlush,        ///< 每条日志提交到系统(flush)，进程崩溃不丢失，掉电可能丢失
+        DurabilityDataSync      ///< 每条日志落盘(fdatasync)，并发写入共享一次同步(组提交)
+    };
+
+    /** 文本日志文件的输出格式 */
+    enum OutputFormat{
+        OutputText,             ///< qInstallHandlers设置的文本格式，默认
+        OutputJson,             ///< 每条日志一行JSON对象(JSON Lines)
+        OutputLogfmt            ///< 每条日志一行key=value
+    };
+
+    /** 网络日志的传输方式 */
+    enum NetworkTransport{
+        NetworkNone,            ///< 关闭网络日志，默认
+        NetworkUdp,             ///< UDP，每条日志一个报文(RFC5426)
+        NetworkTcp,             ///< TCP，octet-counting分帧(RFC6587)
+        NetworkUnix             ///< Unix域套接字(如/dev/log)，优先数据报，对端为流式套接字时按TCP方式分帧
+    };
+
+    /** 限流的计数对象 */
+    enum RateLimitKey{
+        RateLimitNone,          ///< 不限流，默认
+        RateLimitCallSite,      ///< 按调用点(文件、行号、函数、等级、分类)
+        RateLimitCategory       ///< 按分类
+    };
+
+    /** 延迟直方图桶数量 */
+    enum { LatencyBuckets = 32 };
+
+    /**
+     * @brief The LatencyHistogram struct
+     * @details 延迟直方图，第i个桶统计耗时在[2^i, 2^(i+1))纳秒的次数，第0个桶包含0，最后一个桶包含更大的值
+     */
+    struct LatencyHistogram{
+        quint64 buckets[LatencyBuckets] = {};
+        quint64 count = 0;
+        quint64 totalNs = 0;
+        quint64 maxNs = 0;
+    };
+
+    /** 单个分类的统计 */
+    struct CategoryStats{
+        QByteArray name;
+        /** 各等级消息数 */
+        quint64 messages[NUM_SEVERITIES] = {};
+        /** 格式化后(二进制格式为原始内容)的消息字节数 */
+        quint64 bytes = 0;
+        /** 异步模式队列满时丢弃的消息数 */
+        quint64 dropped = 0;
+        /** 分类模式下该分类写入文件的字节数和文件切换次数，普通模式下为0 */
+        quint64 bytesWritten = 0;
+        quint64 rotations = 0;
+    };
+
+    /**
+     * @brief The Stats struct
+     * @details 运行统计快照，计数器自启动起累计，两次快照相减除以timestamp差值即为速率
+     */
+    struct Stats{
+        /** 快照时间，epoch毫秒 */
+        qint64 timestamp = 0;
+        /** 各等级消息数和消息字节数 */
+        quint64 messages[NUM_SEVERITIES] = {};
+        quint64 bytes = 0;
+        quint64 dropped = 0;
+        /** 写入日志文件(含文件头)的字节数和文件切换次数 */
+        quint64 bytesWritten = 0;
+        quint64 rotations = 0;
+        /** 写入日志文件失败(如磁盘已满)而丢失的记录数 */
+        quint64 writeFailures = 0;
+        /** 单次写入文件和flush的耗时 */
+        LatencyHistogram writeLatency;
+        LatencyHistogram flushLatency;
+        /** 异步模式队列当前深度和容量，未开启异步模式时为0 */
+        quint32 queueDepth = 0;
+        quint32 queueCapacity = 0;
+        /** 磁盘空间不足时未写入文件的消息数 */
+        quint64 shed = 0;
+        /** 超出保留限制被删除的旧日志文件数 */
+        quint64 deletedFiles = 0;
+        /** 网络日志已发送的消息数，未能发送而丢弃的消息数(同时写文件时)，未能发送而写入日志文件的消息数 */
+        quint64 networkSent = 0;
+        quint64 networkDropped = 0;
+        quint64 networkFallback = 0;
+        /** 被限流抑制的消息数 */
+        quint64 rateLimited = 0;
+        QVector<CategoryStats> categories;
+    };
+
     /** 注册输出接口函数 */
     static void qInstallHandlers();
 
@@ -85,9 +203,9 @@ public:
      * @brief setqtLogbuffsecs
      * @param secs
      * @details 文件flush到本地间隔时间设置
-     * @note 功能全局设置，设置后所有写操作都按此设置进行操作。注意此处时间间隔判断方法采用上一次写入时间点
-     * 和最新一次日志信息之间时间差做判断，可能存在有数据一直不flush到本地的情况。可调用 @see flushqtLogNow()
-     * 立即flush数据到本地
+     * @note 功能全局设置，设置后所有写操作都按此设置进行操作。写入时按上一次flush时间点判断，
+     * 另有后台刷新线程每隔secs刷新有未flush数据的日志文件，停止写入的日志也会在secs内flush到本地，
+     * @see setqtLogBackgroundFlush 。可调用 @see flushqtLogNow() 立即flush数据到本地
      */
     static void setqtLogbuffsecs(qint64 secs);
 
@@ -106,6 +224,17 @@ public:
      */
     static void setqtLogShouldflush(bool flush);
 
+    /**
+     * @brief setqtLogFatalFlush
+     * @param msecs
+     * @param sync
+     * @details fatal日志处理。qFatal返回后程序立即终止，写入fatal日志前先排空异步队列，写入后刷新全部日志文件，
+     * sync为true时同时fdatasync，全部步骤在msecs毫秒内完成，超时的文件跳过。默认2000毫秒、不同步；
+     * msecs不大于0时只写入fatal日志所在文件
+     * @note 开启后不必为了fatal前的日志落盘而设置 @see setqtLogShouldflush
+     */
+    static void setqtLogFatalFlush(qint64 msecs, bool sync = false);
+
     /**
      * @brief setqtLogFileLine
      * @param rich
@@ -128,6 +257,243 @@ public:
     /** 是否打印到控制台 */
     static void setPrintToConsole(bool isPrint);
 
+    /**
+     * @brief setAsyncMode
+     * @param async
+     * @param capacity
+     * @details 异步写入模式设置，开启后日志消息格式化后写入无锁队列，由后台写线程统一写入日志文件，
+     * 调用线程不再等待文件锁和磁盘IO。capacity为队列容量(条)，向上取整为2的幂，默认8192
+     * @note 队列满时调用线程等待写线程腾出空间。关闭异步模式、调用 @see flushqtLogNow() 以及程序退出时队列中的日志都会写完
+     */
+    static void setAsyncMode(bool async, quint32 capacity = 8192);
+
+    /**
+     * @brief setAsyncOverflowPolicy
+     * @param severity
+     * @param policy
+     * @details 异步模式下队列满时指定日志等级的处理策略，默认全部为 OverflowBlock。
+     * 丢弃的消息按分类计数，并定期以"N messages dropped"提示写入对应日志文件
+     */
+    static void setAsyncOverflowPolicy(LogSeverity severity, OverflowPolicy policy);
+
+    /**
+     * @brief setAsyncOverflowDropBelow
+     * @param severity
+     * @details 队列满时低于severity等级的消息直接丢弃，severity及以上等级阻塞等待，保证警告和错误不丢失
+     */
+    static void setAsyncOverflowDropBelow(LogSeverity severity);
+
+    /**
+     * @brief setqtLogFileBackend
+     * @param backend
+     * @details 日志文件写入后端设置，下一次创建日志文件时生效。
+     * FileBackendMmap 按块预分配并映射日志文件，追加日志直接拷贝到映射区，减少系统调用和QFile缓存拷贝。
+     * FileBackendWritev 日志暂存在缓冲块中，达到flush条件(1M字节、logbufsecs或显式flush)时一次writev提交
+     */
+    static void setqtLogFileBackend(FileBackend backend);
+
+    /**
+     * @brief setqtLogMmapChunkSize
+     * @param size
+     * @details 内存映射后端每次预分配和映射的大小，单位为M，默认为8M
+     */
+    static void setqtLogMmapChunkSize(quint32 size);
+
+    /**
+     * @brief setqtLogMmapSyncMode
+     * @param sync
+     * @details 内存映射后端flush方式，true为msync同步等待写入磁盘，false为异步提交，默认为false
+     */
+    static void setqtLogMmapSyncMode(bool sync);
+
+    /**
+     * @brief setqtLogBinary
+     * @param severity
+     * @param binary
+     * @details 普通模式下severity等级日志以二进制格式写入(.logb文件)。消息只记录调用点id、时间、线程和
+     * 原始UTF-16内容，文件名、函数名、分类等调用点信息每个文件只写一次，写入时不做格式化和编码转换。
+     * 使用 tools/qtlog-decode 还原为文本日志
+     * @note 下一次写入时切换文件格式，控制台输出不受影响
+     */
+    static void setqtLogBinary(LogSeverity severity, bool binary);
+
+    /**
+     * @brief setqtLogBinary
+     * @param category
+     * @param binary
+     * @details 分类模式下category分类日志以二进制格式写入 @see setqtLogBinary(LogSeverity,bool)
+     */
+    static void setqtLogBinary(const QByteArray &category, bool binary);
+
+    /**
+     * @brief setqtLogCompression
+     * @param compression
+     * @param level 压缩级别，gzip为1-9，zstd为1-19，-1使用默认级别
+     * @details 日志文件切换(超过大小或跨天)后，由后台低优先级线程池压缩关闭的旧文件，压缩完成后删除原文件
+     */
+    static void setqtLogCompression(Compression compression, int level = -1);
+
+    /**
+     * @brief setqtLogCompressionThreads
+     * @param threads
+     * @details 同时压缩的最大文件数，默认为1
+     */
+    static void setqtLogCompressionThreads(int threads);
+
+    /**
+     * @brief setqtLogCompressionIoPriority
+     * @param priority
+     * @details 压缩线程的IO优先级，-1为空闲级(仅在磁盘空闲时读写)，0-7为best-effort级别(7最低)，默认为-1。
+     * 压缩线程同时以最低CPU优先级运行，不与业务线程和日志写线程竞争。Linux使用ioprio，Windows使用后台模式
+     */
+    static void setqtLogCompressionIoPriority(int priority);
+
+    /**
+     * @brief setqtLogDurability
+     * @param severity
+     * @param durability
+     * @param wait
+     * @details 普通模式下severity等级日志文件的持久化级别，未设置时按 @see setqtLogShouldflush 为None或Flush。
+     * DurabilityDataSync下同时写入同一文件的线程共享一次fdatasync；wait为true时写入线程等待本条记录落盘后返回，
+     * 为false时只发起同步，由后台刷新线程执行(未开启后台刷新时仍由写入线程同步)，调用 @see flushqtLogNow() 可等待全部落盘
+     * @note 异步模式下由写线程执行同步，业务线程不等待
+     */
+    static void setqtLogDurability(LogSeverity severity, Durability durability, bool wait = true);
+
+    /**
+     * @brief setqtLogDurability
+     * @param category
+     * @param durability
+     * @param wait
+     * @details 分类模式下category分类日志文件的持久化级别 @see setqtLogDurability(LogSeverity,Durability,bool)
+     */
+    static void setqtLogDurability(const QByteArray &category, Durability durability, bool wait = true);
+
+    /**
+     * @brief setqtLogBackgroundFlush
+     * @param enable
+     * @details 后台刷新线程开关，默认开启，在 @see qInstallHandlers 时启动。
+     * 刷新线程按 @see setqtLogbuffsecs 间隔唤醒，只刷新有未flush数据的日志文件
+     */
+    static void setqtLogBackgroundFlush(bool enable);
+
+    /**
+     * @brief stats
+     * @return 运行统计快照
+     * @details 返回各分类、各等级的消息数和字节数，写入字节数，文件切换次数，写入和flush耗时直方图以及异步队列深度。
+     * 计数器按线程分片累加，不增加写日志路径上的锁竞争，可定期调用接入监控系统
+     */
+    static Stats stats();
+
+    /**
+     * @brief setqtLogRetention
+     * @param maxBytes 每个日志目录下日志文件(包括压缩后的旧文件)总大小上限，0不限制
+     * @param maxFiles 每个日志目录下日志文件数量上限，0不限制
+     * @param maxAgeSecs 日志文件最长保留秒数，0不限制
+     * @details 普通模式下按等级目录、分类模式下按分类目录分别计算。文件切换后及每分钟由后台线程检查，
+     * 超出限制时从旧到新删除，正在写入的文件不会删除
+     */
+    static void setqtLogRetention(qint64 maxBytes, int maxFiles = 0, qint64 maxAgeSecs = 0);
+
+    /**
+     * @brief setqtLogMinFreeSpace
+     * @param bytes
+     * @details 日志所在磁盘可用空间低于bytes时不再写入debug和info日志，低于1/2时不再写入warning，
+     * 低于1/4时只写入fatal，控制台输出不受影响。后台线程每秒检查一次可用空间，写日志路径只读取标志。
+     * 默认0不开启；无论是否设置，可用空间不足4M时停止写入日志文件，空间恢复后继续写入
+     */
+    static void setqtLogMinFreeSpace(qint64 bytes);
+
+    /**
+     * @brief setqtLogTimeIndex
+     * @param enable
+     * @details 时间索引开关，默认开启。每个日志文件旁生成同名 .idx 索引文件，随日志写入按秒或64K字节记录时间到文件偏移的对应，
+     * tools/qtlog-query 据此直接定位时间范围，不需要从头扫描日志文件。只影响之后新建的日志文件
+     */
+    static void setqtLogTimeIndex(bool enable);
+
+    /**
+     * @brief setqtLogBlockFormat
+     * @param enable
+     * @param blockSize 块大小，块内记录达到该大小或flush时封装写入
+     * @param compress 每块单独zlib压缩，压缩后不小于原始内容时按原样存储
+     * @details 分块格式开关，默认关闭。开启后日志文件(.logf)按块封装，块头记录首末条时间、记录数、等级位图和CRC32C校验，
+     * 读取时可按时间二分定位块、跳过不需要的等级，程序崩溃留下的不完整末块校验失败后停止，读取见 qtlogblockreader。
+     * 文本和二进制格式均可分块，分块文件不再生成时间索引，也不进行整体压缩
+     */
+    static void setqtLogBlockFormat(bool enable, int blockSize = 64 * 1024, bool compress = false);
+
+    /**
+     * @brief setqtLogOutputFormat
+     * @param format
+     * @details 日志文件输出格式，默认文本格式。JSON和logfmt格式每条日志一行，包含time、pid、thread、severity、category、
+     * file、line、function、message字段，消息中的引号、反斜杠和换行等控制字符转义，编码固定为UTF-8。
+     * 调用位置只在Qt提供时输出(调试版本或定义QT_MESSAGELOGCONTEXT)。控制台和二进制格式日志不受影响，
+     * 当前文件格式与设置不一致时切换新文件
+     */
+    static void setqtLogOutputFormat(OutputFormat format);
+
+    /**
+     * @brief setqtLogNetworkSink
+     * @param transport 传输方式，NetworkNone关闭
+     * @param address 主机名或IP地址，Unix域套接字为路径
+     * @param port UDP/TCP端口
+     * @param minSeverity 发送到网络的最低日志等级
+     * @param toFiles true时日志同时写入日志文件；false时只发送到网络，无法发送的日志写入日志文件
+     * @details 网络日志，按RFC5424 syslog格式发送到日志收集器，仅Linux支持。日志由后台线程成批发送，
+     * 连接断开后按指数退避重连，期间日志暂存在内存中，超过 setqtLogNetworkSpillSize 的最旧日志按toFiles丢弃或写入日志文件。
+     * 重复调用时替换之前的设置
+     */
+    static void setqtLogNetworkSink(NetworkTransport transport, const QString &address, quint16 port = 514,
+                                    LogSeverity minSeverity = QDEBUG, bool toFiles = true);
+
+    /**
+     * @brief setqtLogNetworkSpillSize
+     * @param bytes
+     * @details 网络日志暂存区上限，默认4M
+     */
+    static void setqtLogNetworkSpillSize(qint64 bytes);
+
+    /**
+     * @brief setqtLogFlightRecorder
+     * @param name 共享内存名称，如"/myapp-log"，为空时关闭
+     * @param bytes 缓冲区大小，按槽位数为2的幂向下取整
+     * @param fileSeverity 写入日志文件的最低等级，低于该等级的日志只记录在共享内存中
+     * @param slotSize 每条日志占用的槽位大小，超出部分截断
+     * @return 共享内存创建失败时返回false，仅Linux支持
+     * @details 飞行记录器，每条日志写入shm_open创建的共享内存环形缓冲区，写入不加锁、不经过磁盘，
+     * 用 tools/qtlog-ring 实时跟踪或在程序退出、崩溃后读取。例如fileSeverity为QWARING时，
+     * 内存中保留完整的debug历史，日志文件只写入warning及以上。程序退出时不删除共享内存，由qtlog-ring --unlink删除
+     */
+    static bool setqtLogFlightRecorder(const QString &name, qint64 bytes = 16 * 1024 * 1024,
+                                       LogSeverity fileSeverity = QDEBUG, int slotSize = 512);
+
+    /**
+     * @brief setqtLogRateLimit
+     * @param key 按调用点或分类计数，RateLimitNone关闭
+     * @param perSecond 每秒允许的消息数，不大于0时不限速
+     * @param burst 允许的突发条数
+     * @param sampleEvery 每N条只保留一条，1为不采样
+     * @param collapseDuplicates 与同一调用点(分类)上一条完全相同的消息合并
+     * @param maxSeverity 高于该等级的日志不限流，fatal日志始终不限流
+     * @details 日志限流。被抑制的消息不打印也不写入文件，只计数；该调用点(分类)下一条消息通过时，
+     * 或后台刷新线程定期检查时，写入"suppressed N similar messages"提示。判断不加锁，只用原子操作
+     */
+    static void setqtLogRateLimit(RateLimitKey key, double perSecond, int burst = 1, int sampleEvery = 1,
+                                  bool collapseDuplicates = false, LogSeverity maxSeverity = QERROR);
+
+    /**
+     * @brief setqtLogBacktrace
+     * @param below 低于该等级的日志只缓存在内存中，为QDEBUG时关闭
+     * @param trigger 触发写出缓存的等级
+     * @param count 每个线程缓存的日志条数
+     * @param sameCategory 为true时只写出与触发日志同一分类的缓存
+     * @details 错误前日志回溯。低于below等级的日志不写入日志文件，只保存在各线程最近count条的内存缓冲中；
+     * 同一线程写入trigger及以上等级的日志时，先将缓冲中的日志按原顺序写入日志文件，再写入该日志。
+     * 未被触发的缓存日志不写入文件
+     */
+    static void setqtLogBacktrace(LogSeverity below, LogSeverity trigger = QERROR, int count = 64, bool sameCategory = false);
+
 
 private:
     explicit qtlog();
@@ -1,5 +1,17 @@
 win32:LIBS += -lDbgHelp -luser32
 
+# 旧日志文件gzip压缩，Windows下使用Qt自带的zlib
+unix:LIBS += -lz
+
+# 飞行记录器shm_open，glibc 2.34之前位于librt
+linux:LIBS += -lrt
+
+# 可选zstd压缩支持：CONFIG += qtlog_zstd
+qtlog_zstd {
+    DEFINES += QTLOG_HAVE_ZSTD
+    LIBS += -lzstd
+}
+
 # 支持release模式下，行号等信息导出
 DEFINES += QT_MESSAGELOGCONTEXT
 QMAKE_CXXFLAGS_RELEASE = $$QMAKE_CFLAGS_RELEASE_WITH_DEBUGINFO
@@ -9,10 +21,15 @@ INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
 HEADERS += \
-    $$PWD/qtlog.h
+    $$PWD/qtlog.h \
+    $$PWD/qtlogformat.h \
+    $$PWD/qtlogcrc32c.h \
+    $$PWD/qtlogring.h \
+    $$PWD/qtlogblockreader.h
 
 SOURCES += \
-    $$PWD/qtlog.cpp
+    $$PWD/qtlog.cpp \
+    $$PWD/qtlogblockreader.cpp
 
 #CONFIG +=console
 
@@ -0,0 +1,91 @@
+﻿#ifndef QTLOGBLOCKREADER_H
+#define QTLOGBLOCKREADER_H
+
+#include <QFile>
+#include <QString>
+#include "qtlogformat.h"
+
+/**
+ * @brief The qtlogblockreader class
+ * @details 分块格式日志文件(.logf)读取，格式见 qtlogformat.h。
+ * 按块顺序读取或跳过，按时间二分定位，校验失败时通过同步标记重新定位；
+ * 块内容为文本日志行或可独立解码的二进制日志记录。可读取正在写入的文件，调用refresh读取新写入的块
+ */
+class qtlogblockreader
+{
+public:
+    /** 读取结果 */
+    enum Status{
+        StatusOk,           ///< 读取到一个完整的块
+        StatusEnd,          ///< 已到文件末尾
+        StatusTornTail,     ///< 文件末尾的块不完整或校验失败，通常为程序崩溃时正在写入的块
+        StatusCorrupt       ///< 文件中间的块校验失败，可调用 resync 跳过
+    };
+
+    struct Block{
+        /** 块头在文件中的偏移 */
+        qint64 offset = -1;
+        qtlogformat::BlockHeader header;
+        /** 解压后的块内容，只读块头时为空 */
+        QByteArray data;
+    };
+
+    qtlogblockreader();
+    ~qtlogblockreader();
+
+    bool open(const QString &path);
+    void close();
+    QString errorString() const;
+
+    /** 块内容为二进制日志记录 */
+    bool isBinary() const;
+    int blockSize() const;
+    bool isCompressed() const;
+
+    /** 文本或二进制日志的文件头(第一块的内容) */
+    QByteArray fileHeader() const;
+
+    /**
+     * @brief next
+     * @param block
+     * @param data 为false时只读取块头，不校验和解压内容，用于按时间或等级跳过
+     * @details 读取当前位置的块并移到下一块，返回值不为StatusOk时位置不变
+     */
+    Status next(Block &block, bool data = true);
+
+    /** 定位到第一个末条记录时间不早于timestamp的块，之后next从该块开始，没有这样的块时返回false */
+    bool seek(qint64 timestamp);
+
+    /** 从offset开始查找下一个同步标记和校验均有效的块，找到时定位到该块 */
+    bool resync(qint64 offset);
+
+    qint64 position() const;
+    void setPosition(qint64 offset);
+
+    /** 重新映射文件，读取正在写入的文件新增的块 */
+    bool refresh();
+
+private:
+    bool map();
+    void unmap();
+    Status check(qint64 offset, qtlogformat::BlockHeader &header, bool verify) const;
+    bool load(qint64 offset, const qtlogformat::BlockHeader &header, QByteArray &data) const;
+    qint64 find(qint64 from, qint64 limit, qtlogformat::BlockHeader &header) const;
+
+    QFile file_;
+    QString error_;
+    const char* data_;
+    qint64 size_;
+    uchar* mapped_;
+    QByteArray buffer_;
+
+    int block_size_;
+    bool binary_;
+    bool compressed_;
+    QByteArray file_header_;
+    /** 第一个日志块的偏移 */
+    qint64 first_block_;
+    qint64 pos_;
+};
+
+#endif // QTLOGBLOCKREADER_H
@@ -0,0 +1,266 @@
+﻿#include "qtlogblockreader.h"
+#include "qtlogcrc32c.h"
+#include <string.h>
+
+#if defined(Q_OS_WIN)
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+
+qtlogblockreader::qtlogblockreader():
+    data_(nullptr),size_(0),mapped_(nullptr),block_size_(0),binary_(false),compressed_(false),
+    first_block_(0),pos_(0)
+{
+}
+
+qtlogblockreader::~qtlogblockreader()
+{
+    close();
+}
+
+bool qtlogblockreader::open(const QString &path)
+{
+    close();
+    file_.setFileName(path);
+    if(!file_.open(QIODevice::ReadOnly)){
+        error_ = file_.errorString();
+        return false;
+    }
+    if(!map())
+        return false;
+
+    const char* pos = data_;
+    const char* end = data_ + size_;
+    if(size_ < QTLOGF_HEADER_SIZE || memcmp(pos, QTLOGF_MAGIC, QTLOGF_MAGIC_SIZE) != 0){
+        error_ = QString("%1 is not a qtlog block format log").arg(path);
+        close();
+        return false;
+    }
+    pos += QTLOGF_MAGIC_SIZE;
+    quint64 block_size, format, compression, reserved;
+    qtlogformat::readFixed(pos, end, block_size, 4);
+    qtlogformat::readFixed(pos, end, format, 1);
+    qtlogformat::readFixed(pos, end, compression, 1);
+    qtlogformat::readFixed(pos, end, reserved, 2);
+    block_size_ = static_cast<int>(block_size);
+    binary_ = format == QTLOGF_FORMAT_BINARY;
+    compressed_ = compression != QTLOGF_COMPRESSION_NONE;
+
+    /** 第一块为文本或二进制日志的文件头 */
+    qtlogformat::BlockHeader header;
+    if(check(QTLOGF_HEADER_SIZE, header, true) != StatusOk || !load(QTLOGF_HEADER_SIZE, header, file_header_)){
+        error_ = QString("%1: missing or corrupt file header block").arg(path);
+        close();
+        return false;
+    }
+    first_block_ = QTLOGF_HEADER_SIZE + QTLOGF_BLOCK_HEADER_SIZE + header.storedLength;
+    pos_ = first_block_;
+    return true;
+}
+
+void qtlogblockreader::close()
+{
+    unmap();
+    if(file_.isOpen())
+        file_.close();
+    file_header_.clear();
+    first_block_ = pos_ = 0;
+}
+
+QString qtlogblockreader::errorString() const
+{
+    return error_;
+}
+
+bool qtlogblockreader::isBinary() const
+{
+    return binary_;
+}
+
+int qtlogblockreader::blockSize() const
+{
+    return block_size_;
+}
+
+bool qtlogblockreader::isCompressed() const
+{
+    return compressed_;
+}
+
+QByteArray qtlogblockreader::fileHeader() const
+{
+    return file_header_;
+}
+
+qint64 qtlogblockreader::position() const
+{
+    return pos_;
+}
+
+void qtlogblockreader::setPosition(qint64 offset)
+{
+    pos_ = qBound(first_block_, offset, size_);
+}
+
+bool qtlogblockreader::refresh()
+{
+    unmap();
+    return map();
+}
+
+bool qtlogblockreader::map()
+{
+    /** 优先映射文件，映射失败(如32位系统上的大文件)时整体读入 */
+    size_ = file_.size();
+    mapped_ = size_ > 0 ? file_.map(0, size_) : nullptr;
+    if(mapped_){
+        data_ = reinterpret_cast<const char*>(mapped_);
+        return true;
+    }
+    file_.seek(0);
+    buffer_ = file_.readAll();
+    data_ = buffer_.constData();
+    size_ = buffer_.size();
+    return true;
+}
+
+void qtlogblockreader::unmap()
+{
+    if(mapped_)
+        file_.unmap(mapped_);
+    mapped_ = nullptr;
+    buffer_.clear();
+    data_ = nullptr;
+    size_ = 0;
+}
+
+qtlogblockreader::Status qtlogblockreader::check(qint64 offset, qtlogformat::BlockHeader &header, bool verify) const
+{
+    if(offset >= size_)
+        return StatusEnd;
+
+    const char* pos = data_ + offset;
+    const char* end = data_ + size_;
+    if(!qtlogformat::readBlockHeader(pos, end, header)){
+        /** mmap后端正在写入的文件末尾为预分配的0 */
+        quint32 marker = 0;
+        memcpy(&marker, pos, static_cast<size_t>(qMin<qint64>(4, end - pos)));
+        if(marker == 0)
+            return StatusEnd;
+        return end - pos < QTLOGF_BLOCK_HEADER_SIZE ? StatusTornTail : StatusCorrupt;
+    }
+
+    qint64 block_end = offset + QTLOGF_BLOCK_HEADER_SIZE + header.storedLength;
+    if(block_end > size_)
+        return StatusTornTail;
+    if(!verify)
+        return StatusOk;
+
+    quint32 crc = qtlogcrc32c::compute(0, pos, QTLOGF_BLOCK_HEADER_SIZE - 4);
+    crc = qtlogcrc32c::compute(crc, pos + QTLOGF_BLOCK_HEADER_SIZE, header.storedLength);
+    if(crc == header.crc)
+        return StatusOk;
+
+    /** 最后一块校验失败视为崩溃时未写完的块 */
+    quint32 marker = 0;
+    if(size_ - block_end >= 4)
+        memcpy(&marker, data_ + block_end, 4);
+    return marker == 0 ? StatusTornTail : StatusCorrupt;
+}
+
+bool qtlogblockreader::load(qint64 offset, const qtlogformat::BlockHeader &header, QByteArray &data) const
+{
+    const char* stored = data_ + offset + QTLOGF_BLOCK_HEADER_SIZE;
+    if(!(header.flags & QTLOGF_BLOCK_COMPRESSED)){
+        data = QByteArray(stored, static_cast<int>(header.storedLength));
+        return true;
+    }
+
+    data.resize(static_cast<int>(header.rawLength));
+    uLongf length = header.rawLength;
+    if(uncompress(reinterpret_cast<Bytef*>(data.data()), &length,
+                  reinterpret_cast<const Bytef*>(stored), header.storedLength) != Z_OK || length != header.rawLength){
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
+qtlogblockreader::Status qtlogblockreader::next(Block &block, bool data)
+{
+    Status status = check(pos_, block.header, data);
+    if(status != StatusOk)
+        return status;
+
+    block.offset = pos_;
+    block.data.clear();
+    if(data && !load(pos_, block.header, block.data))
+        return StatusCorrupt;
+    pos_ += QTLOGF_BLOCK_HEADER_SIZE + block.header.storedLength;
+    return StatusOk;
+}
+
+qint64 qtlogblockreader::find(qint64 from, qint64 limit, qtlogformat::BlockHeader &header) const
+{
+    /** 同步标记按小端存储 */
+    char marker[4];
+    for(int i = 0; i < 4; i++)
+        marker[i] = static_cast<char>((QTLOGF_SYNC >> (8 * i)) & 0xff);
+
+    qint64 pos = qMax(from, first_block_);
+    limit = qMin(limit, size_);
+    while(pos < limit){
+        const char* hit = static_cast<const char*>(memchr(data_ + pos, marker[0], static_cast<size_t>(limit - pos)));
+        if(!hit)
+            break;
+        pos = hit - data_;
+        if(size_ - pos >= 4 && memcmp(hit, marker, 4) == 0 && check(pos, header, true) == StatusOk)
+            return pos;
+        pos++;
+    }
+    return -1;
+}
+
+bool qtlogblockreader::resync(qint64 offset)
+{
+    qtlogformat::BlockHeader header;
+    qint64 pos = find(offset, size_, header);
+    if(pos < 0)
+        return false;
+    pos_ = pos;
+    return true;
+}
+
+bool qtlogblockreader::seek(qint64 timestamp)
+{
+    qtlogformat::BlockHeader header;
+
+    /** 块时间按写入顺序递增，二分缩小范围后顺序读取块头 */
+    qint64 low = first_block_;
+    qint64 high = size_;
+    qint64 window = 4 * static_cast<qint64>(qMax(block_size_, 1024) + QTLOGF_BLOCK_HEADER_SIZE);
+    while(high - low > window){
+        qint64 middle = low + (high - low) / 2;
+        qint64 pos = find(middle, high, header);
+        if(pos < 0 || header.lastTimestamp >= timestamp)
+            high = middle;
+        else
+            low = pos + QTLOGF_BLOCK_HEADER_SIZE + header.storedLength;
+    }
+
+    qint64 pos = find(low, size_, header);
+    while(pos >= 0){
+        if(header.lastTimestamp >= timestamp){
+            pos_ = pos;
+            return true;
+        }
+        qint64 next = pos + QTLOGF_BLOCK_HEADER_SIZE + header.storedLength;
+        if(check(next, header, false) == StatusOk)
+            pos = next;
+        else
+            pos = find(next, size_, header);
+    }
+    pos_ = size_;
+    return false;
+}
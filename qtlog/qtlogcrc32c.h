@@ -0,0 +1,139 @@
+﻿#ifndef QTLOGCRC32C_H
+#define QTLOGCRC32C_H
+
+#include <QtGlobal>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define QTLOG_CRC32C_X86
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+#define QTLOG_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+#if defined(QTLOG_CRC32C_X86) && (defined(__GNUC__) || defined(__clang__))
+#define QTLOG_CRC32C_TARGET __attribute__((target("sse4.2")))
+#else
+#define QTLOG_CRC32C_TARGET
+#endif
+
+/**
+ * @brief The qtlogcrc32c class
+ * @details CRC32C(Castagnoli)校验，分块日志格式写入和读取共用。
+ * x86下运行时检测SSE4.2使用crc32指令，ARM下编译器开启CRC扩展时使用__crc32c指令，否则按8字节查表计算
+ */
+class qtlogcrc32c
+{
+public:
+    /** crc为之前数据的校验值，首次计算传0 */
+    static inline quint32 compute(quint32 crc, const char *data, size_t len){
+#if defined(QTLOG_CRC32C_X86)
+        if(hasSse42())
+            return computeSse42(crc, data, len);
+#elif defined(QTLOG_CRC32C_ARM)
+        return computeArm(crc, data, len);
+#endif
+        return computeTable(crc, data, len);
+    }
+
+    /** 查表实现，用于校验硬件实现 */
+    static inline quint32 computeTable(quint32 crc, const char *data, size_t len){
+        const quint32 (*table)[256] = tables();
+        const uchar* p = reinterpret_cast<const uchar*>(data);
+        crc = ~crc;
+        while(len >= 8){
+            quint32 low = crc ^ (quint32(p[0]) | quint32(p[1]) << 8 | quint32(p[2]) << 16 | quint32(p[3]) << 24);
+            crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+                    ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+            p += 8;
+            len -= 8;
+        }
+        while(len--)
+            crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+private:
+    explicit qtlogcrc32c();
+
+    /** 反射多项式0x82F63B78的8张查表，首次使用时生成 */
+    static inline const quint32 (*tables())[256]{
+        struct Tables{
+            quint32 table[8][256];
+            Tables(){
+                for(quint32 i = 0; i < 256; i++){
+                    quint32 crc = i;
+                    for(int bit = 0; bit < 8; bit++)
+                        crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+                    table[0][i] = crc;
+                }
+                for(quint32 i = 0; i < 256; i++){
+                    for(int t = 1; t < 8; t++)
+                        table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+                }
+            }
+        };
+        static const Tables tables;
+        return tables.table;
+    }
+
+#if defined(QTLOG_CRC32C_X86)
+    static inline bool hasSse42(){
+#if defined(_MSC_VER)
+        static const bool supported = [](){
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 20)) != 0;
+        }();
+#else
+        static const bool supported = __builtin_cpu_supports("sse4.2");
+#endif
+        return supported;
+    }
+
+    static inline QTLOG_CRC32C_TARGET quint32 computeSse42(quint32 crc, const char *data, size_t len){
+        crc = ~crc;
+#if defined(__x86_64__) || defined(_M_X64)
+        quint64 crc64 = crc;
+        while(len >= 8){
+            quint64 value;
+            memcpy(&value, data, 8);
+            crc64 = _mm_crc32_u64(crc64, value);
+            data += 8;
+            len -= 8;
+        }
+        crc = static_cast<quint32>(crc64);
+#endif
+        while(len >= 4){
+            quint32 value;
+            memcpy(&value, data, 4);
+            crc = _mm_crc32_u32(crc, value);
+            data += 4;
+            len -= 4;
+        }
+        while(len--)
+            crc = _mm_crc32_u8(crc, static_cast<uchar>(*data++));
+        return ~crc;
+    }
+#elif defined(QTLOG_CRC32C_ARM)
+    static inline quint32 computeArm(quint32 crc, const char *data, size_t len){
+        crc = ~crc;
+        while(len >= 8){
+            quint64 value;
+            memcpy(&value, data, 8);
+            crc = __crc32cd(crc, value);
+            data += 8;
+            len -= 8;
+        }
+        while(len--)
+            crc = __crc32cb(crc, static_cast<uchar>(*data++));
+        return ~crc;
+    }
+#endif
+};
+
+#endif // QTLOGCRC32C_H
@@ -0,0 +1,268 @@
+﻿#ifndef QTLOGFORMAT_H
+#define QTLOGFORMAT_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QtGlobal>
+#include <string.h>
+
+/**
+ * 二进制日志文件格式，整数均为小端
+ *
+ * 文件头:
+ *   magic "QTLOGB02"(8字节) | u64 创建时间(epoch毫秒) | u64 pid | u32 flags | str 主机名
+ * 记录:
+ *   'S' 调用点定义: varint id | u8 severity | varint line | str file | str function | str category
+ *   'T' 线程定义:   varint 线程编号 | varint 线程指针
+ *   'M' 日志消息:   varint 调用点id | zigzag varint 与上一条记录的时间差(毫秒) | varint 线程编号 |
+ *                   u8 编码(0 UTF-16LE, 1 UTF-8) | str 消息内容
+ * str为 varint 长度加字节内容。调用点和线程定义在每个文件中只写一次，位于首次引用它的消息之前。
+ * 调用点id从1开始，id为0的消息是qtlog内部生成的完整文本行(如异步丢弃提示)，解码时原样输出。
+ * 线程编号从1开始，0表示无线程。消息内容写入UTF-8。
+ * 旧版本 "QTLOGB01" 没有线程定义，消息中直接记录线程指针，消息内容为UTF-16LE，解码工具仍可读取
+ */
+#define QTLOGB_MAGIC            "QTLOGB02"
+#define QTLOGB_MAGIC_V1         "QTLOGB01"
+#define QTLOGB_MAGIC_SIZE       8
+
+#define QTLOGB_RECORD_SITE      'S'
+#define QTLOGB_RECORD_THREAD    'T'
+#define QTLOGB_RECORD_MESSAGE   'M'
+
+#define QTLOGB_SITE_RAW         0       ///< 预格式化文本行
+
+#define QTLOGB_ENCODING_UTF16   0
+#define QTLOGB_ENCODING_UTF8    1
+
+/** 文件头flags，解码时按写入时的格式还原文本行 */
+#define QTLOGB_FLAG_FILELINE    0x1     ///< 文本行包含 file:line
+#define QTLOGB_FLAG_CATEGORY    0x2     ///< 文本行包含 category: 前缀(普通模式)
+
+/** 二进制日志文件扩展名 */
+#define QTLOGB_SUFFIX           "logb"
+
+/**
+ * 时间索引文件，与日志文件同名加 .idx 后缀，随日志文件增长追加写入
+ *
+ *   magic "QTLOGI01"(8字节) | 索引项...
+ * 索引项(24字节):
+ *   u64 时间(epoch毫秒) | u64 日志文件偏移 | u64 二进制日志在该偏移处的时间基准
+ * 时间进入新的一秒或距上一索引项超过64K字节时追加一项，偏移处为一条日志记录的开始，
+ * 之后的记录时间不早于该项时间(异步模式下可能有少量乱序，查询时多读一项)。
+ * 二进制日志在每个索引点之后重新写入调用点定义，从索引点开始即可独立解码，时间差以时间基准为起点
+ */
+#define QTLOGI_MAGIC            "QTLOGI01"
+#define QTLOGI_MAGIC_SIZE       8
+#define QTLOGI_ENTRY_SIZE       24
+#define QTLOGI_BUCKET_MSECS     1000
+#define QTLOGI_BUCKET_BYTES     (64 * 1024)
+
+/** 索引文件扩展名，追加在日志文件名之后 */
+#define QTLOGI_SUFFIX           ".idx"
+
+/**
+ * 分块日志文件，文本或二进制日志的字节流按块封装，每块可单独校验、解压和解码
+ *
+ * 文件头(16字节):
+ *   magic "QTLOGF01"(8字节) | u32 块大小 | u8 内容格式(0文本, 1二进制) | u8 压缩方式(0不压缩, 1 zlib) | u16 保留
+ * 块头(48字节):
+ *   u32 同步标记 | u32 存储长度 | u32 原始长度 | u32 记录数 | u64 首条记录时间 | u64 末条记录时间 |
+ *   u64 二进制日志时间基准 | u8 等级位图 | u8 flags | u16 保留 | u32 CRC32C(块头前44字节和存储内容)
+ * 第一块为文本或二进制日志的文件头。块内记录达到块大小、flush或切换文件时封装写入，记录不跨块。
+ * 二进制日志每块重新写入调用点定义，时间差以块头时间基准为起点，任一块均可独立解码。
+ * 读取时按同步标记和CRC定位块，程序崩溃导致的不完整末块校验失败后停止
+ */
+#define QTLOGF_MAGIC            "QTLOGF01"
+#define QTLOGF_MAGIC_SIZE       8
+#define QTLOGF_HEADER_SIZE      16
+#define QTLOGF_BLOCK_HEADER_SIZE 48
+#define QTLOGF_SYNC             0xB10C4C51u
+
+#define QTLOGF_FORMAT_TEXT      0
+#define QTLOGF_FORMAT_BINARY    1
+
+#define QTLOGF_COMPRESSION_NONE 0
+#define QTLOGF_COMPRESSION_ZLIB 1
+
+/** 块flags */
+#define QTLOGF_BLOCK_COMPRESSED 0x1
+
+/** 分块日志文件扩展名 */
+#define QTLOGF_SUFFIX           "logf"
+
+/**
+ * @brief The qtlogformat class
+ * @details 二进制日志格式编解码工具函数，qtlog写入和qtlog-decode解码共用
+ */
+class qtlogformat
+{
+public:
+    static inline void appendVarint(QByteArray &out, quint64 value){
+        char buf[10];
+        int len = 0;
+        while(value >= 0x80){
+            buf[len++] = static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        buf[len++] = static_cast<char>(value);
+        out.append(buf, len);
+    }
+
+    static inline void appendZigzag(QByteArray &out, qint64 value){
+        appendVarint(out, (static_cast<quint64>(value) << 1) ^ static_cast<quint64>(value >> 63));
+    }
+
+    static inline void appendFixed(QByteArray &out, quint64 value, int bytes){
+        char buf[8];
+        for(int i = 0; i < bytes; i++)
+            buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+        out.append(buf, bytes);
+    }
+
+    static inline void appendString(QByteArray &out, const char *data, int len){
+        appendVarint(out, static_cast<quint64>(len));
+        out.append(data, len);
+    }
+
+    /** 读取失败(数据不完整)时返回false，pos不变 */
+    static inline bool readVarint(const char *&pos, const char *end, quint64 &value){
+        const char *p = pos;
+        quint64 result = 0;
+        for(int shift = 0; shift < 64 && p < end; shift += 7){
+            uchar byte = static_cast<uchar>(*p++);
+            result |= static_cast<quint64>(byte & 0x7f) << shift;
+            if(!(byte & 0x80)){
+                value = result;
+                pos = p;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static inline bool readZigzag(const char *&pos, const char *end, qint64 &value){
+        quint64 raw;
+        if(!readVarint(pos, end, raw))
+            return false;
+        value = static_cast<qint64>(raw >> 1) ^ -static_cast<qint64>(raw & 1);
+        return true;
+    }
+
+    static inline bool readFixed(const char *&pos, const char *end, quint64 &value, int bytes){
+        if(end - pos < bytes)
+            return false;
+        value = 0;
+        for(int i = 0; i < bytes; i++)
+            value |= static_cast<quint64>(static_cast<uchar>(pos[i])) << (8 * i);
+        pos += bytes;
+        return true;
+    }
+
+    static inline bool readString(const char *&pos, const char *end, QByteArray &value){
+        const char *p = pos;
+        quint64 len;
+        if(!readVarint(p, end, len) || static_cast<quint64>(end - p) < len)
+            return false;
+        value = QByteArray(p, static_cast<int>(len));
+        pos = p + len;
+        return true;
+    }
+
+    struct IndexEntry{
+        qint64 timestamp;
+        qint64 offset;
+        qint64 base;
+    };
+
+    static inline void appendIndexEntry(QByteArray &out, const IndexEntry &entry){
+        appendFixed(out, static_cast<quint64>(entry.timestamp), 8);
+        appendFixed(out, static_cast<quint64>(entry.offset), 8);
+        appendFixed(out, static_cast<quint64>(entry.base), 8);
+    }
+
+    /** 读取索引文件内容中的全部完整索引项，格式错误时返回false */
+    static inline bool readIndex(const QByteArray &data, QVector<IndexEntry> &entries){
+        if(data.size() < QTLOGI_MAGIC_SIZE || memcmp(data.constData(), QTLOGI_MAGIC, QTLOGI_MAGIC_SIZE) != 0)
+            return false;
+        const char *pos = data.constData() + QTLOGI_MAGIC_SIZE;
+        const char *end = data.constData() + data.size();
+        /** 正在写入的索引文件最后一项可能不完整 */
+        while(end - pos >= QTLOGI_ENTRY_SIZE){
+            quint64 timestamp, offset, base;
+            readFixed(pos, end, timestamp, 8);
+            readFixed(pos, end, offset, 8);
+            readFixed(pos, end, base, 8);
+            IndexEntry entry = {static_cast<qint64>(timestamp), static_cast<qint64>(offset), static_cast<qint64>(base)};
+            entries.append(entry);
+        }
+        return true;
+    }
+
+    struct BlockHeader{
+        quint32 storedLength;
+        quint32 rawLength;
+        quint32 records;
+        qint64 firstTimestamp;
+        qint64 lastTimestamp;
+        qint64 base;
+        quint8 severities;
+        quint8 flags;
+        quint32 crc;
+    };
+
+    /** 写入48字节块头，crc由调用者在前44字节和存储内容上计算后填入 */
+    static inline void appendBlockHeader(QByteArray &out, const BlockHeader &header){
+        appendFixed(out, QTLOGF_SYNC, 4);
+        appendFixed(out, header.storedLength, 4);
+        appendFixed(out, header.rawLength, 4);
+        appendFixed(out, header.records, 4);
+        appendFixed(out, static_cast<quint64>(header.firstTimestamp), 8);
+        appendFixed(out, static_cast<quint64>(header.lastTimestamp), 8);
+        appendFixed(out, static_cast<quint64>(header.base), 8);
+        appendFixed(out, header.severities, 1);
+        appendFixed(out, header.flags, 1);
+        appendFixed(out, 0, 2);
+        appendFixed(out, header.crc, 4);
+    }
+
+    /** 块头写入调用方提供的缓冲区，不分配内存，崩溃处理时使用 */
+    static inline void writeBlockHeader(char *out, const BlockHeader &header){
+        const quint64 value[11] = {QTLOGF_SYNC, header.storedLength, header.rawLength, header.records,
+                                   static_cast<quint64>(header.firstTimestamp), static_cast<quint64>(header.lastTimestamp),
+                                   static_cast<quint64>(header.base), header.severities, header.flags, 0, header.crc};
+        static const int sizes[11] = {4, 4, 4, 4, 8, 8, 8, 1, 1, 2, 4};
+        for(int i = 0; i < 11; i++){
+            for(int k = 0; k < sizes[i]; k++)
+                *out++ = static_cast<char>((value[i] >> (8 * k)) & 0xff);
+        }
+    }
+
+    /** 读取块头，同步标记不匹配或数据不足时返回false */
+    static inline bool readBlockHeader(const char *pos, const char *end, BlockHeader &header){
+        if(end - pos < QTLOGF_BLOCK_HEADER_SIZE)
+            return false;
+        quint64 value[10];
+        static const int sizes[10] = {4, 4, 4, 4, 8, 8, 8, 1, 1, 2};
+        for(int i = 0; i < 10; i++)
+            readFixed(pos, end, value[i], sizes[i]);
+        if(value[0] != QTLOGF_SYNC)
+            return false;
+        header.storedLength = static_cast<quint32>(value[1]);
+        header.rawLength = static_cast<quint32>(value[2]);
+        header.records = static_cast<quint32>(value[3]);
+        header.firstTimestamp = static_cast<qint64>(value[4]);
+        header.lastTimestamp = static_cast<qint64>(value[5]);
+        header.base = static_cast<qint64>(value[6]);
+        header.severities = static_cast<quint8>(value[7]);
+        header.flags = static_cast<quint8>(value[8]);
+        quint64 crc;
+        readFixed(pos, end, crc, 4);
+        header.crc = static_cast<quint32>(crc);
+        return true;
+    }
+
+private:
+    explicit qtlogformat();
+};
+
+#endif // QTLOGFORMAT_H
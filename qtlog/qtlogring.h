@@ -0,0 +1,124 @@
+﻿#ifndef QTLOGRING_H
+#define QTLOGRING_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <string.h>
+
+/**
+ * 共享内存飞行记录环形缓冲区，qtlog写入，qtlog-ring等外部进程读取，整数为本机字节序
+ *
+ * 布局:
+ *   头部(128字节) | 槽位 * slotCount
+ * 头部:
+ *   magic "QTLOGR01"(8字节) | u32 版本 | u32 槽位大小 | u32 槽位数(2的幂) | u32 写入进程pid |
+ *   i64 创建时间(epoch毫秒) | u32 flags | u32 closed | u64 lost(未能写入的记录数) | ... | 偏移64: u64 head(下一个记录序号)
+ * 槽位:
+ *   u64 seq | i64 时间(epoch毫秒) | u64 线程指针 | u8 等级 | u8 flags | u16 分类长度 | u16 文件名长度 |
+ *   u16 消息长度 | u32 行号 | u32 保留 | 分类 | 文件名 | 消息(UTF-8)
+ *
+ * 写入协议：生产者对head原子加1取得序号n，写入槽位 n & (slotCount - 1)：
+ * 先以CAS将seq从之前某一圈的完成值(偶数且小于 2n+1，首次为0)置为 2n+1(写入中)，写入内容后以release语义将seq置为 2n+2(完成)。
+ * seq为奇数(上一圈的写入者还未写完)或大于 2n+1(已被更快的下一圈写入者占用)时该记录放弃写入，lost加1，读取方按未写完处理。
+ * 读取序号n时先读seq，等于 2n+2 才拷贝内容，拷贝后再次读取seq，两次一致说明内容未被覆盖。
+ * seq小于 2n+2 表示尚未写完(写入进程在写入中退出时保持奇数)，大于 2n+2 表示已被后续记录覆盖
+ */
+#define QTLOGR_MAGIC            "QTLOGR01"
+#define QTLOGR_MAGIC_SIZE       8
+#define QTLOGR_VERSION          1
+#define QTLOGR_HEADER_SIZE      128
+#define QTLOGR_SLOT_HEADER_SIZE 40
+
+/** 头部flags，读取工具按写入时的格式还原文本行 */
+#define QTLOGR_FLAG_FILELINE    0x1     ///< 文本行包含 file:line
+#define QTLOGR_FLAG_CATEGORY    0x2     ///< 文本行包含 category: 前缀(普通模式)
+
+/** 槽位flags */
+#define QTLOGR_SLOT_TRUNCATED   0x1     ///< 内容超过槽位大小被截断
+
+struct QtlogRingHeader{
+    char magic[QTLOGR_MAGIC_SIZE];
+    quint32 version;
+    quint32 slotSize;
+    quint32 slotCount;
+    quint32 pid;
+    qint64 created;
+    quint32 flags;
+    /** 写入进程正常关闭时置1 */
+    std::atomic<quint32> closed;
+    /** 槽位被占用而放弃写入的记录数 */
+    std::atomic<quint64> lost;
+    char reserved[64 - 48];
+    /** 单独占用缓存行，生产者争用时不影响其他字段的读取 */
+    std::atomic<quint64> head;
+    char reserved2[QTLOGR_HEADER_SIZE - 72];
+};
+
+struct QtlogRingSlot{
+    std::atomic<quint64> seq;
+    qint64 timestamp;
+    quint64 thread;
+    quint8 severity;
+    quint8 flags;
+    quint16 categoryLength;
+    quint16 fileLength;
+    quint16 messageLength;
+    quint32 line;
+    quint32 reserved;
+};
+
+static_assert(sizeof(QtlogRingHeader) == QTLOGR_HEADER_SIZE, "ring header layout");
+static_assert(sizeof(QtlogRingSlot) == QTLOGR_SLOT_HEADER_SIZE, "ring slot layout");
+
+class qtlogring
+{
+public:
+    /** 读取结果 */
+    enum Status{
+        StatusOk,               ///< 读取成功
+        StatusPending,          ///< 尚未写完
+        StatusOverwritten       ///< 已被后续记录覆盖
+    };
+
+    static inline QtlogRingSlot* slot(QtlogRingHeader *header, quint64 sequence){
+        char* base = reinterpret_cast<char*>(header) + QTLOGR_HEADER_SIZE;
+        return reinterpret_cast<QtlogRingSlot*>(base + (sequence & (header->slotCount - 1)) * header->slotSize);
+    }
+
+    static inline bool isValid(const QtlogRingHeader *header, qint64 size){
+        if(size < QTLOGR_HEADER_SIZE || memcmp(header->magic, QTLOGR_MAGIC, QTLOGR_MAGIC_SIZE) != 0 ||
+                header->version != QTLOGR_VERSION || header->slotSize <= QTLOGR_SLOT_HEADER_SIZE ||
+                header->slotCount == 0 || (header->slotCount & (header->slotCount - 1)) != 0)
+            return false;
+        return QTLOGR_HEADER_SIZE + static_cast<qint64>(header->slotSize) * header->slotCount <= size;
+    }
+
+    /**
+     * @brief read
+     * @details 按序号读取一个槽位，成功时copy为槽位内容(头部加数据)，至少slotSize字节
+     */
+    static inline Status read(QtlogRingHeader *header, quint64 sequence, char *copy){
+        QtlogRingSlot* target = slot(header, sequence);
+        const quint64 done = 2 * sequence + 2;
+        quint64 before = target->seq.load(std::memory_order_acquire);
+        if(before != done)
+            return before < done ? StatusPending : StatusOverwritten;
+        memcpy(copy, reinterpret_cast<const char*>(target), header->slotSize);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        quint64 after = target->seq.load(std::memory_order_relaxed);
+        if(after != done)
+            return StatusOverwritten;
+
+        /** 长度字段来自另一进程，越界时按覆盖处理 */
+        const QtlogRingSlot* record = reinterpret_cast<const QtlogRingSlot*>(copy);
+        if(QTLOGR_SLOT_HEADER_SIZE + static_cast<quint32>(record->categoryLength) + record->fileLength +
+                record->messageLength > header->slotSize)
+            return StatusOverwritten;
+        return StatusOk;
+    }
+
+private:
+    explicit qtlogring();
+};
+
+#endif // QTLOGRING_H
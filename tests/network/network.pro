@@ -0,0 +1,12 @@
+QT -= gui
+QT += testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_network
+
+SOURCES += \
+        tst_network.cpp
+
+include(../../qtlog/qtlog.pri)
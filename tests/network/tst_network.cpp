@@ -0,0 +1,326 @@
+﻿#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+#include <QtTest>
+#include "qtlog.h"
+
+#ifdef Q_OS_LINUX
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/**
+ * tst_network
+ * 网络日志检查(仅Linux)：在本地监听Unix域数据报和TCP端口，检查每条消息的RFC5424格式、
+ * octet-counting分帧和顺序；再关闭TCP监听一段时间后重新监听，检查断开期间暂存的日志在退避重连后送达
+ */
+
+Q_LOGGING_CATEGORY(networkCategory, "tests.network")
+
+#ifdef Q_OS_LINUX
+/** 每项检查写入的消息数，数据报逐条检查，不宜过多 */
+static const int kMessages = 10000;
+/** 等待全部送达的时间，单位ms */
+static const int kDeliverMSecs = 5000;
+
+/** 接收端，数据报每个报文一条消息，流式连接按"长度 消息"拆帧 */
+struct NetworkReceiver{
+    int listen_fd = -1;
+    int fd = -1;
+    bool stream = false;
+    QByteArray pending;
+    /** 收到的消息序号 */
+    QVector<int> received;
+    /** 格式或分帧错误的消息数 */
+    int bad = 0;
+
+    ~NetworkReceiver(){ close(); }
+
+    void close(){
+        if(fd >= 0)
+            ::close(fd);
+        if(listen_fd >= 0)
+            ::close(listen_fd);
+        fd = listen_fd = -1;
+    }
+};
+
+static const char kNetworkPrefix[] = "net-check ";
+
+/** 检查一条syslog消息：<15>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID [SD] BOM MSG，返回MSG中的序号，格式错误返回-1 */
+static int parseSyslog(const QByteArray &packet)
+{
+    /** debug等级，facility为user */
+    if(!packet.startsWith("<15>1 "))
+        return -1;
+    int pos = 6;
+    QByteArray fields[5];
+    for(int i = 0; i < 5; i++){
+        int end = packet.indexOf(' ', pos);
+        if(end <= pos)
+            return -1;
+        fields[i] = packet.mid(pos, end - pos);
+        pos = end + 1;
+    }
+    if(fields[4] != "tests.network" || !fields[0].endsWith('Z'))
+        return -1;
+    int sd = packet.indexOf("] \xEF\xBB\xBF", pos);
+    if(packet.mid(pos, 1) != "[" || sd < 0 || !packet.mid(pos, sd - pos).contains("thread=\"0x"))
+        return -1;
+    QByteArray message = packet.mid(sd + 5);
+    if(!message.startsWith(kNetworkPrefix))
+        return -1;
+    bool ok = false;
+    int sequence = message.mid(static_cast<int>(sizeof(kNetworkPrefix)) - 1).toInt(&ok);
+    return ok ? sequence : -1;
+}
+
+static void addPacket(NetworkReceiver &receiver, const QByteArray &packet)
+{
+    int sequence = parseSyslog(packet);
+    if(sequence < 0)
+        receiver.bad++;
+    else
+        receiver.received.append(sequence);
+}
+
+/** 读取当前可读的全部数据，最多等待timeout毫秒 */
+static void receive(NetworkReceiver &receiver, int timeout)
+{
+    if(receiver.stream && receiver.fd < 0){
+        struct pollfd pfd = {receiver.listen_fd, POLLIN, 0};
+        if(poll(&pfd, 1, timeout) != 1)
+            return;
+        receiver.fd = accept(receiver.listen_fd, nullptr, nullptr);
+        if(receiver.fd < 0)
+            return;
+    }
+
+    struct pollfd pfd = {receiver.fd, POLLIN, 0};
+    if(poll(&pfd, 1, timeout) != 1)
+        return;
+    char buffer[65536];
+    for(;;){
+        ssize_t len = recv(receiver.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(len < 0 && errno == EINTR)
+            continue;
+        if(len == 0 && receiver.stream){
+            ::close(receiver.fd);
+            receiver.fd = -1;
+            return;
+        }
+        if(len <= 0)
+            return;
+        if(!receiver.stream){
+            addPacket(receiver, QByteArray(buffer, static_cast<int>(len)));
+            continue;
+        }
+
+        /** 拆出完整的帧，剩余部分等待后续数据 */
+        receiver.pending.append(buffer, static_cast<int>(len));
+        for(;;){
+            int space = receiver.pending.indexOf(' ');
+            if(space < 0)
+                break;
+            bool ok = false;
+            int size = receiver.pending.left(space).toInt(&ok);
+            if(!ok || size <= 0 || receiver.pending.at(0) == '0'){
+                /** 长度字段错误时之后的数据无法再分帧 */
+                receiver.bad++;
+                receiver.pending.clear();
+                break;
+            }
+            if(receiver.pending.size() < space + 1 + size)
+                break;
+            addPacket(receiver, receiver.pending.mid(space + 1, size));
+            receiver.pending.remove(0, space + 1 + size);
+        }
+    }
+}
+
+/** 乱序或重复的消息数 */
+static int outOfOrder(const NetworkReceiver &receiver, int first)
+{
+    int errors = 0;
+    int last = first - 1;
+    for(int sequence : receiver.received){
+        if(sequence <= last)
+            errors++;
+        last = qMax(last, sequence);
+    }
+    return errors;
+}
+
+static bool listenTcp(NetworkReceiver &receiver, quint16 &port)
+{
+    receiver.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(receiver.listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t addr_len = sizeof(addr);
+    if(receiver.listen_fd < 0 || bind(receiver.listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(receiver.listen_fd, 4) != 0 ||
+            getsockname(receiver.listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len) != 0)
+        return false;
+    port = ntohs(addr.sin_port);
+    receiver.stream = true;
+    return true;
+}
+
+/**
+ * 写入count条日志，序号从first开始，期间持续读取避免接收方缓冲区满，最后等待全部送达。
+ * 网络队列满时丢弃的消息计入networkDropped，返回送达和丢弃的消息总数是否等于count
+ */
+static bool sendMessages(NetworkReceiver &receiver, int first, int count)
+{
+    const quint64 dropped = qtlog::stats().networkDropped;
+    const int received = receiver.received.size();
+    for(int i = 0; i < count; i++){
+        qCDebug(networkCategory, "%s%d", kNetworkPrefix, first + i);
+        if(i % 64 == 63)
+            receive(receiver, 0);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while(timer.elapsed() < kDeliverMSecs){
+        quint64 lost = qtlog::stats().networkDropped - dropped;
+        if(receiver.received.size() - received + static_cast<qint64>(lost) >= count)
+            break;
+        receive(receiver, 50);
+    }
+    quint64 lost = qtlog::stats().networkDropped - dropped;
+    return receiver.received.size() - received + static_cast<qint64>(lost) == count;
+}
+#endif
+
+class TestNetwork : public QObject{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+    void cleanupTestCase();
+
+    /** Unix域数据报：每个报文一条消息 */
+    void unixDatagram();
+    /** TCP：octet-counting分帧 */
+    void tcp();
+    /** 对端关闭后退避重连，断开期间暂存的日志送达 */
+    void tcpReconnect();
+
+private:
+    QTemporaryDir logdir_;
+};
+
+void TestNetwork::initTestCase()
+{
+#ifndef Q_OS_LINUX
+    QSKIP("network sink is only supported on Linux");
+#else
+    QVERIFY(logdir_.isValid());
+    QString logdir = logdir_.path() + "/";
+    qtlog::setqtLogDestination(QDEBUG, logdir);
+    qtlog::setPrintToConsole(false);
+    qtlog::qInstallHandlers();
+#endif
+}
+
+void TestNetwork::cleanup()
+{
+    qtlog::setqtLogNetworkSink(qtlog::NetworkNone, QString());
+}
+
+void TestNetwork::cleanupTestCase()
+{
+    qtlog::flushqtLogNow();
+}
+
+void TestNetwork::unixDatagram()
+{
+#ifdef Q_OS_LINUX
+    QByteArray path = QFile::encodeName(logdir_.path() + "/network.sock");
+    NetworkReceiver receiver;
+    receiver.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    QVERIFY2(path.size() < static_cast<int>(sizeof(addr.sun_path)), path.constData());
+    memcpy(addr.sun_path, path.constData(), static_cast<size_t>(path.size()));
+    QVERIFY2(receiver.fd >= 0 && bind(receiver.fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0,
+             path.constData());
+
+    qtlog::setqtLogNetworkSink(qtlog::NetworkUnix, QFile::decodeName(path));
+    QVERIFY(sendMessages(receiver, 0, kMessages));
+    QCOMPARE(receiver.bad, 0);
+    QCOMPARE(outOfOrder(receiver, 0), 0);
+#endif
+}
+
+void TestNetwork::tcp()
+{
+#ifdef Q_OS_LINUX
+    quint16 port = 0;
+    NetworkReceiver receiver;
+    QVERIFY2(listenTcp(receiver, port), "cannot listen on 127.0.0.1");
+
+    qtlog::setqtLogNetworkSink(qtlog::NetworkTcp, QString("127.0.0.1"), port);
+    QVERIFY(sendMessages(receiver, 0, kMessages));
+    QCOMPARE(receiver.bad, 0);
+    QCOMPARE(outOfOrder(receiver, 0), 0);
+#endif
+}
+
+void TestNetwork::tcpReconnect()
+{
+#ifdef Q_OS_LINUX
+    quint16 port = 0;
+    NetworkReceiver before;
+    QVERIFY2(listenTcp(before, port), "cannot listen on 127.0.0.1");
+    qtlog::setqtLogNetworkSink(qtlog::NetworkTcp, QString("127.0.0.1"), port);
+    QVERIFY(sendMessages(before, 0, 100));
+
+    /**
+     * 关闭监听和连接后写入日志，连接拒绝时按100ms起指数退避，1s后重新监听同一端口。
+     * 对端关闭前已写入套接字的少量消息可能丢失，要求重连成功、最后一条送达、帧完整且有序
+     */
+    before.close();
+    const int first = 100;
+    const int burst = 1000;
+    for(int i = 0; i < burst; i++)
+        qCDebug(networkCategory, "%s%d", kNetworkPrefix, first + i);
+    QThread::msleep(1000);
+
+    NetworkReceiver after;
+    QVERIFY2(listenTcp(after, port), "cannot listen on the same port again");
+    QElapsedTimer timer;
+    timer.start();
+    while(timer.elapsed() < kDeliverMSecs){
+        receive(after, 50);
+        if(!after.received.isEmpty() && after.received.last() == first + burst - 1)
+            break;
+    }
+    QVERIFY2(after.fd >= 0, "sink did not reconnect");
+    QVERIFY(!after.received.isEmpty());
+    QCOMPARE(after.received.last(), first + burst - 1);
+    QCOMPARE(after.bad, 0);
+    QCOMPARE(outOfOrder(after, first), 0);
+#endif
+}
+
+QTEST_GUILESS_MAIN(TestNetwork)
+#include "tst_network.moc"
@@ -0,0 +1,304 @@
+﻿#include "decoder.h"
+#include <QFile>
+#include <QDateTime>
+#include <QVector>
+#include <QHash>
+#include <limits.h>
+#include <string.h>
+#include "qtlogformat.h"
+#include "qtlogblockreader.h"
+
+struct CallSite{
+    bool defined = false;
+    int severity = 0;
+    quint64 line = 0;
+    QByteArray file;
+    QByteArray function;
+    QByteArray category;
+};
+
+/** 与qtlog日志格式中的%{if-debug}D...%{if-fatal}F一致 */
+static const char SeverityLetters[] = "DIWCF";
+
+static void appendNumber(QByteArray &out, quint64 value, int base = 10, int width = 0)
+{
+    char buf[24];
+    int len = 0;
+    do{
+        buf[len++] = "0123456789abcdef"[value % base];
+        value /= base;
+    }while(value);
+    while(len < width)
+        buf[len++] = '0';
+    while(len > 0)
+        out.append(buf[--len]);
+}
+
+Decoder::Decoder(FILE *out, const char *program):
+    out_(out),buffer_(nullptr),program_(program),header_(true),from_(LLONG_MIN),to_(LLONG_MAX),second_(-1)
+{
+}
+
+Decoder::Decoder(QByteArray *buffer, const char *program):
+    out_(nullptr),buffer_(buffer),program_(program),header_(true),from_(LLONG_MIN),to_(LLONG_MAX),second_(-1)
+{
+}
+
+void Decoder::output(const QByteArray &data)
+{
+    if(buffer_)
+        buffer_->append(data);
+    else
+        fwrite(data.constData(), 1, static_cast<size_t>(data.size()), out_);
+}
+
+void Decoder::setFilter(qint64 from, qint64 to, const QByteArray &category)
+{
+    from_ = from;
+    to_ = to;
+    category_ = category;
+}
+
+bool Decoder::matchCategory(const QByteArray &category, const QByteArray &filter)
+{
+    if(filter.isEmpty() || category == filter)
+        return true;
+    return category.size() > filter.size() && category.startsWith(filter) && category[filter.size()] == '.';
+}
+
+bool Decoder::decode(const QString &path, qint64 offset, qint64 end, qint64 base)
+{
+    if(path.endsWith(QString(".") + QTLOGF_SUFFIX))
+        return decodeBlocks(path);
+
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)){
+        fprintf(stderr, "%s: cannot open %s\n", program_, qPrintable(path));
+        return false;
+    }
+
+    /** 优先映射文件，避免大文件整体读入 */
+    QByteArray data;
+    const char* begin = nullptr;
+    qint64 size = file.size();
+    uchar* mapped = size > 0 ? file.map(0, size) : nullptr;
+    if(mapped){
+        begin = reinterpret_cast<const char*>(mapped);
+    }
+    else{
+        data = file.readAll();
+        begin = data.constData();
+        size = data.size();
+    }
+
+    if(end < 0 || end > size)
+        end = size;
+    if(offset < 0 || offset > end)
+        offset = end;
+    bool ok = decodeRecords(begin, begin + offset, begin + end, base, path);
+    if(mapped)
+        file.unmap(mapped);
+    return ok;
+}
+
+bool Decoder::decodeRecords(const char *begin, const char *start, const char *end, qint64 base, const QString &path)
+{
+    const char* pos = begin;
+    if(end - pos < QTLOGB_MAGIC_SIZE || (memcmp(pos, QTLOGB_MAGIC, QTLOGB_MAGIC_SIZE) != 0 &&
+                                         memcmp(pos, QTLOGB_MAGIC_V1, QTLOGB_MAGIC_SIZE) != 0)){
+        fprintf(stderr, "%s: %s is not a qtlog binary log\n", program_, qPrintable(path));
+        return false;
+    }
+    /** 旧版本文件的消息中直接记录线程指针 */
+    const bool thread_pointers = memcmp(pos, QTLOGB_MAGIC_V1, QTLOGB_MAGIC_SIZE) == 0;
+    pos += QTLOGB_MAGIC_SIZE;
+
+    quint64 created, pid, flags;
+    QByteArray hostname;
+    if(!qtlogformat::readFixed(pos, end, created, 8) || !qtlogformat::readFixed(pos, end, pid, 8)
+            || !qtlogformat::readFixed(pos, end, flags, 4) || !qtlogformat::readString(pos, end, hostname)){
+        fprintf(stderr, "%s: %s: truncated file header\n", program_, qPrintable(path));
+        return false;
+    }
+
+    /** 与文本日志相同的文件头 */
+    if(header_ && start == begin){
+        QByteArray header;
+        header.append("Log file created at: ")
+                .append(QDateTime::fromMSecsSinceEpoch(static_cast<qint64>(created)).toString("yyyy/MM/dd hh:mm:ss").toLocal8Bit())
+                .append("\nRunning on machine: ").append(hostname)
+                .append("\nLog line format: [DIWEF]pid hh:mm:ss.zzz ")
+                .append((flags & QTLOGB_FLAG_FILELINE) ? "threadid](file:line _function) msg\n" : "threadid] msg\n");
+        output(header);
+    }
+
+    QByteArray pid_text;
+    appendNumber(pid_text, pid);
+
+    QVector<CallSite> sites;
+    QHash<quint64, quint64> threads;
+    qint64 timestamp = static_cast<qint64>(created);
+    QByteArray payload;
+
+    /** 从索引点或块开始解码，之后会重新写入调用点定义，时间差以base为起点 */
+    if(start != begin){
+        pos = qMax(start, pos);
+        timestamp = base;
+    }
+
+    while(pos < end){
+        const char* record = pos;
+        char type = *pos++;
+        /** mmap后端正在写入的文件末尾为预分配的0 */
+        if(type == 0)
+            break;
+        bool ok = false;
+
+        if(type == QTLOGB_RECORD_SITE){
+            quint64 id, line;
+            CallSite site;
+            if(qtlogformat::readVarint(pos, end, id) && pos < end){
+                site.severity = static_cast<uchar>(*pos++);
+                ok = qtlogformat::readVarint(pos, end, line) && qtlogformat::readString(pos, end, site.file)
+                        && qtlogformat::readString(pos, end, site.function) && qtlogformat::readString(pos, end, site.category)
+                        && id < 0x7fffffff && site.severity < static_cast<int>(sizeof(SeverityLetters) - 1);
+                if(ok){
+                    site.line = line;
+                    site.defined = true;
+                    if(static_cast<int>(id) >= sites.size())
+                        sites.resize(static_cast<int>(id) + 1);
+                    sites[static_cast<int>(id)] = site;
+                }
+            }
+        }
+        else if(type == QTLOGB_RECORD_THREAD){
+            quint64 id, thread;
+            ok = qtlogformat::readVarint(pos, end, id) && qtlogformat::readVarint(pos, end, thread);
+            if(ok)
+                threads.insert(id, thread);
+        }
+        else if(type == QTLOGB_RECORD_MESSAGE){
+            quint64 id, thread;
+            qint64 delta;
+            if(qtlogformat::readVarint(pos, end, id) && qtlogformat::readZigzag(pos, end, delta)
+                    && qtlogformat::readVarint(pos, end, thread) && pos < end){
+                char encoding = *pos++;
+                ok = qtlogformat::readString(pos, end, payload);
+                if(ok){
+                    timestamp += delta;
+                    line_.resize(0);
+                    if(id == QTLOGB_SITE_RAW){
+                        if(timestamp < from_ || timestamp > to_ || !category_.isEmpty())
+                            continue;
+                        line_.append(payload);
+                    }
+                    else if(static_cast<qint64>(id) < sites.size() && sites[static_cast<int>(id)].defined){
+                        const CallSite &site = sites[static_cast<int>(id)];
+                        if(timestamp < from_ || timestamp > to_ || !matchCategory(site.category, category_))
+                            continue;
+                        line_.append('[').append(SeverityLetters[site.severity]).append(pid_text).append(' ');
+                        appendTime(timestamp);
+                        line_.append(" 0x", 3);
+                        appendNumber(line_, thread_pointers ? thread : threads.value(thread), 16);
+                        line_.append(']');
+                        if(flags & QTLOGB_FLAG_FILELINE){
+                            line_.append(site.file).append(':');
+                            appendNumber(line_, site.line);
+                            line_.append(" -", 2);
+                        }
+                        line_.append(' ');
+                        if((flags & QTLOGB_FLAG_CATEGORY) && !site.category.isEmpty() && site.category != "default")
+                            line_.append(site.category).append(": ", 2);
+                        if(encoding == QTLOGB_ENCODING_UTF16)
+                            line_.append(QString::fromUtf16(reinterpret_cast<const ushort*>(payload.constData()),
+                                                            payload.size() / 2).toLocal8Bit());
+                        else
+                            line_.append(payload);
+                    }
+                    else{
+                        fprintf(stderr, "%s: %s: message references undefined call site %llu\n", program_,
+                                qPrintable(path), static_cast<unsigned long long>(id));
+                        continue;
+                    }
+                    line_.append('\n');
+                    output(line_);
+                }
+            }
+        }
+
+        if(!ok){
+            /** 程序异常退出时最后一条记录可能不完整 */
+            fprintf(stderr, "%s: %s: corrupt or truncated record at offset %lld\n", program_,
+                    qPrintable(path), static_cast<long long>(record - begin));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Decoder::decodeBlocks(const QString &path)
+{
+    qtlogblockreader reader;
+    if(!reader.open(path)){
+        fprintf(stderr, "%s: %s\n", program_, qPrintable(reader.errorString()));
+        return false;
+    }
+    if(from_ != LLONG_MIN && !reader.seek(from_))
+        return true;
+
+    /** 二进制内容每块拼接在文件头之后解码，文件头只输出一次 */
+    QByteArray header = reader.fileHeader();
+    if(reader.isBinary()){
+        if(!decodeRecords(header.constData(), header.constData(), header.constData() + header.size(), 0, path))
+            return false;
+    }
+    else if(header_){
+        output(header);
+    }
+
+    qtlogblockreader::Block block;
+    QByteArray buffer;
+    bool ok = true;
+    for(;;){
+        qtlogblockreader::Status status = reader.next(block);
+        if(status == qtlogblockreader::StatusCorrupt){
+            fprintf(stderr, "%s: %s: corrupt block at offset %lld skipped\n", program_,
+                    qPrintable(path), static_cast<long long>(reader.position()));
+            ok = false;
+            if(!reader.resync(reader.position() + 1))
+                break;
+            continue;
+        }
+        if(status == qtlogblockreader::StatusTornTail)
+            fprintf(stderr, "%s: %s: incomplete last block ignored\n", program_, qPrintable(path));
+        if(status != qtlogblockreader::StatusOk)
+            break;
+        if(block.header.firstTimestamp > to_)
+            break;
+
+        if(reader.isBinary()){
+            buffer = header;
+            buffer.append(block.data);
+            ok = decodeRecords(buffer.constData(), buffer.constData() + header.size(),
+                               buffer.constData() + buffer.size(), block.header.base, path) && ok;
+        }
+        else{
+            output(block.data);
+        }
+    }
+    return ok;
+}
+
+void Decoder::appendTime(qint64 timestamp)
+{
+    qint64 second = timestamp / 1000;
+    if(second != second_){
+        second_ = second;
+        /** 格式与 %{time h:mm:ss.zzz } 一致 */
+        hms_ = QDateTime::fromMSecsSinceEpoch(second * 1000).toString("h:mm:ss").toLatin1();
+    }
+    line_.append(hms_).append('.');
+    appendNumber(line_, static_cast<quint64>(timestamp % 1000), 10, 3);
+    line_.append(' ');
+}
+
@@ -0,0 +1,58 @@
+﻿#ifndef DECODER_H
+#define DECODER_H
+
+#include <QByteArray>
+#include <QString>
+#include <stdio.h>
+
+/**
+ * @brief The Decoder class
+ * @details 将qtlog二进制格式日志(.logb)还原为与文本日志相同格式的日志行，qtlog-decode和qtlog-query共用
+ */
+class Decoder{
+public:
+    explicit Decoder(FILE *out, const char *program = "qtlog-decode");
+
+    /** 解码结果追加到buffer，用于在内存中继续过滤 */
+    explicit Decoder(QByteArray *buffer, const char *program);
+
+    /** 输出文本日志文件头，默认开启 */
+    void setHeader(bool header){ header_ = header; }
+
+    /** 只输出时间在[from, to](epoch毫秒)内、分类匹配category的日志，category为空时不按分类过滤 */
+    void setFilter(qint64 from, qint64 to, const QByteArray &category);
+
+    /**
+     * @brief decode
+     * @param path
+     * @param offset 从该偏移开始解码，须为时间索引项的偏移，0表示从头解码
+     * @param end 解码到该偏移为止，-1表示到文件末尾
+     * @param base 时间索引项中的时间基准
+     */
+    bool decode(const QString &path, qint64 offset = 0, qint64 end = -1, qint64 base = 0);
+
+    /** 解码分块格式日志(.logf)，按过滤时间定位到起始块，内容为文本时原样输出 */
+    bool decodeBlocks(const QString &path);
+
+    /** category为filter或其子分类(filter.xxx)时匹配，filter为空时全部匹配 */
+    static bool matchCategory(const QByteArray &category, const QByteArray &filter);
+
+private:
+    bool decodeRecords(const char *begin, const char *pos, const char *end, qint64 base, const QString &path);
+    void appendTime(qint64 timestamp);
+    void output(const QByteArray &data);
+
+    FILE* out_;
+    QByteArray* buffer_;
+    const char* program_;
+    bool header_;
+    qint64 from_;
+    qint64 to_;
+    QByteArray category_;
+    QByteArray line_;
+    /** 同一秒内的日志复用时间文本 */
+    qint64 second_;
+    QByteArray hms_;
+};
+
+#endif // DECODER_H
@@ -0,0 +1,55 @@
+﻿#include <QCoreApplication>
+#include <QFile>
+#include <QStringList>
+#include <stdio.h>
+#include "decoder.h"
+
+/**
+ * qtlog-decode
+ * 将qtlog二进制格式日志(.logb)或分块格式日志(.logf)还原为与文本日志相同格式的日志行
+ *
+ * 用法: qtlog-decode [-o output] file.logb|file.logf [...]
+ * 未指定-o时输出到标准输出，多个文件按参数顺序依次解码
+ */
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList arguments = a.arguments();
+    arguments.removeFirst();
+
+    QString output;
+    QStringList inputs;
+    for(int i = 0; i < arguments.size(); i++){
+        if(arguments[i] == "-o" && i + 1 < arguments.size())
+            output = arguments[++i];
+        else
+            inputs.append(arguments[i]);
+    }
+
+    if(inputs.isEmpty()){
+        fprintf(stderr, "usage: qtlog-decode [-o output] file.logb|file.logf [...]\n");
+        return 2;
+    }
+
+    FILE* out = stdout;
+    if(!output.isEmpty()){
+        out = fopen(QFile::encodeName(output).constData(), "wb");
+        if(!out){
+            fprintf(stderr, "qtlog-decode: cannot open %s\n", qPrintable(output));
+            return 2;
+        }
+    }
+
+    Decoder decoder(out);
+    int result = 0;
+    for(const QString &input : inputs){
+        if(!decoder.decode(input))
+            result = 1;
+    }
+
+    if(out != stdout)
+        fclose(out);
+    return result;
+}
@@ -0,0 +1,23 @@
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = qtlog-decode
+
+# 分块格式解压，Windows下使用Qt自带的zlib
+unix:LIBS += -lz
+
+# 与qtlog共用二进制格式定义
+INCLUDEPATH += $$PWD/../../qtlog
+
+HEADERS += \
+        $$PWD/../../qtlog/qtlogformat.h \
+        $$PWD/../../qtlog/qtlogcrc32c.h \
+        $$PWD/../../qtlog/qtlogblockreader.h \
+        decoder.h
+
+SOURCES += \
+        $$PWD/../../qtlog/qtlogblockreader.cpp \
+        decoder.cpp \
+        main.cpp
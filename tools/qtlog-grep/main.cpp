@@ -0,0 +1,595 @@
+﻿#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QDateTime>
+#include <QHash>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QVector>
+#include <stdio.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#if defined(Q_OS_WIN)
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+#ifdef QTLOG_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "qtlogformat.h"
+#include "decoder.h"
+#include "scan.h"
+
+/**
+ * qtlog-grep
+ * 按qtlog日志行格式过滤日志，支持文本日志、二进制日志(.logb)、分块格式日志(.logf)以及压缩后的旧日志(.gz/.zst)
+ *
+ * 用法: qtlog-grep [--severity DIWCF] [--thread 0x...] [--category name] [-e literal] [-r regex]
+ *                  [--label] [--no-merge] [-o output] dir|file [...]
+ * 日志行格式与 qtlog::qInstallHandlers 中的pattern一致：[<等级><pid> h:mm:ss.zzz 0x<线程>]file:line - category: msg，
+ * 是否包含file:line由文件头的"Log line format"判断，多行消息与首行作为一条记录。
+ * 目录递归查找，每个日志目录(等级目录或分类目录)为一路，多路输出按时间合并
+ */
+
+static const char SeverityLetters[] = "DIWCF";
+static const char *const SeverityDirectories[] = {"DEBUG", "INFO", "WARNING", "ERROR", "FATAL"};
+
+struct Filter{
+    QByteArray severities;
+    QByteArray thread;
+    QByteArray category;
+    QByteArray literal;
+    QRegularExpression regex;
+    bool has_regex = false;
+    /** 从正则中提取的必需字面量，用于预筛选 */
+    QByteArray regex_literal;
+};
+
+struct Record{
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    qint64 timestamp = 0;
+};
+
+/** category为filter或其子分类时匹配 */
+static bool matchCategory(const QByteArray &category, const QByteArray &filter)
+{
+    return Decoder::matchCategory(category, filter);
+}
+
+/**
+ * 提取正则中一定出现的最长字面量，含分组或分支时不提取。
+ * 量词可能为0次的字符不计入，不足3个字符时不预筛选
+ */
+static QByteArray requiredLiteral(const QString &pattern)
+{
+    if(pattern.contains('|') || pattern.contains('('))
+        return QByteArray();
+
+    QByteArray best, current;
+    QByteArray text = pattern.toUtf8();
+    for(int i = 0; i < text.size(); i++){
+        char c = text[i];
+        if(strchr("\\^$.[]{}*+?", c)){
+            /** {m,n}整体跳过，最少次数不为0时前一个字符一定出现，否则与*相同 */
+            bool optional = c == '*' || c == '?';
+            if(c == '{'){
+                int close = text.indexOf('}', i);
+                bool ok = false;
+                if(close > i){
+                    QByteArray bounds = text.mid(i + 1, close - i - 1);
+                    int comma = bounds.indexOf(',');
+                    int min = bounds.left(comma < 0 ? bounds.size() : comma).toInt(&ok);
+                    ok = ok && min > 0;
+                    i = close;
+                }
+                optional = !ok;
+            }
+            if(optional && !current.isEmpty())
+                current.chop(1);
+            if(current.size() > best.size())
+                best = current;
+            current.clear();
+            /** 转义字符和字符类整体跳过 */
+            if(c == '\\')
+                i++;
+            else if(c == '['){
+                while(i < text.size() && text[i] != ']')
+                    i++;
+            }
+            continue;
+        }
+        current.append(c);
+    }
+    if(current.size() > best.size())
+        best = current;
+    return best.size() >= 3 ? best : QByteArray();
+}
+
+/** 解压整个文件到data */
+static bool decompress(const QString &path, QByteArray &data)
+{
+    if(path.endsWith(".gz")){
+        /** gzip格式由zlib自动识别文件头 */
+        gzFile gz = gzopen(QFile::encodeName(path).constData(), "rb");
+        if(!gz){
+            fprintf(stderr, "qtlog-grep: cannot open %s\n", qPrintable(path));
+            return false;
+        }
+        char chunk[256 * 1024];
+        int n;
+        while((n = gzread(gz, chunk, sizeof(chunk))) > 0)
+            data.append(chunk, n);
+        bool ok = n == 0;
+        gzclose(gz);
+        if(!ok)
+            fprintf(stderr, "qtlog-grep: %s: corrupt gzip data, output truncated\n", qPrintable(path));
+        return true;
+    }
+#ifdef QTLOG_HAVE_ZSTD
+    QFile in(path);
+    if(!in.open(QIODevice::ReadOnly)){
+        fprintf(stderr, "qtlog-grep: cannot open %s\n", qPrintable(path));
+        return false;
+    }
+    QByteArray compressed = in.readAll();
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    ZSTD_initDStream(stream);
+    ZSTD_inBuffer input = {compressed.constData(), static_cast<size_t>(compressed.size()), 0};
+    QByteArray chunk(static_cast<int>(ZSTD_DStreamOutSize()), Qt::Uninitialized);
+    while(input.pos < input.size){
+        ZSTD_outBuffer output = {chunk.data(), static_cast<size_t>(chunk.size()), 0};
+        if(ZSTD_isError(ZSTD_decompressStream(stream, &output, &input))){
+            fprintf(stderr, "qtlog-grep: %s: corrupt zstd data, output truncated\n", qPrintable(path));
+            break;
+        }
+        data.append(chunk.constData(), static_cast<int>(output.pos));
+    }
+    ZSTD_freeDStream(stream);
+    return true;
+#else
+    fprintf(stderr, "qtlog-grep: %s skipped, rebuild with CONFIG += qtlog_zstd to read .zst logs\n", qPrintable(path));
+    return false;
+#endif
+}
+
+/**
+ * @brief The Source class
+ * @details 一个日志目录下按时间排列的日志文件，逐条返回满足过滤条件的记录。
+ * 文本日志直接映射，压缩和二进制日志解压或解码到内存后过滤
+ */
+class Source{
+public:
+    Source(const QString &label, bool severity_mode, const Filter &filter):
+        label_(label.toUtf8()),severity_mode_(severity_mode),filter_(filter),
+        mapped_(nullptr),begin_(nullptr),pos_(nullptr),end_(nullptr),day_(0),file_line_(false),index_(0){}
+
+    ~Source(){ closeFile(); }
+
+    void addFile(const QString &path){ files_.append(path); }
+    void sortFiles();
+    const QByteArray& label() const{ return label_; }
+
+    /** 返回下一条满足条件的记录，记录在下次调用前有效 */
+    bool next(Record &record);
+
+private:
+    bool openNext();
+    bool load(const QString &path);
+    void closeFile();
+    const char* recordStart(const char *hit) const;
+    const char* recordEnd(const char *start) const;
+    bool parse(const char *begin, const char *end, Record &record) const;
+    static bool isHeaderLine(const char *pos, const char *end);
+
+    QByteArray label_;
+    bool severity_mode_;
+    const Filter &filter_;
+    QStringList files_;
+
+    QFile file_;
+    uchar* mapped_;
+    QByteArray buffer_;
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    /** 当前文件创建当天零点，日志行只有时分秒 */
+    qint64 day_;
+    /** 当前文件的日志行是否包含file:line */
+    bool file_line_;
+    int index_;
+};
+
+void Source::sortFiles()
+{
+    std::sort(files_.begin(), files_.end(), [](const QString &a, const QString &b){
+        return QFileInfo(a).fileName() < QFileInfo(b).fileName();
+    });
+}
+
+bool Source::next(Record &record)
+{
+    const QByteArray &literal = filter_.literal.isEmpty() ? filter_.regex_literal : filter_.literal;
+    for(;;){
+        if(pos_ >= end_){
+            if(!openNext())
+                return false;
+            continue;
+        }
+
+        /** 有字面量时先在整个缓冲区中查找，只解析命中的记录 */
+        const char* start = pos_;
+        if(!literal.isEmpty()){
+            const char* hit = Scanner::findLiteral(pos_, end_, literal.constData(), literal.size());
+            if(hit == end_){
+                pos_ = end_;
+                continue;
+            }
+            start = recordStart(hit);
+        }
+        const char* end = recordEnd(start);
+        pos_ = end;
+        if(parse(start, end, record))
+            return true;
+    }
+}
+
+bool Source::openNext()
+{
+    closeFile();
+    while(index_ < files_.size()){
+        if(load(files_[index_++]))
+            return true;
+    }
+    return false;
+}
+
+void Source::closeFile()
+{
+    if(mapped_)
+        file_.unmap(mapped_);
+    mapped_ = nullptr;
+    if(file_.isOpen())
+        file_.close();
+    buffer_.clear();
+    begin_ = pos_ = end_ = nullptr;
+}
+
+bool Source::load(const QString &path)
+{
+    QString name = QFileInfo(path).fileName();
+    QDateTime created = QDateTime::fromString(name.left(15), "yyyyMMdd-hhmmss");
+    day_ = created.isValid() ? QDateTime(created.date(), QTime(0, 0)).toMSecsSinceEpoch() : 0;
+
+    if(path.endsWith(".gz") || path.endsWith(".zst")){
+        QByteArray data;
+        if(!decompress(path, data))
+            return false;
+        name.chop(path.endsWith(".gz") ? 3 : 4);
+        if(name.endsWith(".log")){
+            buffer_ = data;
+        }
+        else{
+            /** 二进制和分块格式按文件解码，解压到临时文件后与未压缩的文件相同处理 */
+            QTemporaryFile temp(QDir::tempPath() + "/qtlog-grep-XXXXXX." + QFileInfo(name).suffix());
+            if(!temp.open() || temp.write(data) != data.size() || !temp.flush()){
+                fprintf(stderr, "qtlog-grep: cannot write temporary file for %s\n", qPrintable(path));
+                return false;
+            }
+            data.clear();
+            Decoder decoder(&buffer_, "qtlog-grep");
+            decoder.decode(temp.fileName());
+        }
+    }
+    else if(name.endsWith(QString(".") + QTLOGB_SUFFIX) || name.endsWith(QString(".") + QTLOGF_SUFFIX)){
+        Decoder decoder(&buffer_, "qtlog-grep");
+        decoder.decode(path);
+    }
+    else{
+        file_.setFileName(path);
+        if(!file_.open(QIODevice::ReadOnly)){
+            fprintf(stderr, "qtlog-grep: cannot open %s\n", qPrintable(path));
+            return false;
+        }
+        qint64 size = file_.size();
+        mapped_ = size > 0 ? file_.map(0, size) : nullptr;
+        if(mapped_){
+            begin_ = reinterpret_cast<const char*>(mapped_);
+            end_ = begin_ + size;
+        }
+        else{
+            buffer_ = file_.readAll();
+        }
+    }
+
+    if(!mapped_){
+        begin_ = buffer_.constData();
+        end_ = begin_ + buffer_.size();
+    }
+    pos_ = begin_;
+
+    /** 文件头 "Log line format: ... threadid](file:line _function) msg" 表示日志行包含file:line */
+    const char* header_end = Scanner::findLiteral(begin_, end_, "Log line format:", 16);
+    file_line_ = false;
+    if(header_end != end_){
+        const char* line_end = Scanner::findByte(header_end, end_, '\n');
+        file_line_ = Scanner::findLiteral(header_end, line_end, "(file:line", 10) != line_end;
+    }
+    return true;
+}
+
+bool Source::isHeaderLine(const char *pos, const char *end)
+{
+    return end - pos > 3 && pos[0] == '[' && strchr(SeverityLetters, pos[1]) && pos[1] && pos[2] >= '0' && pos[2] <= '9';
+}
+
+const char* Source::recordStart(const char *hit) const
+{
+    /** 回退到命中位置所在记录的首行，多行消息的后续行不以日志前缀开头 */
+    const char* line = hit;
+    for(;;){
+        while(line > pos_ && line[-1] != '\n')
+            line--;
+        if(line <= pos_ || isHeaderLine(line, end_))
+            return line;
+        line--;
+    }
+}
+
+const char* Source::recordEnd(const char *start) const
+{
+    const char* pos = start;
+    for(;;){
+        const char* newline = Scanner::findByte(pos, end_, '\n');
+        if(newline == end_)
+            return end_;
+        pos = newline + 1;
+        if(pos >= end_ || isHeaderLine(pos, end_) || *pos == '\0')
+            return pos;
+    }
+}
+
+bool Source::parse(const char *begin, const char *end, Record &record) const
+{
+    /** mmap后端正在写入的文件末尾为预分配的0 */
+    while(end > begin && end[-1] == '\0')
+        end--;
+    if(!isHeaderLine(begin, end))
+        return false;
+
+    char severity = begin[1];
+    if(!filter_.severities.isEmpty() && !filter_.severities.contains(severity))
+        return false;
+
+    const char* p = begin + 2;
+    while(p < end && *p >= '0' && *p <= '9')
+        p++;
+    if(p >= end || *p++ != ' ')
+        return false;
+
+    int fields[4] = {0, 0, 0, 0};
+    const char separators[4] = {':', ':', '.', ' '};
+    for(int i = 0; i < 4; i++){
+        const char* digits = p;
+        while(p < end && *p >= '0' && *p <= '9')
+            fields[i] = fields[i] * 10 + (*p++ - '0');
+        if(p == digits || p >= end || *p++ != separators[i])
+            return false;
+    }
+    while(p < end && *p == ' ')
+        p++;
+
+    const char* thread = p;
+    const char* close = static_cast<const char*>(memchr(p, ']', static_cast<size_t>(end - p)));
+    if(!close)
+        return false;
+    if(!filter_.thread.isEmpty()){
+        QByteArray value = QByteArray::fromRawData(thread, static_cast<int>(close - thread)).toLower();
+        if(value != filter_.thread && value != "0x" + filter_.thread)
+            return false;
+    }
+
+    /** ]file:line - category: msg，file:line由文件头判断，普通模式下才有分类前缀 */
+    const char* message = close + 1;
+    if(file_line_){
+        const char* dash = Scanner::findLiteral(message, end, " - ", 3);
+        if(dash != end)
+            message = dash + 2;
+    }
+    if(message < end && *message == ' ')
+        message++;
+
+    if(severity_mode_){
+        QByteArray category("default");
+        const char* space = static_cast<const char*>(memchr(message, ' ', static_cast<size_t>(end - message)));
+        if(space && space - message > 1 && space[-1] == ':'){
+            category = QByteArray(message, static_cast<int>(space - 1 - message));
+            message = space + 1;
+        }
+        if(!filter_.category.isEmpty() && !matchCategory(category, filter_.category))
+            return false;
+    }
+
+    if(!filter_.literal.isEmpty() &&
+            Scanner::findLiteral(message, end, filter_.literal.constData(), filter_.literal.size()) == end)
+        return false;
+    if(filter_.has_regex &&
+            !filter_.regex.match(QString::fromUtf8(message, static_cast<int>(end - message))).hasMatch())
+        return false;
+
+    record.begin = begin;
+    record.end = end;
+    record.timestamp = day_ + ((fields[0] * 60 + fields[1]) * 60 + fields[2]) * 1000LL + fields[3];
+    return true;
+}
+
+/** 各路当前记录中时间最早的先输出，时间相同时按参数顺序 */
+struct Pending{
+    Record record;
+    int source;
+    bool operator<(const Pending &other) const{
+        if(record.timestamp != other.record.timestamp)
+            return record.timestamp > other.record.timestamp;
+        return source > other.source;
+    }
+};
+
+static void writeRecord(FILE *out, const Record &record, const QByteArray &label, bool with_label)
+{
+    if(with_label){
+        fwrite(label.constData(), 1, static_cast<size_t>(label.size()), out);
+        fwrite("| ", 1, 2, out);
+    }
+    fwrite(record.begin, 1, static_cast<size_t>(record.end - record.begin), out);
+    if(record.end[-1] != '\n')
+        fputc('\n', out);
+}
+
+static bool isLogFile(const QString &name)
+{
+    QString base = name;
+    if(base.endsWith(".gz"))
+        base.chop(3);
+    else if(base.endsWith(".zst"))
+        base.chop(4);
+    return base.endsWith(".log") || base.endsWith(QString(".") + QTLOGB_SUFFIX) || base.endsWith(QString(".") + QTLOGF_SUFFIX);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList arguments = a.arguments();
+    arguments.removeFirst();
+
+    Filter filter;
+    QString output;
+    QStringList inputs;
+    bool with_label = false;
+    bool merge = true;
+    for(int i = 0; i < arguments.size(); i++){
+        const QString &arg = arguments[i];
+        bool has_value = i + 1 < arguments.size();
+        if(arg == "--severity" && has_value)
+            filter.severities = arguments[++i].toUpper().toLatin1();
+        else if(arg == "--thread" && has_value)
+            filter.thread = arguments[++i].toLower().toLatin1();
+        else if(arg == "--category" && has_value)
+            filter.category = arguments[++i].toUtf8();
+        else if(arg == "-e" && has_value)
+            filter.literal = arguments[++i].toUtf8();
+        else if(arg == "-r" && has_value){
+            filter.regex.setPattern(arguments[++i]);
+            if(!filter.regex.isValid()){
+                fprintf(stderr, "qtlog-grep: invalid regex: %s\n", qPrintable(filter.regex.errorString()));
+                return 2;
+            }
+            filter.has_regex = true;
+            filter.regex_literal = requiredLiteral(arguments[i]);
+        }
+        else if(arg == "--label")
+            with_label = true;
+        else if(arg == "--no-merge")
+            merge = false;
+        else if(arg == "-o" && has_value)
+            output = arguments[++i];
+        else
+            inputs.append(arg);
+    }
+    if(filter.thread.startsWith("0x"))
+        filter.thread = filter.thread.mid(2);
+
+    if(inputs.isEmpty()){
+        fprintf(stderr, "usage: qtlog-grep [--severity DIWCF] [--thread 0x...] [--category name] [-e literal] [-r regex]\n"
+                        "                  [--label] [--no-merge] [-o output] dir|file [...]\n");
+        return 2;
+    }
+
+    /** 每个日志目录为一路，分类模式下目录相对路径即分类名 */
+    QVector<Source*> sources;
+    QHash<QString, Source*> by_directory;
+    for(const QString &input : inputs){
+        QFileInfo info(input);
+        QString root = info.isDir() ? info.absoluteFilePath() : info.absolutePath();
+        QStringList paths;
+        if(info.isDir()){
+            QDirIterator it(root, QDir::Files, QDirIterator::Subdirectories);
+            while(it.hasNext()){
+                QString path = it.next();
+                if(isLogFile(QFileInfo(path).fileName()))
+                    paths.append(path);
+            }
+        }
+        else{
+            paths.append(info.absoluteFilePath());
+        }
+
+        for(const QString &path : paths){
+            QString directory = QFileInfo(path).absolutePath();
+            Source* source = by_directory.value(directory);
+            if(!source){
+                QString name = QDir(directory).dirName();
+                bool severity_mode = false;
+                for(const char* severity : SeverityDirectories)
+                    severity_mode |= name == severity;
+
+                QString label = QDir(root).relativeFilePath(directory).replace('/', '.');
+                if(label == ".")
+                    label = name;
+                /** 分类模式下整路按分类过滤，不需要逐条解析分类 */
+                if(!severity_mode && !filter.category.isEmpty() && !matchCategory(label.toUtf8(), filter.category))
+                    continue;
+
+                source = new Source(label, severity_mode, filter);
+                by_directory.insert(directory, source);
+                sources.append(source);
+            }
+            source->addFile(path);
+        }
+    }
+
+    FILE* out = stdout;
+    if(!output.isEmpty()){
+        out = fopen(QFile::encodeName(output).constData(), "wb");
+        if(!out){
+            fprintf(stderr, "qtlog-grep: cannot open %s\n", qPrintable(output));
+            return 2;
+        }
+    }
+
+    Record record;
+    if(!merge || sources.size() == 1){
+        for(Source* source : sources){
+            source->sortFiles();
+            while(source->next(record))
+                writeRecord(out, record, source->label(), with_label);
+        }
+    }
+    else{
+        std::priority_queue<Pending> pending;
+        for(int i = 0; i < sources.size(); i++){
+            sources[i]->sortFiles();
+            Pending item;
+            item.source = i;
+            if(sources[i]->next(item.record))
+                pending.push(item);
+        }
+        while(!pending.empty()){
+            Pending item = pending.top();
+            pending.pop();
+            writeRecord(out, item.record, sources[item.source]->label(), with_label);
+            if(sources[item.source]->next(item.record))
+                pending.push(item);
+        }
+    }
+
+    qDeleteAll(sources);
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,30 @@
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = qtlog-grep
+
+# .gz旧日志和分块格式解压，Windows下使用Qt自带的zlib
+unix:LIBS += -lz
+
+# 以 CONFIG += qtlog_zstd 编译时支持.zst旧日志
+qtlog_zstd {
+    DEFINES += QTLOG_HAVE_ZSTD
+    LIBS += -lzstd
+}
+
+# 二进制和分块格式日志先由qtlog-decode的解码器还原为文本再过滤
+INCLUDEPATH += $$PWD/../../qtlog $$PWD/../qtlog-decode
+
+HEADERS += \
+        $$PWD/../../qtlog/qtlogformat.h \
+        $$PWD/../../qtlog/qtlogcrc32c.h \
+        $$PWD/../../qtlog/qtlogblockreader.h \
+        $$PWD/../qtlog-decode/decoder.h \
+        scan.h
+
+SOURCES += \
+        $$PWD/../../qtlog/qtlogblockreader.cpp \
+        $$PWD/../qtlog-decode/decoder.cpp \
+        main.cpp
@@ -0,0 +1,132 @@
+﻿#ifndef SCAN_H
+#define SCAN_H
+
+#include <QtGlobal>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define QTLOG_SCAN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(QTLOG_SCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define QTLOG_SCAN_AVX2 __attribute__((target("avx2")))
+#else
+#define QTLOG_SCAN_AVX2
+#endif
+
+/**
+ * @brief The Scanner class
+ * @details 按内存带宽查找换行和字面量。x86下运行时检测AVX2，每次比较32字节；
+ * 字面量先按首尾字节批量筛选候选位置再逐个比较，不支持时使用memchr和逐字节比较
+ */
+class Scanner
+{
+public:
+    /** 查找字节c，未找到返回end */
+    static inline const char* findByte(const char *pos, const char *end, char c){
+#if defined(QTLOG_SCAN_X86)
+        if(hasAvx2())
+            return findByteAvx2(pos, end, c);
+#endif
+        const char* hit = static_cast<const char*>(memchr(pos, c, static_cast<size_t>(end - pos)));
+        return hit ? hit : end;
+    }
+
+    /** 查找字面量needle，未找到返回end */
+    static inline const char* findLiteral(const char *pos, const char *end, const char *needle, int len){
+        if(len <= 0)
+            return pos;
+        if(len == 1)
+            return findByte(pos, end, needle[0]);
+#if defined(QTLOG_SCAN_X86)
+        if(hasAvx2())
+            return findLiteralAvx2(pos, end, needle, len);
+#endif
+        return findLiteralScalar(pos, end, needle, len);
+    }
+
+private:
+    explicit Scanner();
+
+    static inline const char* findLiteralScalar(const char *pos, const char *end, const char *needle, int len){
+        while(end - pos >= len){
+            const char* hit = static_cast<const char*>(memchr(pos, needle[0], static_cast<size_t>(end - pos - len + 1)));
+            if(!hit)
+                break;
+            if(memcmp(hit + 1, needle + 1, static_cast<size_t>(len - 1)) == 0)
+                return hit;
+            pos = hit + 1;
+        }
+        return end;
+    }
+
+#if defined(QTLOG_SCAN_X86)
+    static inline bool hasAvx2(){
+#if defined(_MSC_VER)
+        static const bool supported = [](){
+            int info[4];
+            __cpuid(info, 0);
+            if(info[0] < 7)
+                return false;
+            __cpuid(info, 1);
+            /** 需要系统保存YMM寄存器(OSXSAVE且XCR0的SSE、AVX位) */
+            if(!(info[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6)
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+        }();
+#else
+        static const bool supported = __builtin_cpu_supports("avx2");
+#endif
+        return supported;
+    }
+
+    static inline int lowestBit(quint32 mask){
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    static inline QTLOG_SCAN_AVX2 const char* findByteAvx2(const char *pos, const char *end, char c){
+        const __m256i needle = _mm256_set1_epi8(c);
+        while(end - pos >= 32){
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+            quint32 mask = static_cast<quint32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+            if(mask)
+                return pos + lowestBit(mask);
+            pos += 32;
+        }
+        const char* hit = static_cast<const char*>(memchr(pos, c, static_cast<size_t>(end - pos)));
+        return hit ? hit : end;
+    }
+
+    static inline QTLOG_SCAN_AVX2 const char* findLiteralAvx2(const char *pos, const char *end, const char *needle, int len){
+        const __m256i first = _mm256_set1_epi8(needle[0]);
+        const __m256i last = _mm256_set1_epi8(needle[len - 1]);
+        while(end - pos >= len - 1 + 32){
+            __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+            __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos + len - 1));
+            quint32 mask = static_cast<quint32>(_mm256_movemask_epi8(
+                        _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last))));
+            while(mask){
+                int i = lowestBit(mask);
+                if(memcmp(pos + i + 1, needle + 1, static_cast<size_t>(len - 2)) == 0)
+                    return pos + i;
+                mask &= mask - 1;
+            }
+            pos += 32;
+        }
+        return findLiteralScalar(pos, end, needle, len);
+    }
+#endif
+};
+
+#endif // SCAN_H
@@ -0,0 +1,498 @@
+﻿#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDirIterator>
+#include <QDateTime>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QVector>
+#include <limits.h>
+#include <stdio.h>
+#include <algorithm>
+#if defined(Q_OS_WIN)
+#include <QtZlib/zlib.h>
+#else
+#include <zlib.h>
+#endif
+#ifdef QTLOG_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "qtlogformat.h"
+#include "qtlogblockreader.h"
+#include "decoder.h"
+
+/**
+ * qtlog-query
+ * 按时间范围和分类查询日志，利用日志文件旁的 .idx 时间索引直接定位到时间范围，
+ * 不需要从头扫描整个日志文件。支持文本日志(.log)、二进制日志(.logb)和分块格式日志(.logf，按块头时间定位)，包括正在写入的文件。
+ * 压缩后的旧日志(.gz/.zst)没有索引，解压后按行时间过滤
+ *
+ * 用法: qtlog-query [--from time] [--to time] [--category name] [-o output] dir|file [...]
+ * time 格式为 "yyyy-MM-dd hh:mm:ss[.zzz]"；目录下的日志文件递归查找，按文件创建时间依次输出。
+ * 分类模式下按分类目录查找，普通模式下按日志行中的 "category: " 前缀过滤，name同时匹配其子分类
+ */
+
+struct LogFile{
+    QString path;
+    /** 文件名中的创建时间，epoch毫秒 */
+    qint64 created;
+    /** 普通模式下需要按日志行中的分类过滤 */
+    bool filter_lines;
+};
+
+static const char *const TimeFormats[] = {
+    "yyyy-MM-dd hh:mm:ss.zzz", "yyyy-MM-dd hh:mm:ss", "yyyy-MM-ddThh:mm:ss.zzz", "yyyy-MM-ddThh:mm:ss", "yyyy-MM-dd"
+};
+
+static bool parseTime(const QString &text, qint64 &msecs)
+{
+    for(const char* format : TimeFormats){
+        QDateTime time = QDateTime::fromString(text, format);
+        if(time.isValid()){
+            msecs = time.toMSecsSinceEpoch();
+            return true;
+        }
+    }
+    return false;
+}
+
+/** 文件名格式为 yyyyMMdd-hhmmss.PID.log，解析失败返回-1 */
+static qint64 createdTime(const QString &path)
+{
+    QDateTime time = QDateTime::fromString(QFileInfo(path).fileName().left(15), "yyyyMMdd-hhmmss");
+    return time.isValid() ? time.toMSecsSinceEpoch() : -1;
+}
+
+/** 去掉.gz/.zst后缀后的文件名 */
+static QString uncompressedName(const QString &path)
+{
+    QString base = path;
+    if(base.endsWith(".gz"))
+        base.chop(3);
+    else if(base.endsWith(".zst"))
+        base.chop(4);
+    return base;
+}
+
+static bool isLogFile(const QString &path)
+{
+    QString base = uncompressedName(path);
+    return base.endsWith(".log") || base.endsWith(QString(".") + QTLOGB_SUFFIX) || base.endsWith(QString(".") + QTLOGF_SUFFIX);
+}
+
+static bool isCompressed(const QString &path)
+{
+    return path.endsWith(".gz") || path.endsWith(".zst");
+}
+
+/** 解压整个文件到data */
+static bool decompress(const QString &path, QByteArray &data)
+{
+    if(path.endsWith(".gz")){
+        /** gzip格式由zlib自动识别文件头 */
+        gzFile gz = gzopen(QFile::encodeName(path).constData(), "rb");
+        if(!gz){
+            fprintf(stderr, "qtlog-query: cannot open %s\n", qPrintable(path));
+            return false;
+        }
+        char chunk[256 * 1024];
+        int n;
+        while((n = gzread(gz, chunk, sizeof(chunk))) > 0)
+            data.append(chunk, n);
+        bool ok = n == 0;
+        gzclose(gz);
+        if(!ok)
+            fprintf(stderr, "qtlog-query: %s: corrupt gzip data, output truncated\n", qPrintable(path));
+        return true;
+    }
+#ifdef QTLOG_HAVE_ZSTD
+    QFile in(path);
+    if(!in.open(QIODevice::ReadOnly)){
+        fprintf(stderr, "qtlog-query: cannot open %s\n", qPrintable(path));
+        return false;
+    }
+    QByteArray compressed = in.readAll();
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    ZSTD_initDStream(stream);
+    ZSTD_inBuffer input = {compressed.constData(), static_cast<size_t>(compressed.size()), 0};
+    QByteArray chunk(static_cast<int>(ZSTD_DStreamOutSize()), Qt::Uninitialized);
+    while(input.pos < input.size){
+        ZSTD_outBuffer output = {chunk.data(), static_cast<size_t>(chunk.size()), 0};
+        if(ZSTD_isError(ZSTD_decompressStream(stream, &output, &input))){
+            fprintf(stderr, "qtlog-query: %s: corrupt zstd data, output truncated\n", qPrintable(path));
+            break;
+        }
+        data.append(chunk.constData(), static_cast<int>(output.pos));
+    }
+    ZSTD_freeDStream(stream);
+    return true;
+#else
+    fprintf(stderr, "qtlog-query: %s skipped, rebuild with CONFIG += qtlog_zstd to read .zst logs\n", qPrintable(path));
+    return false;
+#endif
+}
+
+class Query{
+public:
+    Query(FILE *out, qint64 from, qint64 to, const QByteArray &category):
+        out_(out),from_(from),to_(to),category_(category),decoder_(out, "qtlog-query"){
+        decoder_.setHeader(false);
+        decoder_.setFilter(from, to, category);
+    }
+
+    void addPath(const QString &path);
+    bool run();
+
+private:
+    void addDirectory(const QString &directory, bool filter_lines);
+    bool range(const LogFile &file, qint64 &start, qint64 &end, qint64 &base);
+    bool queryText(const LogFile &file, qint64 start, qint64 end);
+    bool queryBlocks(const LogFile &file);
+    bool queryCompressed(const LogFile &file);
+    void scanLines(const char *pos, const char *limit, qint64 day, bool filter_lines, bool &matched);
+    static qint64 dayOf(const LogFile &file);
+    bool matchLine(const char *line, const char *end, qint64 day, bool filter_lines, bool &matched);
+
+    FILE* out_;
+    qint64 from_;
+    qint64 to_;
+    QByteArray category_;
+    Decoder decoder_;
+    QVector<LogFile> files_;
+};
+
+void Query::addPath(const QString &path)
+{
+    QFileInfo info(path);
+    if(!info.isDir()){
+        LogFile file = {path, createdTime(path), !category_.isEmpty()};
+        files_.append(file);
+        return;
+    }
+
+    /** 分类模式下分类a.b的日志位于a/b/目录，只查找该目录 */
+    if(!category_.isEmpty()){
+        QString directory = QDir(path).filePath(QString::fromUtf8(category_).replace('.', '/'));
+        if(QFileInfo(directory).isDir()){
+            addDirectory(directory, false);
+            return;
+        }
+    }
+    addDirectory(path, !category_.isEmpty());
+}
+
+void Query::addDirectory(const QString &directory, bool filter_lines)
+{
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while(it.hasNext()){
+        QString path = it.next();
+        if(!isLogFile(path))
+            continue;
+        LogFile file = {path, createdTime(path), filter_lines};
+        files_.append(file);
+    }
+}
+
+bool Query::run()
+{
+    std::stable_sort(files_.begin(), files_.end(), [](const LogFile &a, const LogFile &b){
+        return QFileInfo(a.path).fileName() < QFileInfo(b.path).fileName();
+    });
+
+    bool ok = true;
+    for(const LogFile &file : files_){
+        /** 日志文件按天切换，创建时间晚于to或创建当天早于from的文件不需要打开 */
+        if(file.created >= 0){
+            qint64 day_end = QDateTime(QDateTime::fromMSecsSinceEpoch(file.created).date().addDays(1), QTime(0, 0)).toMSecsSinceEpoch();
+            if(file.created > to_ || day_end + 60 * 1000 < from_)
+                continue;
+        }
+
+        if(isCompressed(file.path)){
+            ok = queryCompressed(file) && ok;
+            continue;
+        }
+        if(file.path.endsWith(QString(".") + QTLOGF_SUFFIX)){
+            ok = queryBlocks(file) && ok;
+            continue;
+        }
+
+        qint64 start, end, base;
+        if(!range(file, start, end, base))
+            continue;
+
+        if(file.path.endsWith(QString(".") + QTLOGB_SUFFIX))
+            ok = decoder_.decode(file.path, start, end, base) && ok;
+        else
+            ok = queryText(file, start, end) && ok;
+    }
+    return ok;
+}
+
+bool Query::range(const LogFile &file, qint64 &start, qint64 &end, qint64 &base)
+{
+    start = 0;
+    end = -1;
+    base = 0;
+
+    QFile index(file.path + QTLOGI_SUFFIX);
+    if(!index.open(QIODevice::ReadOnly))
+        return true;
+    QVector<qtlogformat::IndexEntry> entries;
+    if(!qtlogformat::readIndex(index.readAll(), entries) || entries.isEmpty())
+        return true;
+
+    /** 异步模式下记录时间可能有少量乱序，起止位置各多读一个索引项 */
+    int first = -1;
+    for(int i = 0; i < entries.size() && entries[i].timestamp <= from_; i++)
+        first = i;
+    if(first > 0)
+        first--;
+    if(first >= 0){
+        start = entries[first].offset;
+        base = entries[first].base;
+    }
+
+    for(int i = qMax(first, 0); i < entries.size(); i++){
+        if(entries[i].timestamp > to_){
+            if(i + 1 < entries.size())
+                end = entries[i + 1].offset;
+            break;
+        }
+    }
+    /** 文件中第一条记录已晚于to */
+    if(first < 0 && entries[0].timestamp > to_ && entries.size() > 1 && entries[1].timestamp > to_)
+        return false;
+    return true;
+}
+
+bool Query::queryText(const LogFile &file, qint64 start, qint64 end)
+{
+    QFile in(file.path);
+    if(!in.open(QIODevice::ReadOnly)){
+        fprintf(stderr, "qtlog-query: cannot open %s\n", qPrintable(file.path));
+        return false;
+    }
+    qint64 size = in.size();
+    if(end < 0 || end > size)
+        end = size;
+    if(start >= end)
+        return true;
+
+    /** 优先映射查询范围，避免大文件整体读入 */
+    QByteArray data;
+    const char* begin;
+    uchar* mapped = in.map(start, end - start);
+    if(mapped){
+        begin = reinterpret_cast<const char*>(mapped);
+    }
+    else{
+        in.seek(start);
+        data = in.read(end - start);
+        begin = data.constData();
+        end = start + data.size();
+    }
+
+    bool matched = false;
+    scanLines(begin, begin + (end - start), dayOf(file), file.filter_lines, matched);
+
+    if(mapped)
+        in.unmap(mapped);
+    return true;
+}
+
+bool Query::queryBlocks(const LogFile &file)
+{
+    qtlogblockreader reader;
+    if(!reader.open(file.path)){
+        fprintf(stderr, "qtlog-query: %s\n", qPrintable(reader.errorString()));
+        return false;
+    }
+    if(reader.isBinary()){
+        reader.close();
+        return decoder_.decode(file.path);
+    }
+    if(from_ != LLONG_MIN && !reader.seek(from_))
+        return true;
+
+    qint64 day = dayOf(file);
+    bool matched = false;
+    qtlogblockreader::Block block;
+    for(;;){
+        qtlogblockreader::Status status = reader.next(block);
+        if(status == qtlogblockreader::StatusCorrupt){
+            fprintf(stderr, "qtlog-query: %s: corrupt block at offset %lld skipped\n",
+                    qPrintable(file.path), static_cast<long long>(reader.position()));
+            if(!reader.resync(reader.position() + 1))
+                break;
+            continue;
+        }
+        /** 块按写入顺序排列，首条记录已晚于to时结束 */
+        if(status != qtlogblockreader::StatusOk || block.header.firstTimestamp > to_)
+            break;
+        scanLines(block.data.constData(), block.data.constData() + block.data.size(), day, file.filter_lines, matched);
+    }
+    return true;
+}
+
+bool Query::queryCompressed(const LogFile &file)
+{
+    QByteArray data;
+    if(!decompress(file.path, data))
+        return false;
+
+    const QString name = uncompressedName(file.path);
+    if(name.endsWith(".log")){
+        bool matched = false;
+        scanLines(data.constData(), data.constData() + data.size(), dayOf(file), file.filter_lines, matched);
+        return true;
+    }
+
+    /** 二进制和分块格式按文件解码，解压到临时文件后与未压缩的文件相同处理 */
+    QTemporaryFile temp(QDir::tempPath() + "/qtlog-query-XXXXXX." + QFileInfo(name).suffix());
+    if(!temp.open() || temp.write(data) != data.size() || !temp.flush()){
+        fprintf(stderr, "qtlog-query: cannot write temporary file for %s\n", qPrintable(file.path));
+        return false;
+    }
+    data.clear();
+    LogFile inner = {temp.fileName(), file.created, file.filter_lines};
+    if(name.endsWith(QString(".") + QTLOGF_SUFFIX))
+        return queryBlocks(inner);
+    return decoder_.decode(inner.path);
+}
+
+/** 文本日志行只有时分秒，日期取自文件创建时间 */
+qint64 Query::dayOf(const LogFile &file)
+{
+    if(file.created < 0)
+        return 0;
+    return QDateTime(QDateTime::fromMSecsSinceEpoch(file.created).date(), QTime(0, 0)).toMSecsSinceEpoch();
+}
+
+void Query::scanLines(const char *pos, const char *limit, qint64 day, bool filter_lines, bool &matched)
+{
+    while(pos < limit){
+        const char* line_end = static_cast<const char*>(memchr(pos, '\n', static_cast<size_t>(limit - pos)));
+        line_end = line_end ? line_end + 1 : limit;
+        /** mmap后端正在写入的文件末尾为预分配的0 */
+        if(*pos == '\0')
+            break;
+        /** 不以日志前缀开头的行(多行消息)跟随上一行 */
+        matchLine(pos, line_end, day, filter_lines, matched);
+        if(matched)
+            fwrite(pos, 1, static_cast<size_t>(line_end - pos), out_);
+        pos = line_end;
+    }
+}
+
+/** 解析 [X<pid> h:mm:ss.zzz ...] 前缀，是日志行时更新matched并返回true */
+bool Query::matchLine(const char *line, const char *end, qint64 day, bool filter_lines, bool &matched)
+{
+    const char* p = line;
+    if(end - p < 4 || *p++ != '[')
+        return false;
+    p++;
+    while(p < end && *p >= '0' && *p <= '9')
+        p++;
+    if(p >= end || *p++ != ' ')
+        return false;
+
+    int fields[4] = {0, 0, 0, 0};
+    const char separators[4] = {':', ':', '.', ' '};
+    for(int i = 0; i < 4; i++){
+        const char* digits = p;
+        while(p < end && *p >= '0' && *p <= '9')
+            fields[i] = fields[i] * 10 + (*p++ - '0');
+        if(p == digits || p >= end || *p++ != separators[i])
+            return false;
+    }
+    qint64 timestamp = day + ((fields[0] * 60 + fields[1]) * 60 + fields[2]) * 1000LL + fields[3];
+    matched = timestamp >= from_ && timestamp <= to_;
+
+    if(matched && filter_lines){
+        /** 普通模式下分类位于 "] " 或 " - " 之后，默认分类不输出 */
+        const char* close = static_cast<const char*>(memchr(p, ']', static_cast<size_t>(end - p)));
+        QByteArray category("default");
+        if(close){
+            QByteArray rest = QByteArray::fromRawData(close + 1, static_cast<int>(end - close - 1));
+            int begin = -1;
+            if(rest.startsWith(' ')){
+                begin = 1;
+            }
+            else{
+                int dash = rest.indexOf(" - ");
+                if(dash >= 0)
+                    begin = dash + 3;
+            }
+            if(begin >= 0){
+                int colon = rest.indexOf(": ", begin);
+                int space = rest.indexOf(' ', begin);
+                if(colon > begin && space > colon)
+                    category = rest.mid(begin, colon - begin);
+            }
+        }
+        matched = Decoder::matchCategory(category, category_);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList arguments = a.arguments();
+    arguments.removeFirst();
+
+    qint64 from = LLONG_MIN;
+    qint64 to = LLONG_MAX;
+    QByteArray category;
+    QString output;
+    QStringList inputs;
+    for(int i = 0; i < arguments.size(); i++){
+        const QString &arg = arguments[i];
+        bool has_value = i + 1 < arguments.size();
+        if(arg == "--from" && has_value){
+            if(!parseTime(arguments[++i], from)){
+                fprintf(stderr, "qtlog-query: invalid time %s\n", qPrintable(arguments[i]));
+                return 2;
+            }
+        }
+        else if(arg == "--to" && has_value){
+            if(!parseTime(arguments[++i], to)){
+                fprintf(stderr, "qtlog-query: invalid time %s\n", qPrintable(arguments[i]));
+                return 2;
+            }
+        }
+        else if(arg == "--category" && has_value)
+            category = arguments[++i].toUtf8();
+        else if(arg == "-o" && has_value)
+            output = arguments[++i];
+        else
+            inputs.append(arg);
+    }
+
+    if(inputs.isEmpty()){
+        fprintf(stderr, "usage: qtlog-query [--from time] [--to time] [--category name] [-o output] dir|file [...]\n"
+                        "       time: \"yyyy-MM-dd hh:mm:ss[.zzz]\"\n");
+        return 2;
+    }
+
+    FILE* out = stdout;
+    if(!output.isEmpty()){
+        out = fopen(QFile::encodeName(output).constData(), "wb");
+        if(!out){
+            fprintf(stderr, "qtlog-query: cannot open %s\n", qPrintable(output));
+            return 2;
+        }
+    }
+
+    Query query(out, from, to, category);
+    for(const QString &input : inputs)
+        query.addPath(input);
+    int result = query.run() ? 0 : 1;
+
+    if(out != stdout)
+        fclose(out);
+    return result;
+}
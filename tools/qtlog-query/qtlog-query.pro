@@ -0,0 +1,29 @@
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = qtlog-query
+
+# .gz旧日志和分块格式解压，Windows下使用Qt自带的zlib
+unix:LIBS += -lz
+
+# 以 CONFIG += qtlog_zstd 编译时支持.zst旧日志
+qtlog_zstd {
+    DEFINES += QTLOG_HAVE_ZSTD
+    LIBS += -lzstd
+}
+
+# 与qtlog共用索引和二进制格式定义，与qtlog-decode共用二进制解码
+INCLUDEPATH += $$PWD/../../qtlog $$PWD/../qtlog-decode
+
+HEADERS += \
+        $$PWD/../../qtlog/qtlogformat.h \
+        $$PWD/../../qtlog/qtlogcrc32c.h \
+        $$PWD/../../qtlog/qtlogblockreader.h \
+        $$PWD/../qtlog-decode/decoder.h
+
+SOURCES += \
+        $$PWD/../../qtlog/qtlogblockreader.cpp \
+        $$PWD/../qtlog-decode/decoder.cpp \
+        main.cpp
@@ -0,0 +1,196 @@
+﻿#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QStringList>
+#include <QThread>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "qtlogring.h"
+
+/**
+ * qtlog-ring
+ * 读取qtlog飞行记录器的共享内存环形缓冲区，输出与文本日志相同格式的日志行
+ *
+ * 用法: qtlog-ring [-f] [--unlink] [-o output] name
+ * 默认输出缓冲区中现有的全部日志后退出；-f 之后持续跟踪新日志，写入进程关闭缓冲区或退出后结束；
+ * --unlink 读取完成后删除共享内存。被覆盖或写入进程崩溃时未写完的日志跳过，数量输出到标准错误
+ */
+
+static const char SeverityLetters[] = "DIWCF";
+
+class Reader{
+public:
+    Reader(FILE *out, QtlogRingHeader *header):out_(out),header_(header),copy_(header->slotSize, Qt::Uninitialized),lost_(0){}
+
+    /** 输出从next到当前head之间的日志，wait为true时等待正在写入的日志写完 */
+    quint64 drain(quint64 next, bool wait);
+    quint64 lost() const{ return lost_; }
+
+private:
+    void print(const QtlogRingSlot *slot);
+
+    FILE* out_;
+    QtlogRingHeader* header_;
+    QByteArray copy_;
+    QByteArray line_;
+    quint64 lost_;
+};
+
+quint64 Reader::drain(quint64 next, bool wait)
+{
+    const quint64 head = header_->head.load(std::memory_order_acquire);
+    if(head - next > header_->slotCount){
+        /** 读取落后超过一圈，之前的日志已被覆盖 */
+        lost_ += head - header_->slotCount - next;
+        next = head - header_->slotCount;
+    }
+    while(next < head){
+        qtlogring::Status status = qtlogring::read(header_, next, copy_.data());
+        /** 生产者取得序号后正在写入，最多等待100ms，写入进程在写入中退出时不再等待 */
+        for(int retry = 0; wait && status == qtlogring::StatusPending && retry < 100; retry++){
+            QThread::msleep(1);
+            status = qtlogring::read(header_, next, copy_.data());
+        }
+        if(status == qtlogring::StatusOk)
+            print(reinterpret_cast<const QtlogRingSlot*>(copy_.constData()));
+        else
+            lost_++;
+        next++;
+    }
+    fflush(out_);
+    return next;
+}
+
+void Reader::print(const QtlogRingSlot *slot)
+{
+    const char* category = reinterpret_cast<const char*>(slot) + QTLOGR_SLOT_HEADER_SIZE;
+    const char* file = category + slot->categoryLength;
+    const char* message = file + slot->fileLength;
+
+    /** [<等级><pid> h:mm:ss.zzz 0x<线程>]file:line - category: msg */
+    line_.resize(0);
+    line_.append('[');
+    line_.append(slot->severity < 5 ? SeverityLetters[slot->severity] : '?');
+    line_.append(QByteArray::number(header_->pid));
+    line_.append(' ');
+    line_.append(QDateTime::fromMSecsSinceEpoch(slot->timestamp).toString("h:mm:ss.zzz").toLatin1());
+    /** 与文本日志格式 %{time h:mm:ss.zzz } %{qthreadptr} 一致，线程指针前两个空格 */
+    line_.append("  0x");
+    line_.append(QByteArray::number(slot->thread, 16));
+    line_.append(']');
+    if(header_->flags & QTLOGR_FLAG_FILELINE){
+        line_.append(file, slot->fileLength);
+        line_.append(':');
+        line_.append(QByteArray::number(slot->line));
+        line_.append(" -");
+    }
+    line_.append(' ');
+    QByteArray name(category, slot->categoryLength);
+    if((header_->flags & QTLOGR_FLAG_CATEGORY) && !name.isEmpty() && name != "default"){
+        line_.append(name);
+        line_.append(": ");
+    }
+    line_.append(message, slot->messageLength);
+    if(slot->flags & QTLOGR_SLOT_TRUNCATED)
+        line_.append(" [truncated]");
+    line_.append('\n');
+    fwrite(line_.constData(), 1, static_cast<size_t>(line_.size()), out_);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QStringList arguments = a.arguments();
+    arguments.removeFirst();
+
+    QString output;
+    QString name;
+    bool follow = false;
+    bool unlink_after = false;
+    for(int i = 0; i < arguments.size(); i++){
+        if(arguments[i] == "-o" && i + 1 < arguments.size())
+            output = arguments[++i];
+        else if(arguments[i] == "-f")
+            follow = true;
+        else if(arguments[i] == "--unlink")
+            unlink_after = true;
+        else
+            name = arguments[i];
+    }
+
+    if(name.isEmpty()){
+        fprintf(stderr, "usage: qtlog-ring [-f] [--unlink] [-o output] name\n");
+        return 2;
+    }
+    QByteArray path = QFile::encodeName(name.startsWith(QString("/")) ? name : QString("/") + name);
+
+    int fd = shm_open(path.constData(), O_RDONLY, 0);
+    if(fd < 0){
+        fprintf(stderr, "qtlog-ring: cannot open %s: %s\n", path.constData(), strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    void* base = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size >= QTLOGR_HEADER_SIZE)
+        base = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        fprintf(stderr, "qtlog-ring: cannot map %s\n", path.constData());
+        return 1;
+    }
+    QtlogRingHeader* header = static_cast<QtlogRingHeader*>(base);
+    if(!qtlogring::isValid(header, st.st_size)){
+        fprintf(stderr, "qtlog-ring: %s is not a qtlog flight recorder\n", path.constData());
+        munmap(base, static_cast<size_t>(st.st_size));
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if(!output.isEmpty()){
+        out = fopen(QFile::encodeName(output).constData(), "wb");
+        if(!out){
+            fprintf(stderr, "qtlog-ring: cannot open %s\n", qPrintable(output));
+            return 2;
+        }
+    }
+
+    /** 写入进程是否仍在运行，决定是否等待正在写入的日志 */
+    auto alive = [header](){
+        return header->closed.load(std::memory_order_acquire) == 0 &&
+                (kill(static_cast<pid_t>(header->pid), 0) == 0 || errno == EPERM);
+    };
+
+    Reader reader(out, header);
+    quint64 head = header->head.load(std::memory_order_acquire);
+    quint64 next = head > header->slotCount ? head - header->slotCount : 0;
+    next = reader.drain(next, alive());
+    while(follow){
+        bool running = alive();
+        next = reader.drain(next, running);
+        if(!running && next == header->head.load(std::memory_order_acquire))
+            break;
+        QThread::msleep(50);
+    }
+
+    if(reader.lost() > 0)
+        fprintf(stderr, "qtlog-ring: %llu records lost (overwritten or incomplete)\n",
+                static_cast<unsigned long long>(reader.lost()));
+    quint64 dropped = header->lost.load(std::memory_order_relaxed);
+    if(dropped > 0)
+        fprintf(stderr, "qtlog-ring: %llu records dropped by the writer (slot still in use)\n",
+                static_cast<unsigned long long>(dropped));
+
+    munmap(base, static_cast<size_t>(st.st_size));
+    if(unlink_after)
+        shm_unlink(path.constData());
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,18 @@
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = qtlog-ring
+
+# shm_open，glibc 2.34之前位于librt
+LIBS += -lrt
+
+# 与qtlog共用共享内存布局定义
+INCLUDEPATH += $$PWD/../../qtlog
+
+HEADERS += \
+        $$PWD/../../qtlog/qtlogring.h
+
+SOURCES += \
+        main.cpp